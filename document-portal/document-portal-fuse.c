@@ -23,6 +23,7 @@
 #include "document-portal-fuse.h"
 #include "document-store.h"
 #include "src/xdp-utils.h"
+#include "src/xdp-metrics.h"
 
 #ifndef O_FSYNC
 #define O_FSYNC O_SYNC
@@ -141,9 +142,11 @@ struct _XdpDomain {
 
   int doc_queued_invalidate; /* Access atomically, 1 if queued invalidate */
 
-  /* Below is mutable, protected by mutex */
-  GMutex  tempfile_mutex;
-  GHashTable *tempfiles; /* Name -> physical */
+  /* Below is mutable, protected by tempfile_lock. Lookups take it
+   * for reading, creating a tempfile only takes it for writing to
+   * insert it once it exists on disk. */
+  GRWLock  tempfile_lock;
+  GHashTable *tempfiles; /* Name -> XdpTempfile */
 };
 
 static void xdp_domain_unref (XdpDomain *domain);
@@ -155,6 +158,14 @@ typedef struct {
   gint ref_count; /* atomic */
   DevIno backing_devino;
   int fd; /* O_PATH fd */
+
+  /* xattr name -> time of ENODATA reply, protected by xattr_cache */
+  GHashTable *xattr_enodata;
+  guint xattr_generation;
+
+  /* Resolved host path, protected by real_path_cache */
+  char *real_path;
+  guint real_path_generation;
 } XdpPhysicalInode;
 
 static XdpPhysicalInode *xdp_physical_inode_ref   (XdpPhysicalInode *inode);
@@ -165,9 +176,10 @@ typedef struct {
   gint ref_count; /* atomic */
 
   char *name;      /* This changes over time (i.e. in renames)
-                      protected by domain->tempfile_mutex,
+                      protected by domain->tempfile_lock,
                       used as key in domain->tempfiles */
-  char *tempname;  /* Real filename on disk.
+  char *tempname;  /* Real filename on disk, NULL for O_TMPFILE files
+                      until they are renamed.
                       This can be NULLed to avoid unlink at finalize */
   XdpInode *inode;
 } XdpTempfile;
@@ -254,6 +266,17 @@ fd_to_path (int fd)
   return g_strdup_printf ("/proc/self/fd/%d", fd);
 }
 
+#define PROC_FD_PATH_SIZE (sizeof ("/proc/self/fd/") + 11)
+
+/* Like fd_to_path(), into a caller provided buffer */
+static const char *
+fd_to_path_buf (int  fd,
+                char buf[PROC_FD_PATH_SIZE])
+{
+  g_snprintf (buf, PROC_FD_PATH_SIZE, "/proc/self/fd/%d", fd);
+  return buf;
+}
+
 static char *
 open_flags_to_string (int flags)
 {
@@ -396,6 +419,77 @@ static GHashTable *physical_inodes;
 G_LOCK_DEFINE (physical_inodes);
 
 
+/* Renames and removals through fuse can change the path of any
+ * physical inode below them, so they invalidate all cached paths */
+static gint real_path_generation;
+
+G_LOCK_DEFINE (real_path_cache);
+
+static void
+real_path_invalidate_all (void)
+{
+  g_atomic_int_inc (&real_path_generation);
+}
+
+/* Changes whenever a path on the host may have changed through fuse */
+guint
+xdp_fuse_get_path_generation (void)
+{
+  return g_atomic_int_get (&real_path_generation);
+}
+
+static gboolean
+real_path_matches (const char       *path,
+                   XdpPhysicalInode *physical)
+{
+  struct stat buf;
+
+  return fstatat (AT_FDCWD, path, &buf, AT_SYMLINK_NOFOLLOW) == 0 &&
+         buf.st_dev == physical->backing_devino.dev &&
+         buf.st_ino == physical->backing_devino.ino;
+}
+
+/* Returns the host path of the inode, verified to still lead to it.
+ * The path is cached, so this only needs a readlink on /proc when
+ * something was renamed or removed since the last call. */
+static char *
+xdp_physical_inode_get_real_path (XdpPhysicalInode *physical)
+{
+  char fd_path[PROC_FD_PATH_SIZE];
+  char path_buffer[PATH_MAX + 1];
+  g_autofree char *cached = NULL;
+  guint generation;
+  ssize_t symlink_size;
+
+  generation = g_atomic_int_get (&real_path_generation);
+
+  G_LOCK (real_path_cache);
+  if (physical->real_path != NULL &&
+      physical->real_path_generation == generation)
+    cached = g_strdup (physical->real_path);
+  G_UNLOCK (real_path_cache);
+
+  /* Still catches changes made outside of fuse */
+  if (cached != NULL && real_path_matches (cached, physical))
+    return g_steal_pointer (&cached);
+
+  symlink_size = readlink (fd_to_path_buf (physical->fd, fd_path), path_buffer, PATH_MAX);
+  if (symlink_size < 1)
+    return NULL;
+  path_buffer[symlink_size] = 0;
+
+  if (!real_path_matches (path_buffer, physical))
+    return NULL;
+
+  G_LOCK (real_path_cache);
+  g_free (physical->real_path);
+  physical->real_path = g_strdup (path_buffer);
+  physical->real_path_generation = generation;
+  G_UNLOCK (real_path_cache);
+
+  return g_strdup (path_buffer);
+}
+
 /* Takes ownership of the o_path fd if passed in */
 static XdpPhysicalInode *
 ensure_physical_inode (dev_t dev, ino_t ino, int o_path_fd)
@@ -466,6 +560,8 @@ retry_atomic_decrement1:
 
       G_UNLOCK (physical_inodes);
 
+      g_clear_pointer (&inode->xattr_enodata, g_hash_table_unref);
+      g_free (inode->real_path);
       close (inode->fd);
       g_free (inode);
     }
@@ -493,7 +589,7 @@ xdp_domain_unref (XdpDomain *domain)
       g_clear_pointer (&domain->parent, xdp_domain_unref);
       g_clear_pointer (&domain->parent_inode, xdp_inode_unref);
       g_clear_pointer (&domain->tempfiles, g_hash_table_unref);
-      g_mutex_clear (&domain->tempfile_mutex);
+      g_rw_lock_clear (&domain->tempfile_lock);
       g_free (domain);
     }
 }
@@ -513,7 +609,7 @@ _xdp_domain_new (XdpDomainType type)
   XdpDomain *domain = g_new0 (XdpDomain, 1);
   domain->ref_count = 1;
   domain->type = type;
-  g_mutex_init (&domain->tempfile_mutex);
+  g_rw_lock_init (&domain->tempfile_lock);
   return domain;
 }
 
@@ -1007,8 +1103,44 @@ open_temp_at (int    dirfd,
   return -EEXIST;
 }
 
+/* Links an anonymous (O_TMPFILE) tempfile into the directory under a
+   temporary name, so it can be renamed. Called with tempfile lock held */
+static int
+xdp_tempfile_ensure_tempname (XdpTempfile *tempfile,
+                              int          dirfd)
+{
+  g_autofree char *fd_path = NULL;
+  g_autofree char *tmp = NULL;
+  const guint count_max = 100;
+
+  if (tempfile->tempname != NULL)
+    return 0;
+
+  fd_path = fd_to_path (tempfile->inode->physical->fd);
+  tmp = g_strconcat (".xdp-", tempfile->name, "-XXXXXX", NULL);
+
+  for (int count = 0; count < count_max; count++)
+    {
+      gen_temp_name (tmp);
+
+      if (linkat (AT_FDCWD, fd_path, dirfd, tmp, AT_SYMLINK_FOLLOW) == 0)
+        {
+          tempfile->tempname = g_steal_pointer (&tmp);
+          return 0;
+        }
+
+      /* E.g. EPERM with protected hardlinks. A copy would be a different
+         inode than the one open files and the fuse inode refer to, so
+         fail the rename instead */
+      if (errno != EEXIST)
+        return -errno;
+    }
+
+  return -EEXIST;
+}
+
 /* allocates tempfile for existing file,
-   Called with tempfile lock held, sets errno */
+   Called with tempfile lock held for writing, sets errno */
 static int
 get_tempfile_for (XdpInode *parent,
                   XdpDomain *domain,
@@ -1043,33 +1175,47 @@ get_tempfile_for (XdpInode *parent,
   return 0;
 }
 
-/* Creates a new file on disk,
-   Called with tempfile lock held, sets errno */
+/* Creates a new file on disk and registers it, unless another one
+   was registered under the same name meanwhile. Called without the
+   tempfile lock held, sets errno */
 static int
 create_tempfile (XdpInode *parent,
                  XdpDomain *domain,
                  const char *name,
                  int dirfd,
                  mode_t mode,
-                  XdpTempfile **tempfile_out)
+                 gboolean exclusive,
+                 XdpTempfile **tempfile_out)
 {
   g_autoptr(XdpInode) inode = NULL;
   g_autofree char *real_fd_path = NULL;
   xdp_autofd int real_fd = -1;
   xdp_autofd int o_path_fd = -1;
   g_autoptr(XdpTempfile) tempfile = NULL;
+  XdpTempfile *existing;
+  XdpTempfile *other = NULL;
   g_autofree char *tmpname = NULL;
   int res;
 
   if (tempfile_out != NULL)
     *tempfile_out = NULL;
 
-  real_fd = open_temp_at (dirfd, name, &tmpname, mode);
-  if (real_fd < 0)
-    return real_fd;
+  /* Prefer an anonymous file, which only gets a name on disk if it is
+   * renamed over the main file. An O_PATH fd keeps it alive. */
+  real_fd = openat (dirfd, ".", O_TMPFILE | O_RDWR | O_CLOEXEC, mode);
+  if (real_fd == -1)
+    {
+      /* Not supported by the kernel or filesystem */
+      if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)
+        return -errno;
+
+      real_fd = open_temp_at (dirfd, name, &tmpname, mode);
+      if (real_fd < 0)
+        return real_fd;
+    }
 
   real_fd_path = fd_to_path (real_fd);
-  o_path_fd = open (real_fd_path, O_PATH, 0);
+  o_path_fd = open (real_fd_path, O_PATH | O_CLOEXEC, 0);
   if (o_path_fd == -1)
     return -errno;
 
@@ -1082,8 +1228,25 @@ create_tempfile (XdpInode *parent,
 
   tempfile = xdp_tempfile_new (inode, name, tmpname);
 
-  /* This is atomic, because we're called with the lock held */
-  g_hash_table_replace (domain->tempfiles, tempfile->name, xdp_tempfile_ref (tempfile));
+  g_rw_lock_writer_lock (&domain->tempfile_lock);
+  existing = g_hash_table_lookup (domain->tempfiles, name);
+  if (existing == NULL)
+    g_hash_table_insert (domain->tempfiles, tempfile->name, xdp_tempfile_ref (tempfile));
+  else if (exclusive)
+    res = -EEXIST;
+  else
+    other = xdp_tempfile_ref (existing);
+  g_rw_lock_writer_unlock (&domain->tempfile_lock);
+
+  if (res != 0)
+    return res;
+
+  /* Lost the race, ours is removed from disk when freed */
+  if (other != NULL)
+    {
+      xdp_tempfile_unref (tempfile);
+      tempfile = g_steal_pointer (&other);
+    }
 
   if (tempfile_out)
     *tempfile_out = g_steal_pointer (&tempfile);
@@ -1150,7 +1313,7 @@ xdp_document_inode_open_child_fd (XdpInode *inode, const char *name, int open_fl
 
           /* Not main file, maybe a temporary file? */
 
-          g_mutex_lock (&domain->tempfile_mutex);
+          g_rw_lock_reader_lock (&domain->tempfile_lock);
 
           tempfile_lookup = g_hash_table_lookup (domain->tempfiles, name);
           if (tempfile_lookup)
@@ -1160,12 +1323,12 @@ xdp_document_inode_open_child_fd (XdpInode *inode, const char *name, int open_fl
               else
                 tempfile = xdp_tempfile_ref (tempfile_lookup);
             }
-          else if (open_flags & O_CREAT)
-            {
-              tempfile_res = create_tempfile (inode, domain, name, dirfd, mode, &tempfile);
-            }
 
-          g_mutex_unlock (&domain->tempfile_mutex);
+          g_rw_lock_reader_unlock (&domain->tempfile_lock);
+
+          if (tempfile_lookup == NULL && (open_flags & O_CREAT))
+            tempfile_res = create_tempfile (inode, domain, name, dirfd, mode,
+                                            (open_flags & O_EXCL) != 0, &tempfile);
 
           if (tempfile)
             {
@@ -1220,9 +1383,218 @@ tweak_statbuf_for_document_inode (XdpInode *inode,
     buf->st_mode &= ~(0222);
 }
 
+/* Fuse op tracing: when enabled, every op is recorded in a fixed
+ * size ring buffer that can be read back over D-Bus. Writers claim a
+ * slot with an atomic increment and publish it by storing its
+ * sequence number last, so readers can skip slots that are being
+ * overwritten. When disabled, the only cost is reading one flag.
+ */
+#define FUSE_TRACE_SIZE 4096
+
+typedef struct {
+  guint64 seq; /* slot number + 1, 0 while being written */
+  const char *op;
+  guint64 ino;
+  gint64 start;
+  guint32 duration;
+  gint32 err;
+  gint32 domain_type;
+} XdpFuseTraceRecord;
+
+static XdpFuseTraceRecord *fuse_trace = NULL;
+static guint64 fuse_trace_head = 0;
+static gint fuse_trace_enabled = FALSE; /* atomic */
+static GPrivate fuse_trace_errno;
+
+static const char *
+domain_type_to_string (int type)
+{
+  switch (type)
+    {
+    case XDP_DOMAIN_ROOT:
+      return "root";
+    case XDP_DOMAIN_BY_APP:
+      return "by-app";
+    case XDP_DOMAIN_APP:
+      return "app";
+    case XDP_DOMAIN_DOCUMENT:
+      return "document";
+    default:
+      return "";
+    }
+}
+
+static int
+xdp_fuse_trace_domain_type (fuse_ino_t ino)
+{
+  ino_t key = ino;
+  XdpInode *inode;
+  int type = -1;
+
+  G_LOCK (all_inodes);
+  inode = g_hash_table_lookup (all_inodes, &key);
+  if (inode)
+    type = inode->domain->type;
+  G_UNLOCK (all_inodes);
+
+  return type;
+}
+
+static void
+xdp_fuse_trace_record (const char *op,
+                       fuse_ino_t  ino,
+                       int         domain_type,
+                       gint64      start,
+                       gint64      duration,
+                       int         err)
+{
+  guint64 n = __atomic_fetch_add (&fuse_trace_head, 1, __ATOMIC_RELAXED);
+  XdpFuseTraceRecord *record = &fuse_trace[n % FUSE_TRACE_SIZE];
+
+  __atomic_store_n (&record->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  __atomic_store_n (&record->op, op, __ATOMIC_RELAXED);
+  __atomic_store_n (&record->ino, ino, __ATOMIC_RELAXED);
+  __atomic_store_n (&record->start, start, __ATOMIC_RELAXED);
+  __atomic_store_n (&record->duration, MIN (duration, G_MAXUINT32), __ATOMIC_RELAXED);
+  __atomic_store_n (&record->err, err, __ATOMIC_RELAXED);
+  __atomic_store_n (&record->domain_type, domain_type, __ATOMIC_RELAXED);
+
+  __atomic_store_n (&record->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+void
+xdp_fuse_trace_set_enabled (gboolean enabled)
+{
+  /* The buffer is never freed, so ops that saw the flag
+   * just before it was cleared can still write to it.
+   */
+  if (enabled && g_once_init_enter (&fuse_trace))
+    g_once_init_leave (&fuse_trace, g_new0 (XdpFuseTraceRecord, FUSE_TRACE_SIZE));
+
+  g_atomic_int_set (&fuse_trace_enabled, enabled);
+}
+
+/* Returns the buffered ops, oldest first, as a(sstxui):
+ * op, domain type, inode, start time and duration in
+ * microseconds, and errno.
+ */
+GVariant *
+xdp_fuse_trace_collect (void)
+{
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a(sstxui)"));
+  guint64 head, n;
+
+  if (fuse_trace == NULL)
+    return g_variant_builder_end (&builder);
+
+  head = __atomic_load_n (&fuse_trace_head, __ATOMIC_ACQUIRE);
+  n = head > FUSE_TRACE_SIZE ? head - FUSE_TRACE_SIZE : 0;
+
+  for (; n < head; n++)
+    {
+      XdpFuseTraceRecord *record = &fuse_trace[n % FUSE_TRACE_SIZE];
+      XdpFuseTraceRecord copy;
+
+      if (__atomic_load_n (&record->seq, __ATOMIC_ACQUIRE) != n + 1)
+        continue;
+
+      copy.op = __atomic_load_n (&record->op, __ATOMIC_RELAXED);
+      copy.ino = __atomic_load_n (&record->ino, __ATOMIC_RELAXED);
+      copy.start = __atomic_load_n (&record->start, __ATOMIC_RELAXED);
+      copy.duration = __atomic_load_n (&record->duration, __ATOMIC_RELAXED);
+      copy.err = __atomic_load_n (&record->err, __ATOMIC_RELAXED);
+      copy.domain_type = __atomic_load_n (&record->domain_type, __ATOMIC_RELAXED);
+
+      /* Skip it if a writer took the slot while we were reading */
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+      if (__atomic_load_n (&record->seq, __ATOMIC_RELAXED) != n + 1)
+        continue;
+
+      g_variant_builder_add (&builder, "(sstxui)",
+                             copy.op,
+                             domain_type_to_string (copy.domain_type),
+                             copy.ino,
+                             copy.start,
+                             copy.duration,
+                             copy.err);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+/* Times a fuse op from the start of its handler to the end of the
+ * scope, and declares the op name used for logging. The clock is
+ * only read when metrics or tracing are enabled.
+ */
+typedef struct {
+  const char *op;
+  fuse_ino_t ino;
+  gint64 start;
+  int domain_type;
+  gboolean traced;
+} XdpFuseOpTimer;
+
+static inline XdpFuseOpTimer
+xdp_fuse_op_timer_start (const char *op,
+                         fuse_ino_t  ino)
+{
+  XdpFuseOpTimer timer = { op, ino, 0, -1, FALSE };
+
+  if (G_UNLIKELY (g_atomic_int_get (&fuse_trace_enabled)))
+    {
+      timer.traced = TRUE;
+      timer.domain_type = xdp_fuse_trace_domain_type (ino);
+      g_private_set (&fuse_trace_errno, NULL);
+    }
+
+  if (G_UNLIKELY (xdp_metrics_enabled || timer.traced))
+    timer.start = g_get_monotonic_time ();
+
+  return timer;
+}
+
+static void
+xdp_fuse_op_timer_done (XdpFuseOpTimer *timer)
+{
+  char name[64];
+  gint64 duration;
+
+  if (G_LIKELY (timer->start == 0))
+    return;
+
+  duration = g_get_monotonic_time () - timer->start;
+
+  if (xdp_metrics_enabled)
+    {
+      g_snprintf (name, sizeof (name), "fuse/%s", timer->op);
+      xdp_metrics_histogram_add (xdp_metrics_histogram (name), duration);
+    }
+
+  if (timer->traced)
+    {
+      int err = GPOINTER_TO_INT (g_private_get (&fuse_trace_errno));
+
+      g_private_set (&fuse_trace_errno, NULL);
+      xdp_fuse_trace_record (timer->op, timer->ino, timer->domain_type,
+                             timer->start, duration, err);
+    }
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (XdpFuseOpTimer, xdp_fuse_op_timer_done)
+
+#define XDP_FUSE_OP(name, ino) \
+  const char *op G_GNUC_UNUSED = name; \
+  g_auto(XdpFuseOpTimer) op_timer = xdp_fuse_op_timer_start (op, ino)
+
 static void
 xdp_reply_err (const char *op, fuse_req_t req, int err)
 {
+  /* Picked up by the op timer when tracing */
+  if (G_UNLIKELY (g_atomic_int_get (&fuse_trace_enabled)))
+    g_private_set (&fuse_trace_errno, GINT_TO_POINTER (err));
+
   if (err != 0)
     {
       const char *errname = NULL;
@@ -1362,7 +1734,7 @@ xdp_fuse_getattr (fuse_req_t req,
   struct stat buf;
   int res;
   double attr_valid_time = 0.0;/* Time in secs for attribute validation */
-  const char *op = "GETATTR";
+  XDP_FUSE_OP ("GETATTR", ino);
 
   g_debug ("GETATTR %lx", ino);
 
@@ -1402,7 +1774,7 @@ xdp_fuse_setattr (fuse_req_t             req,
   struct stat buf;
   double attr_valid_time = 0.0;/* Time in secs for attribute validation */
   int res;
-  const char *op = "SETATTR";
+  XDP_FUSE_OP ("SETATTR", ino);
 
   g_debug ("SETATTR %lx %s", ino, to_set_string);
 
@@ -1695,8 +2067,11 @@ invalidate_doc_domain (gpointer user_data)
 
   XDP_AUTOLOCK (session);
   if (session && g_atomic_int_get (&doc_domain->parent_inode->kernel_ref_count) > 0)
-    fuse_lowlevel_notify_inval_entry (session, parent_ino, doc_domain->doc_id,
-                                      strlen (doc_domain->doc_id));
+    {
+      fuse_lowlevel_notify_inval_entry (session, parent_ino, doc_domain->doc_id,
+                                        strlen (doc_domain->doc_id));
+      xdp_metrics_count ("fuse/invalidations");
+    }
 
   return FALSE;
 }
@@ -1728,7 +2103,7 @@ xdp_fuse_lookup (fuse_req_t req,
   struct fuse_entry_param e;
   int res, fd;
   int open_flags = O_PATH|O_NOFOLLOW;
-  const char *op = "LOOKUP";
+  XDP_FUSE_OP ("LOOKUP", parent_ino);
 
   g_debug ("LOOKUP %lx:%s", parent_ino, name);
 
@@ -1813,7 +2188,7 @@ xdp_fuse_open (fuse_req_t req,
   g_autofree char *path = NULL;
   XdpFile *file = NULL;
   XdpDocumentChecks checks;
-  const char *op = "OPEN";
+  XDP_FUSE_OP ("OPEN", ino);
 
   g_debug ("OPEN %lx %s", ino, open_flags_string);
 
@@ -1856,7 +2231,7 @@ xdp_fuse_create (fuse_req_t             req,
   xdp_autofd int o_path_fd = -1;
   g_autofree char *fd_path = NULL;
   XdpFile *file = NULL;
-  const char *op = "CREATE";
+  XDP_FUSE_OP ("CREATE", parent_ino);
 
   g_debug ("CREATE %lx %s %s, 0%o", parent_ino, filename, open_flags_string, mode);
 
@@ -1898,6 +2273,7 @@ xdp_fuse_read (fuse_req_t req,
 {
   struct fuse_bufvec buf = FUSE_BUFVEC_INIT(size);
   XdpFile *file = (XdpFile *)fi->fh;
+  XDP_FUSE_OP ("READ", ino);
 
   g_debug ("READ %lx size %ld off %ld", ino, size, off);
 
@@ -1919,7 +2295,7 @@ xdp_fuse_write (fuse_req_t             req,
 {
   XdpFile *file = (XdpFile *)fi->fh;
   ssize_t res;
-  const char *op = "WRITE";
+  XDP_FUSE_OP ("WRITE", ino);
 
   g_debug ("WRITE %lx size %ld off %ld", ino, size, off);
 
@@ -1941,7 +2317,7 @@ xdp_fuse_write_buf (fuse_req_t             req,
   XdpFile *file = (XdpFile *)fi->fh;
   struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(bufv));
   ssize_t res;
-  const char *op = "WRITEBUF";
+  XDP_FUSE_OP ("WRITEBUF", ino);
 
   g_debug ("WRITEBUF %lx off %ld", ino, off);
 
@@ -1964,7 +2340,7 @@ xdp_fuse_fsync (fuse_req_t             req,
 {
   XdpFile *file = (XdpFile *)fi->fh;
   int res;
-  const char *op = "FSYNC";
+  XDP_FUSE_OP ("FSYNC", ino);
 
   g_debug ("FSYNC %lx", ino);
 
@@ -1988,7 +2364,7 @@ xdp_fuse_fallocate (fuse_req_t req,
 {
   XdpFile *file = (XdpFile *)fi->fh;
   int res;
-  const char *op = "FALLOCATE";
+  XDP_FUSE_OP ("FALLOCATE", ino);
 
   g_debug ("FALLOCATE %lx", ino);
 
@@ -2005,7 +2381,7 @@ xdp_fuse_flush (fuse_req_t req,
                 fuse_ino_t ino,
                 struct fuse_file_info *fi)
 {
-  const char *op = "FLUSH";
+  XDP_FUSE_OP ("FLUSH", ino);
 
   g_debug ("FLUSH %lx", ino);
   xdp_reply_err (op, req, 0);
@@ -2017,7 +2393,7 @@ xdp_fuse_release (fuse_req_t             req,
                   struct fuse_file_info *fi)
 {
   XdpFile *file = (XdpFile *)fi->fh;
-  const char *op = "RELEASE";
+  XDP_FUSE_OP ("RELEASE", ino);
 
   g_debug ("RELEASE %lx", ino);
 
@@ -2041,6 +2417,8 @@ xdp_fuse_forget (fuse_req_t req,
                  fuse_ino_t ino,
                  unsigned long nlookup)
 {
+  XDP_FUSE_OP ("FORGET", ino);
+
   forget_one (ino, nlookup);
   fuse_reply_none (req);
 }
@@ -2051,6 +2429,7 @@ xdp_fuse_forget_multi (fuse_req_t req,
                        struct fuse_forget_data *forgets)
 {
   size_t i;
+  XDP_FUSE_OP ("FORGET_MULTI", 0);
 
   g_debug ("FORGET_MULTI %ld", count);
 
@@ -2167,7 +2546,7 @@ xdp_fuse_opendir (fuse_req_t             req,
   XdpDir *d = NULL;
   int open_flags = O_RDONLY | O_DIRECTORY;
   DIR *dir;
-  const char *op = "OPENDIR";
+  XDP_FUSE_OP ("OPENDIR", ino);
 
   g_debug ("OPENDIR %lx domain %d", ino, inode->domain->type);
 
@@ -2238,7 +2617,7 @@ xdp_fuse_opendir (fuse_req_t             req,
           if (stat (main_path, &buf) == 0)
             xdp_dir_add (d, req, domain->doc_file, buf.st_mode);
 
-          g_mutex_lock (&domain->tempfile_mutex);
+          g_rw_lock_reader_lock (&domain->tempfile_lock);
 
           g_hash_table_iter_init (&iter, domain->tempfiles);
           while (g_hash_table_iter_next (&iter, &key, &value))
@@ -2247,7 +2626,7 @@ xdp_fuse_opendir (fuse_req_t             req,
               xdp_dir_add (d, req, tempname, S_IFREG);
             }
 
-          g_mutex_unlock (&domain->tempfile_mutex);
+          g_rw_lock_reader_unlock (&domain->tempfile_lock);
         }
     }
 
@@ -2270,7 +2649,7 @@ xdp_fuse_readdir (fuse_req_t req,
   XdpDir *d = (XdpDir *)fi->fh;
   char *p;
   size_t rem;
-  const char *op = "READDIR";
+  XDP_FUSE_OP ("READDIR", ino);
 
   g_debug ("READDIR %lx %ld %ld", ino, size, off);
 
@@ -2356,7 +2735,7 @@ xdp_fuse_releasedir (fuse_req_t             req,
                      struct fuse_file_info *fi)
 {
   XdpDir *d = (XdpDir *)fi->fh;
-  const char *op = "RELEASEDIR";
+  XDP_FUSE_OP ("RELEASEDIR", ino);
 
   g_debug ("RELEASEDIR %lx", ino);
 
@@ -2373,7 +2752,7 @@ xdp_fuse_fsyncdir (fuse_req_t             req,
 {
   XdpDir *dir = (XdpDir *)fi->fh;
   int fd, res;
-  const char *op = "FSYNCDIR";
+  XDP_FUSE_OP ("FSYNCDIR", ino);
 
   g_debug ("FSYNCDIR %lx", ino);
 
@@ -2405,7 +2784,7 @@ xdp_fuse_mkdir (fuse_req_t  req,
   int res;
   xdp_autofd int close_fd = -1;
   int dirfd;
-  const char *op = "MKDIR";
+  XDP_FUSE_OP ("MKDIR", parent_ino);
 
   g_debug ("MKDIR %lx %s", parent_ino, name);
 
@@ -2439,7 +2818,7 @@ xdp_fuse_unlink (fuse_req_t  req,
   g_autoptr(XdpInode) parent = xdp_inode_from_ino (parent_ino);
   XdpDomain *parent_domain = parent->domain;
   int res = -1;
-  const char * op = "UNLINK";
+  XDP_FUSE_OP ("UNLINK", parent_ino);
 
   g_debug ("UNLINK %lx %s", parent_ino, filename);
 
@@ -2453,6 +2832,8 @@ xdp_fuse_unlink (fuse_req_t  req,
       res = unlinkat (parent->physical->fd, filename, 0);
       if (res != 0)
         return xdp_reply_err (op, req, errno);
+
+      real_path_invalidate_all ();
     }
   else
     {
@@ -2472,15 +2853,18 @@ xdp_fuse_unlink (fuse_req_t  req,
         }
       else
         {
-          gboolean removed = FALSE;
+          gpointer removed = NULL;
 
           /* Not directory and not main file, maybe a temporary file? */
-          g_mutex_lock (&parent_domain->tempfile_mutex);
-          removed = g_hash_table_remove (parent_domain->tempfiles, filename);
-          g_mutex_unlock (&parent_domain->tempfile_mutex);
+          g_rw_lock_writer_lock (&parent_domain->tempfile_lock);
+          g_hash_table_steal_extended (parent_domain->tempfiles, filename, NULL, &removed);
+          g_rw_lock_writer_unlock (&parent_domain->tempfile_lock);
 
-          if (!removed)
+          if (removed == NULL)
             return xdp_reply_err (op, req, ENOENT);
+
+          /* Unlinks it on disk, if it has a name there */
+          xdp_tempfile_unref (removed);
         }
     }
 
@@ -2525,7 +2909,7 @@ xdp_fuse_rename (fuse_req_t  req,
   int olddirfd, newdirfd, dirfd;
   xdp_autofd int close_fd1 = -1;
   xdp_autofd int close_fd2 = -1;
-  const char *op = "RENAME";
+  XDP_FUSE_OP ("RENAME", parent_ino);
 
   g_debug ("RENAME %lx %s -> %lx %s (flags: %s)", parent_ino, name,
            newparent_ino, newname, rename_flags_string);
@@ -2554,6 +2938,8 @@ xdp_fuse_rename (fuse_req_t  req,
       if (res != 0)
         return xdp_reply_err (op, req, errno);
 
+      real_path_invalidate_all ();
+
       xdp_reply_err (op, req, 0);
     }
   else
@@ -2583,7 +2969,7 @@ xdp_fuse_rename (fuse_req_t  req,
             return xdp_reply_err (op, req, -tmp_fd);
           close (tmp_fd);
 
-          g_mutex_lock (&domain->tempfile_mutex);
+          g_rw_lock_writer_lock (&domain->tempfile_lock);
           res = try_renameat (dirfd, name, dirfd, tmpname, flags);
           if (res == -1)
             {
@@ -2596,7 +2982,7 @@ xdp_fuse_rename (fuse_req_t  req,
               res = get_tempfile_for (parent, domain, newname, dirfd, tmpname, NULL);
             }
 
-          g_mutex_unlock (&domain->tempfile_mutex);
+          g_rw_lock_writer_unlock (&domain->tempfile_lock);
 
           if (res != 0)
             return xdp_reply_err (op, req, -res);
@@ -2609,14 +2995,23 @@ xdp_fuse_rename (fuse_req_t  req,
 
           /* source is (maybe) tempfile, Destination is main file */
 
-          g_mutex_lock (&domain->tempfile_mutex);
+          g_rw_lock_writer_lock (&domain->tempfile_lock);
           if (g_hash_table_steal_extended (domain->tempfiles, name,
                                            NULL, &stolen_value))
             {
               XdpTempfile *tempfile = stolen_value;
 
-              res = try_renameat (dirfd, tempfile->tempname, dirfd, newname, flags);
-              errsv = errno;
+              res = xdp_tempfile_ensure_tempname (tempfile, dirfd);
+              if (res == 0)
+                {
+                  res = try_renameat (dirfd, tempfile->tempname, dirfd, newname, flags);
+                  errsv = errno;
+                }
+              else
+                {
+                  errsv = -res;
+                  res = -1;
+                }
 
               if (res == -1) /* Revert tempfile steal */
                 g_hash_table_replace (domain->tempfiles, tempfile->name, tempfile);
@@ -2633,7 +3028,7 @@ xdp_fuse_rename (fuse_req_t  req,
               errsv = ENOENT;
             }
 
-          g_mutex_unlock (&domain->tempfile_mutex);
+          g_rw_lock_writer_unlock (&domain->tempfile_lock);
 
           if (res != 0)
             return xdp_reply_err (op, req, errsv);
@@ -2647,7 +3042,7 @@ xdp_fuse_rename (fuse_req_t  req,
           gpointer stolen_value;
 
           /* Renaming temp file to temp file */
-          g_mutex_lock (&domain->tempfile_mutex);
+          g_rw_lock_writer_lock (&domain->tempfile_lock);
           if (g_hash_table_steal_extended (domain->tempfiles, name,
                                             NULL, &stolen_value))
             {
@@ -2661,7 +3056,7 @@ xdp_fuse_rename (fuse_req_t  req,
               /* This destroys any pre-existing tempfile with this name */
               g_hash_table_replace (domain->tempfiles, tempfile->name, tempfile);
           }
-          g_mutex_unlock (&domain->tempfile_mutex);
+          g_rw_lock_writer_unlock (&domain->tempfile_lock);
 
           if (!found_tempfile)
             return xdp_reply_err (op, req, ENOENT);
@@ -2679,7 +3074,7 @@ xdp_fuse_access (fuse_req_t req,
   g_autoptr(XdpInode) inode = xdp_inode_from_ino (ino);
   g_autofree char *path = NULL;
   int res;
-  const char *op = "ACCESS";
+  XDP_FUSE_OP ("ACCESS", ino);
 
   g_debug ("ACCESS %lx", ino);
 
@@ -2730,7 +3125,7 @@ xdp_fuse_rmdir (fuse_req_t req,
   xdp_autofd int close_fd = -1;
   int dirfd;
   int res;
-  const char *op = "RMDIR";
+  XDP_FUSE_OP ("RMDIR", parent_ino);
 
   g_debug ("RMDIR %lx %s", parent_ino, filename);
 
@@ -2746,7 +3141,9 @@ xdp_fuse_rmdir (fuse_req_t req,
 
   res = unlinkat (dirfd, filename, AT_REMOVEDIR);
   if (res != 0)
-    xdp_reply_err (op, req, errno);
+    return xdp_reply_err (op, req, errno);
+
+  real_path_invalidate_all ();
 
   xdp_reply_err (op, req, 0);
 }
@@ -2758,7 +3155,7 @@ xdp_fuse_readlink (fuse_req_t req,
   g_autoptr(XdpInode) inode = xdp_inode_from_ino (ino);
   char linkname[PATH_MAX + 1];
   ssize_t res;
-  const char *op = "READLINK";
+  XDP_FUSE_OP ("READLINK", ino);
 
   g_debug ("READLINK %lx", ino);
 
@@ -2789,7 +3186,7 @@ xdp_fuse_symlink (fuse_req_t req,
   int dirfd;
   xdp_autofd int close_fd = -1;
   struct fuse_entry_param e;
-  const char * op = "SYMLINK";
+  XDP_FUSE_OP ("SYMLINK", parent_ino);
 
   g_debug ("SYMLINK %s %lx %s", link, parent_ino, name);
 
@@ -2828,7 +3225,7 @@ xdp_fuse_link (fuse_req_t req,
   int newparent_dirfd;
   xdp_autofd int close_fd = -1;
   struct fuse_entry_param e;
-  const char * op = "LINK";
+  XDP_FUSE_OP ("LINK", ino);
 
   g_debug ("LINK %lx %lx %s", ino, newparent_ino, newname);
 
@@ -2868,7 +3265,7 @@ xdp_fuse_statfs (fuse_req_t req,
   g_autoptr(XdpInode) inode = xdp_inode_from_ino (ino);
   struct statvfs buf;
   int res;
-  const char *op = "STATFS";
+  XDP_FUSE_OP ("STATFS", ino);
 
   g_debug ("STATFS %lx", ino);
 
@@ -2886,6 +3283,73 @@ xdp_fuse_statfs (fuse_req_t req,
     xdp_reply_err (op, req, errno);
 }
 
+/* File managers probe the same missing xattrs over and over, so
+ * remember ENODATA replies for a short while. Changes made through
+ * fuse drop the cache, changes made outside show up after the TTL. */
+#define XATTR_ENODATA_TTL_USEC (1 * G_USEC_PER_SEC)
+#define XATTR_ENODATA_MAX 64
+
+G_LOCK_DEFINE (xattr_cache);
+
+/* Also returns the generation to pass to set_missing, so that a reply
+ * racing with a change through fuse isn't cached */
+static gboolean
+xdp_physical_inode_xattr_is_missing (XdpPhysicalInode *physical,
+                                     const char       *name,
+                                     guint            *generation_out)
+{
+  gboolean res = FALSE;
+  gpointer value;
+
+  G_LOCK (xattr_cache);
+  *generation_out = physical->xattr_generation;
+  if (physical->xattr_enodata != NULL &&
+      g_hash_table_lookup_extended (physical->xattr_enodata, name, NULL, &value))
+    {
+      gint64 *when = value;
+
+      if (g_get_monotonic_time () - *when < XATTR_ENODATA_TTL_USEC)
+        res = TRUE;
+      else
+        g_hash_table_remove (physical->xattr_enodata, name);
+    }
+  G_UNLOCK (xattr_cache);
+
+  return res;
+}
+
+static void
+xdp_physical_inode_xattr_set_missing (XdpPhysicalInode *physical,
+                                      const char       *name,
+                                      guint             generation)
+{
+  gint64 *when;
+
+  G_LOCK (xattr_cache);
+  if (physical->xattr_generation == generation)
+    {
+      if (physical->xattr_enodata == NULL)
+        physical->xattr_enodata = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+      else if (g_hash_table_size (physical->xattr_enodata) >= XATTR_ENODATA_MAX)
+        g_hash_table_remove_all (physical->xattr_enodata);
+
+      when = g_new (gint64, 1);
+      *when = g_get_monotonic_time ();
+      g_hash_table_replace (physical->xattr_enodata, g_strdup (name), when);
+    }
+  G_UNLOCK (xattr_cache);
+}
+
+static void
+xdp_physical_inode_xattr_invalidate (XdpPhysicalInode *physical)
+{
+  G_LOCK (xattr_cache);
+  physical->xattr_generation++;
+  if (physical->xattr_enodata != NULL)
+    g_hash_table_remove_all (physical->xattr_enodata);
+  G_UNLOCK (xattr_cache);
+}
+
 static void
 xdp_fuse_setxattr (fuse_req_t req,
                    fuse_ino_t ino,
@@ -2896,8 +3360,9 @@ xdp_fuse_setxattr (fuse_req_t req,
 {
   g_autoptr(XdpInode) inode = xdp_inode_from_ino (ino);
   ssize_t res;
-  g_autofree char *path = NULL;
-  const char *op = "SETXATTR";
+  int errsv;
+  char path_buf[PROC_FD_PATH_SIZE];
+  XDP_FUSE_OP ("SETXATTR", ino);
 
   g_debug ("SETXATTR %lx %s", ino, name);
 
@@ -2907,11 +3372,12 @@ xdp_fuse_setxattr (fuse_req_t req,
                                   CHECK_IS_PHYSICAL))
     return;
 
-  path = fd_to_path (inode->physical->fd);
-  res = setxattr (path, name, value, size, flags);
+  res = setxattr (fd_to_path_buf (inode->physical->fd, path_buf), name, value, size, flags);
+  errsv = errno;
+  xdp_physical_inode_xattr_invalidate (inode->physical);
 
   if (res < 0)
-    return xdp_reply_err (op, req, errno);
+    return xdp_reply_err (op, req, errsv);
 
   xdp_reply_err (op, req, 0);
 }
@@ -2926,21 +3392,42 @@ xdp_fuse_getxattr (fuse_req_t req,
   ssize_t res;
   g_autofree char *buf = NULL;
   g_autofree char *path = NULL;
-  const char *op = "GETXATTR";
+  char path_buf[PROC_FD_PATH_SIZE];
+  guint generation = 0;
+  XDP_FUSE_OP ("GETXATTR", ino);
 
   g_debug ("GETXATTR %lx %s %ld", ino, name, size);
 
   if (inode->domain->type != XDP_DOMAIN_DOCUMENT)
     return xdp_reply_err (op, req, ENODATA);
 
+  if (inode->physical &&
+      xdp_physical_inode_xattr_is_missing (inode->physical, name, &generation))
+    return xdp_reply_err (op, req, ENODATA);
+
   if (size != 0)
     buf = g_malloc (size);
 
-  path = xdp_document_inode_get_self_as_path (inode);
-  if (path == NULL)
-    res = ENODATA;
+  if (inode->physical)
+    {
+      res = getxattr (fd_to_path_buf (inode->physical->fd, path_buf), name, buf, size);
+      if (res < 0 && errno == ENODATA)
+        {
+          xdp_physical_inode_xattr_set_missing (inode->physical, name, generation);
+          errno = ENODATA;
+        }
+    }
   else
-    res = getxattr (path, name, buf, size);
+    {
+      path = xdp_document_inode_get_self_as_path (inode);
+      if (path == NULL)
+        {
+          res = -1;
+          errno = ENODATA;
+        }
+      else
+        res = getxattr (path, name, buf, size);
+    }
   if (res < 0)
     return xdp_reply_err (op, req, errno);
 
@@ -2959,7 +3446,8 @@ xdp_fuse_listxattr (fuse_req_t req,
   ssize_t res;
   g_autofree char *buf = NULL;
   g_autofree char *path = NULL;
-  const char *op = "LISTXATTR";
+  char path_buf[PROC_FD_PATH_SIZE];
+  XDP_FUSE_OP ("LISTXATTR", ino);
 
   g_debug ("LISTXATTR %lx %ld", ino, size);
 
@@ -2969,11 +3457,16 @@ xdp_fuse_listxattr (fuse_req_t req,
   if (size != 0)
     buf = g_malloc (size);
 
-  path = xdp_document_inode_get_self_as_path (inode);
-  if (path)
-    res = listxattr (path, buf, size);
+  if (inode->physical)
+    res = listxattr (fd_to_path_buf (inode->physical->fd, path_buf), buf, size);
   else
-    res = 0;
+    {
+      path = xdp_document_inode_get_self_as_path (inode);
+      if (path)
+        res = listxattr (path, buf, size);
+      else
+        res = 0;
+    }
 
   if (res < 0)
     return xdp_reply_err (op, req, errno);
@@ -2990,9 +3483,10 @@ xdp_fuse_removexattr (fuse_req_t req,
                       const char *name)
 {
   g_autoptr(XdpInode) inode = xdp_inode_from_ino (ino);
-  g_autofree char *path = NULL;
+  char path_buf[PROC_FD_PATH_SIZE];
   ssize_t res;
-  const char *op = "REMOVEXATTR";
+  int errsv;
+  XDP_FUSE_OP ("REMOVEXATTR", ino);
 
   g_debug ("REMOVEXATTR %lx %s", ino, name);
 
@@ -3002,11 +3496,12 @@ xdp_fuse_removexattr (fuse_req_t req,
                                   CHECK_IS_PHYSICAL))
     return;
 
-  path = fd_to_path (inode->physical->fd);
-  res = removexattr (path, name);
+  res = removexattr (fd_to_path_buf (inode->physical->fd, path_buf), name);
+  errsv = errno;
+  xdp_physical_inode_xattr_invalidate (inode->physical);
 
   if (res < 0)
-    xdp_reply_err (op, req, errno);
+    xdp_reply_err (op, req, errsv);
   else
     xdp_reply_err (op, req, 0);
 }
@@ -3017,7 +3512,7 @@ xdp_fuse_getlk (fuse_req_t req,
                 struct fuse_file_info *fi,
                 struct flock *lock)
 {
-  const char *op = "GETLK";
+  XDP_FUSE_OP ("GETLK", ino);
 
   g_debug ("GETLK %lx", ino);
 
@@ -3031,7 +3526,7 @@ xdp_fuse_setlk (fuse_req_t req,
                 struct flock *lock,
                 int sleep)
 {
-  const char *op = "SETLK";
+  XDP_FUSE_OP ("SETLK", ino);
 
   g_debug ("SETLK %lx", ino);
 
@@ -3044,7 +3539,7 @@ xdp_fuse_flock (fuse_req_t req,
                 struct fuse_file_info *fi,
                 int lock_op)
 {
-  const char *op = "FLOCK";
+  XDP_FUSE_OP ("FLOCK", ino);
 
   g_debug ("FLOCK %lx", ino);
 
@@ -3407,9 +3902,38 @@ xdp_fuse_invalidate_doc_app (const char *doc_id,
         }
       else
         fuse_lowlevel_notify_inval_inode (session, invalidate->ino, 0, 0);
+
+      xdp_metrics_count ("fuse/invalidations");
     }
 }
 
+guint64
+xdp_fuse_get_n_inodes (void)
+{
+  guint64 n = 0;
+
+  G_LOCK (all_inodes);
+  if (all_inodes)
+    n = g_hash_table_size (all_inodes);
+  G_UNLOCK (all_inodes);
+
+  return n;
+}
+
+/* Each physical inode holds an O_PATH fd */
+guint64
+xdp_fuse_get_n_physical_inodes (void)
+{
+  guint64 n = 0;
+
+  G_LOCK (physical_inodes);
+  if (physical_inodes)
+    n = g_hash_table_size (physical_inodes);
+  G_UNLOCK (physical_inodes);
+
+  return n;
+}
+
 char *
 xdp_fuse_lookup_id_for_inode (ino_t ino, gboolean directory,
                               char **real_path_out)
@@ -3473,25 +3997,12 @@ xdp_fuse_lookup_id_for_inode (ino_t ino, gboolean directory,
       /* But maybe its a subfile of the document */
       if (real_path_out)
         {
-          g_autofree char *fd_path = fd_to_path (physical->fd);
-          char path_buffer[PATH_MAX + 1];
-          DevIno file_devino = physical->backing_devino;
-          ssize_t symlink_size;
-          struct stat buf;
+          g_autofree char *real_path = xdp_physical_inode_get_real_path (physical);
 
-          /* Try to extract a real path to the file (and verify it goes to the same place as the fd) */
-          symlink_size = readlink (fd_path, path_buffer, PATH_MAX);
-          if (symlink_size >= 1)
+          if (real_path != NULL)
             {
-              path_buffer[symlink_size] = 0;
-
-              if (lstat (path_buffer, &buf) == 0 &&
-                  buf.st_dev == file_devino.dev &&
-                  buf.st_ino == file_devino.ino)
-                {
-                  *real_path_out = g_strdup (path_buffer);
-                  return g_strdup (domain->doc_id);
-                }
+              *real_path_out = g_steal_pointer (&real_path);
+              return g_strdup (domain->doc_id);
             }
         }
     }
@@ -18,6 +18,11 @@ void        xdp_fuse_invalidate_doc_app (const char *doc_id,
 char      *xdp_fuse_lookup_id_for_inode (ino_t    inode,
                                          gboolean directory,
                                          char   **real_path_out);
+guint64     xdp_fuse_get_n_inodes (void);
+guint64     xdp_fuse_get_n_physical_inodes (void);
+guint       xdp_fuse_get_path_generation (void);
+void        xdp_fuse_trace_set_enabled (gboolean enabled);
+GVariant   *xdp_fuse_trace_collect (void);
 
 
 G_END_DECLS
@@ -15,6 +15,8 @@
 #include "document-portal-dbus.h"
 #include "document-store.h"
 #include "src/xdp-utils.h"
+#include "src/xdp-metrics.h"
+#include "src/xdp-profile.h"
 #include "permission-db.h"
 #include "permission-store-dbus.h"
 #include "document-portal-fuse.h"
@@ -44,27 +46,33 @@ static GError *exit_error = NULL;
 static dev_t fuse_dev = 0;
 static GQueue get_mount_point_invocations = G_QUEUE_INIT;
 static XdpDbusDocuments *dbus_api;
+static gboolean trace_fuse = FALSE;
+/* "dev:ino:flags:path" -> GPtrArray of doc ids, protected by the db lock */
+static GHashTable *path_index = NULL;
+/* Ids of transient documents, protected by the db lock */
+static GHashTable *transient_ids = NULL;
+static guint transient_checkpoint_id = 0; /* Protected by the db lock */
 
 G_LOCK_DEFINE (db);
 
 char **
 xdp_list_apps (void)
 {
-  XDP_AUTOLOCK (db);
+  XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
   return permission_db_list_apps (db);
 }
 
 char **
 xdp_list_docs (void)
 {
-  XDP_AUTOLOCK (db);
+  XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
   return permission_db_list_ids (db);
 }
 
 PermissionDbEntry *
 xdp_lookup_doc (const char *doc_id)
 {
-  XDP_AUTOLOCK (db);
+  XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
   return permission_db_lookup (db, doc_id);
 }
 
@@ -76,6 +84,269 @@ persist_entry (PermissionDbEntry *entry)
   return (flags & DOCUMENT_ENTRY_FLAG_TRANSIENT) == 0;
 }
 
+/* Transient documents are not in the permission store, so they are
+ * checkpointed to the runtime dir. A restarted portal gets them back
+ * with the same ids, so the paths apps hold keep working. */
+#define TRANSIENT_CHECKPOINT_DELAY_MS 100
+
+static char *
+transient_checkpoint_path (void)
+{
+  return g_build_filename (g_get_user_runtime_dir (),
+                           "xdg-document-portal", "transient-documents", NULL);
+}
+
+/* Must be called with the db lock held */
+static GVariant *
+transient_serialize (void)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(va{sas})}"));
+
+  g_hash_table_iter_init (&iter, transient_ids);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      g_autoptr(PermissionDbEntry) entry = permission_db_lookup (db, key);
+      g_autoptr(GVariant) data = NULL;
+
+      if (entry == NULL)
+        continue;
+
+      data = permission_db_entry_get_data (entry);
+      g_variant_builder_add (&builder, "{s(@v@a{sas})}", key,
+                             g_variant_new_variant (data),
+                             permission_db_entry_get_app_permissions (entry));
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+transient_checkpoint (void)
+{
+  g_autoptr(GVariant) state = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *path = transient_checkpoint_path ();
+  g_autofree char *dir = g_path_get_dirname (path);
+
+  {
+    XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
+
+    g_clear_handle_id (&transient_checkpoint_id, g_source_remove);
+    state = transient_serialize ();
+  }
+
+  if (g_mkdir_with_parents (dir, 0700) != 0)
+    {
+      g_warning ("Failed to create %s: %s", dir, g_strerror (errno));
+      return;
+    }
+
+  if (!g_file_set_contents (path,
+                            g_variant_get_data (state),
+                            g_variant_get_size (state),
+                            &error))
+    g_warning ("Failed to save transient documents to %s: %s", path, error->message);
+}
+
+static gboolean
+transient_checkpoint_cb (gpointer user_data)
+{
+  {
+    XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
+
+    /* Don't remove the source we are called from */
+    transient_checkpoint_id = 0;
+  }
+
+  transient_checkpoint ();
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Must be called with the db lock held */
+static void
+transient_changed (const char *id,
+                   gboolean    exists)
+{
+  if (exists)
+    g_hash_table_add (transient_ids, g_strdup (id));
+  else
+    g_hash_table_remove (transient_ids, id);
+
+  /* Batch changes that happen close together */
+  if (transient_checkpoint_id == 0)
+    transient_checkpoint_id = g_timeout_add_full (G_PRIORITY_LOW,
+                                                  TRANSIENT_CHECKPOINT_DELAY_MS,
+                                                  transient_checkpoint_cb,
+                                                  NULL, NULL);
+}
+
+/* Adds the transient documents of a previous instance to the db */
+static void
+transient_restore (void)
+{
+  g_autofree char *path = transient_checkpoint_path ();
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GVariant) state = NULL;
+  g_autoptr(GVariant) data = NULL;
+  g_autoptr(GVariant) apps = NULL;
+  GVariantIter iter;
+  const char *id;
+  char *contents;
+  gsize length;
+
+  transient_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  if (!g_file_get_contents (path, &contents, &length, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Failed to load transient documents from %s: %s", path, error->message);
+      return;
+    }
+
+  bytes = g_bytes_new_take (contents, length);
+  state = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("a{s(va{sas})}"),
+                                                        bytes, FALSE));
+
+  g_variant_iter_init (&iter, state);
+  while (g_variant_iter_next (&iter, "{&s(v@a{sas})}", &id, &data, &apps))
+    {
+      g_autoptr(PermissionDbEntry) existing = permission_db_lookup (db, id);
+      g_autoptr(PermissionDbEntry) entry = NULL;
+      GVariantIter apps_iter;
+      const char *app_id;
+      g_autofree const char **permissions = NULL;
+
+      if (existing == NULL &&
+          g_variant_is_of_type (data, G_VARIANT_TYPE ("(ayttu)")))
+        entry = permission_db_entry_new (data);
+
+      if (entry != NULL && !persist_entry (entry))
+        {
+          g_variant_iter_init (&apps_iter, apps);
+          while (g_variant_iter_next (&apps_iter, "{&s^a&s}", &app_id, &permissions))
+            {
+              PermissionDbEntry *new_entry;
+
+              new_entry = permission_db_entry_set_app_permissions (entry, app_id, permissions);
+              permission_db_entry_unref (entry);
+              entry = new_entry;
+              g_clear_pointer (&permissions, g_free);
+            }
+
+          permission_db_set_entry (db, id, entry);
+          g_hash_table_add (transient_ids, g_strdup (id));
+        }
+
+      g_clear_pointer (&data, g_variant_unref);
+      g_clear_pointer (&apps, g_variant_unref);
+    }
+
+  g_debug ("Restored %u transient documents", g_hash_table_size (transient_ids));
+}
+
+static char *
+path_index_key (const char *path,
+                guint64     dev,
+                guint64     ino,
+                guint32     flags)
+{
+  /* The path goes last, so the key is unambiguous whatever it contains */
+  return g_strdup_printf ("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%u:%s",
+                          dev, ino, flags, path);
+}
+
+static char *
+path_index_key_for_entry (PermissionDbEntry *entry)
+{
+  return path_index_key (document_entry_get_path (entry),
+                         document_entry_get_device (entry),
+                         document_entry_get_inode (entry),
+                         document_entry_get_flags (entry));
+}
+
+static void
+path_index_add (const char        *id,
+                PermissionDbEntry *entry)
+{
+  g_autofree char *key = path_index_key_for_entry (entry);
+  GPtrArray *ids;
+
+  ids = g_hash_table_lookup (path_index, key);
+  if (ids == NULL)
+    {
+      ids = g_ptr_array_new_with_free_func (g_free);
+      g_hash_table_insert (path_index, g_steal_pointer (&key), ids);
+    }
+
+  g_ptr_array_add (ids, g_strdup (id));
+}
+
+static void
+path_index_remove (const char        *id,
+                   PermissionDbEntry *entry)
+{
+  g_autofree char *key = path_index_key_for_entry (entry);
+  GPtrArray *ids;
+  guint i;
+
+  ids = g_hash_table_lookup (path_index, key);
+  if (ids == NULL)
+    return;
+
+  for (i = 0; i < ids->len; i++)
+    {
+      if (strcmp (g_ptr_array_index (ids, i), id) == 0)
+        {
+          g_ptr_array_remove_index_fast (ids, i);
+          break;
+        }
+    }
+
+  if (ids->len == 0)
+    g_hash_table_remove (path_index, key);
+}
+
+static const char *
+path_index_lookup (const char *path,
+                   guint64     dev,
+                   guint64     ino,
+                   guint32     flags)
+{
+  g_autofree char *key = path_index_key (path, dev, ino, flags);
+  GPtrArray *ids;
+
+  ids = g_hash_table_lookup (path_index, key);
+  if (ids == NULL)
+    return NULL;
+
+  return g_ptr_array_index (ids, 0);
+}
+
+static void
+path_index_build (void)
+{
+  g_auto(GStrv) ids = NULL;
+  int i;
+
+  path_index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                      g_free, (GDestroyNotify) g_ptr_array_unref);
+
+  ids = permission_db_list_ids (db);
+  for (i = 0; ids[i] != NULL; i++)
+    {
+      g_autoptr(PermissionDbEntry) entry = permission_db_lookup (db, ids[i]);
+
+      if (entry != NULL)
+        path_index_add (ids[i], entry);
+    }
+}
+
 static void
 do_set_permissions (PermissionDbEntry    *entry,
                     const char        *doc_id,
@@ -91,6 +362,9 @@ do_set_permissions (PermissionDbEntry    *entry,
   new_entry = permission_db_entry_set_app_permissions (entry, app_id, perms_s);
   permission_db_set_entry (db, doc_id, new_entry);
 
+  if (!persist_entry (new_entry))
+    transient_changed (doc_id, TRUE);
+
   if (persist_entry (new_entry))
     {
       xdg_permission_store_call_set_permission (permission_store,
@@ -120,7 +394,7 @@ portal_grant_permissions (GDBusMethodInvocation *invocation,
   g_variant_get (parameters, "(&s&s^a&s)", &id, &target_app_id, &permissions);
 
   {
-    XDP_AUTOLOCK (db);
+    XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
 
     entry = permission_db_lookup (db, id);
     if (entry == NULL)
@@ -183,7 +457,7 @@ portal_revoke_permissions (GDBusMethodInvocation *invocation,
   g_variant_get (parameters, "(&s&s^a&s)", &id, &target_app_id, &permissions);
 
   {
-    XDP_AUTOLOCK (db);
+    XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
 
     entry = permission_db_lookup (db, id);
     if (entry == NULL)
@@ -245,7 +519,7 @@ portal_delete (GDBusMethodInvocation *invocation,
   g_debug ("portal_delete %s", id);
 
   {
-    XDP_AUTOLOCK (db);
+    XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
 
     entry = permission_db_lookup (db, id);
     if (entry == NULL)
@@ -267,10 +541,13 @@ portal_delete (GDBusMethodInvocation *invocation,
     g_debug ("delete %s", id);
 
     permission_db_set_entry (db, id, NULL);
+    path_index_remove (id, entry);
 
     if (persist_entry (entry))
       xdg_permission_store_call_delete (permission_store, TABLE_NAME,
                                         id, NULL, NULL, NULL);
+    else
+      transient_changed (id, FALSE);
   }
 
   /* All i/o is done now, so drop the lock so we can invalidate the fuse caches */
@@ -288,7 +565,6 @@ do_create_doc (struct stat *parent_st_buf, const char *path, gboolean reuse_exis
 {
   g_autoptr(GVariant) data = NULL;
   g_autoptr(PermissionDbEntry) entry = NULL;
-  g_auto(GStrv) ids = NULL;
   char *id = NULL;
   guint32 flags = 0;
 
@@ -309,10 +585,13 @@ do_create_doc (struct stat *parent_st_buf, const char *path, gboolean reuse_exis
 
   if (reuse_existing)
     {
-      ids = permission_db_list_ids_by_value (db, data);
+      const char *existing_id = path_index_lookup (path,
+                                                   parent_st_buf->st_dev,
+                                                   parent_st_buf->st_ino,
+                                                   flags);
 
-      if (ids[0] != NULL)
-        return g_strdup (ids[0]);  /* Reuse pre-existing entry with same path */
+      if (existing_id != NULL)
+        return g_strdup (existing_id);  /* Reuse pre-existing entry with same path */
     }
 
   while (TRUE)
@@ -330,6 +609,10 @@ do_create_doc (struct stat *parent_st_buf, const char *path, gboolean reuse_exis
 
   entry = permission_db_entry_new (data);
   permission_db_set_entry (db, id, entry);
+  path_index_add (id, entry);
+
+  if (!persistent)
+    transient_changed (id, TRUE);
 
   if (persistent)
     {
@@ -345,6 +628,143 @@ do_create_doc (struct stat *parent_st_buf, const char *path, gboolean reuse_exis
   return id;
 }
 
+/* Exporting many files from one folder opens and stats the same parent
+ * directory over and over, so keep it open for a short while. An entry
+ * is only used while nothing was renamed or removed through fuse, and
+ * only if the file is still found in it. */
+#define VALIDATED_DIR_TTL_USEC (2 * G_USEC_PER_SEC)
+#define VALIDATED_DIR_MAX 32
+
+typedef struct {
+  int fd; /* O_PATH */
+  struct stat st_buf;
+  gint64 expires;
+  guint generation;
+} ValidatedDir;
+
+static GHashTable *validated_dirs; /* "app:dirname" -> ValidatedDir */
+static guint validated_dirs_purge_id;
+G_LOCK_DEFINE (validated_dirs);
+
+static void
+validated_dir_free (ValidatedDir *dir)
+{
+  close (dir->fd);
+  g_free (dir);
+}
+
+/* Checks that the cached directory still has the file, or the dir
+ * itself if name is NULL */
+static gboolean
+validated_dir_lookup (const char  *key,
+                      const char  *name,
+                      struct stat *st_buf,
+                      struct stat *real_dir_st_buf)
+{
+  ValidatedDir *dir;
+  struct stat real_st_buf;
+  gboolean res = FALSE;
+
+  G_LOCK (validated_dirs);
+
+  if (validated_dirs == NULL)
+    goto out;
+
+  dir = g_hash_table_lookup (validated_dirs, key);
+  if (dir == NULL)
+    goto out;
+
+  if (dir->expires < g_get_monotonic_time () ||
+      dir->generation != xdp_fuse_get_path_generation ())
+    {
+      g_hash_table_remove (validated_dirs, key);
+      goto out;
+    }
+
+  if (name != NULL)
+    res = fstatat (dir->fd, name, &real_st_buf, AT_SYMLINK_NOFOLLOW) == 0 &&
+          st_buf->st_dev == real_st_buf.st_dev &&
+          st_buf->st_ino == real_st_buf.st_ino;
+  else
+    res = st_buf->st_dev == dir->st_buf.st_dev &&
+          st_buf->st_ino == dir->st_buf.st_ino;
+
+  /* Maybe replaced, let the caller look again */
+  if (!res)
+    g_hash_table_remove (validated_dirs, key);
+  else
+    *real_dir_st_buf = dir->st_buf;
+
+ out:
+  G_UNLOCK (validated_dirs);
+
+  return res;
+}
+
+/* Closes expired directories, so they don't stay pinned (e.g. keeping
+ * removable media busy) until the next export */
+static gboolean
+validated_dirs_purge_cb (gpointer user_data)
+{
+  GHashTableIter iter;
+  gpointer value;
+  gint64 now = g_get_monotonic_time ();
+  gboolean res = G_SOURCE_CONTINUE;
+
+  G_LOCK (validated_dirs);
+
+  g_hash_table_iter_init (&iter, validated_dirs);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      ValidatedDir *dir = value;
+
+      if (dir->expires < now)
+        g_hash_table_iter_remove (&iter);
+    }
+
+  if (g_hash_table_size (validated_dirs) == 0)
+    {
+      validated_dirs_purge_id = 0;
+      res = G_SOURCE_REMOVE;
+    }
+
+  G_UNLOCK (validated_dirs);
+
+  return res;
+}
+
+static void
+validated_dir_add (const char  *key,
+                   int          dir_fd, /* Takes ownership */
+                   struct stat *real_dir_st_buf,
+                   guint        generation)
+{
+  ValidatedDir *dir = g_new0 (ValidatedDir, 1);
+
+  dir->fd = dir_fd;
+  dir->st_buf = *real_dir_st_buf;
+  dir->expires = g_get_monotonic_time () + VALIDATED_DIR_TTL_USEC;
+  dir->generation = generation;
+
+  G_LOCK (validated_dirs);
+
+  if (validated_dirs == NULL)
+    validated_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, (GDestroyNotify) validated_dir_free);
+  else if (g_hash_table_size (validated_dirs) >= VALIDATED_DIR_MAX)
+    g_hash_table_remove_all (validated_dirs);
+
+  g_hash_table_replace (validated_dirs, g_strdup (key), dir);
+
+  if (validated_dirs_purge_id == 0)
+    validated_dirs_purge_id = g_timeout_add_full (G_PRIORITY_LOW,
+                                                  VALIDATED_DIR_TTL_USEC / 1000,
+                                                  validated_dirs_purge_cb,
+                                                  NULL, NULL);
+
+  G_UNLOCK (validated_dirs);
+}
+
 gboolean
 validate_fd (int fd,
              XdpAppInfo *app_info,
@@ -358,8 +778,10 @@ validate_fd (int fd,
   g_autofree char *path = NULL;
   g_autofree char *dirname = NULL;
   g_autofree char *name = NULL;
+  g_autofree char *key = NULL;
   xdp_autofd int dir_fd = -1;
   struct stat real_st_buf;
+  guint generation;
   g_autoptr(GError) local_error = NULL;
 
   path = xdp_app_info_get_path_for_fd (app_info, fd, 0, st_buf, writable_out, &local_error);
@@ -387,6 +809,13 @@ validate_fd (int fd,
   else
     goto errout;
 
+  key = g_strconcat (xdp_app_info_get_id (app_info), ":", dirname, NULL);
+  if (validated_dir_lookup (key, name, st_buf, real_dir_st_buf))
+    goto out;
+
+  /* Read before the checks, so a rename racing with them invalidates the entry */
+  generation = xdp_fuse_get_path_generation ();
+
   dir_fd = open (dirname, O_CLOEXEC | O_PATH);
   if (dir_fd < 0 || fstat (dir_fd, real_dir_st_buf) != 0)
     goto errout;
@@ -402,7 +831,9 @@ validate_fd (int fd,
            st_buf->st_ino != real_dir_st_buf->st_ino)
     goto errout;
 
+  validated_dir_add (key, xdp_steal_fd (&dir_fd), real_dir_st_buf, generation);
 
+ out:
   if (path_out)
     *path_out = g_steal_pointer (&path);
 
@@ -437,7 +868,7 @@ verify_existing_document (struct stat *st_buf,
 
   /* Don't lock the db before doing the fuse call above, because it takes takes a lock
      that can block something calling back, causing a deadlock on the db lock */
-  XDP_AUTOLOCK (db);
+  XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
 
   /* If the entry doesn't exist anymore, fail.  Also fail if not
    * reuse_existing, because otherwise the user could use this to
@@ -860,7 +1291,7 @@ document_add_full (int                      *fd,
     if (!reuse_existing)
       caller_write_perms |= DOCUMENT_PERMISSION_FLAGS_DELETE;
 
-    XDP_AUTOLOCK (db); /* Lock once for all ops */
+    XDP_METRICS_AUTOLOCK (db, "db/lock-wait"); /* Lock once for all ops */
 
     for (i = 0; i < n_args; i++)
       {
@@ -1028,7 +1459,7 @@ portal_add_named_full (GDBusMethodInvocation *invocation,
     if (!reuse_existing)
       caller_perms |= DOCUMENT_PERMISSION_FLAGS_DELETE;
 
-    XDP_AUTOLOCK (db);
+    XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
 
     if (as_needed_by_app &&
         app_has_file_access (target_app_id, target_perms, path))
@@ -1142,7 +1573,7 @@ portal_add_named (GDBusMethodInvocation *invocation,
 
   path = g_build_filename (parent_path, filename, NULL);
 
-  XDP_AUTOLOCK (db);
+  XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
 
   id = do_create_doc (&parent_st_buf, path, reuse_existing, persistent, FALSE);
 
@@ -1168,6 +1599,9 @@ handle_method (GCallback              method_callback,
   else
     portal_method (invocation, g_dbus_method_invocation_get_parameters (invocation), app_info);
 
+  if (G_UNLIKELY (xdp_profile_startup_enabled))
+    xdp_profile_startup_done ();
+
   return TRUE;
 }
 
@@ -1183,21 +1617,100 @@ handle_get_mount_point (XdpDbusDocuments *object, GDBusMethodInvocation *invocat
     }
 
   xdp_dbus_documents_complete_get_mount_point (object, invocation, xdp_fuse_get_mountpoint ());
+
+  if (G_UNLIKELY (xdp_profile_startup_enabled))
+    xdp_profile_startup_done ();
+
   return TRUE;
 }
 
+typedef struct {
+  char *id;
+  char *path;
+  struct stat real_dir_st_buf;
+  gboolean is_dir;
+  gboolean resolved;
+  GError *error;
+} LookupItem;
+
+static void
+lookup_item_clear (LookupItem *item)
+{
+  g_clear_pointer (&item->id, g_free);
+  g_clear_pointer (&item->path, g_free);
+  g_clear_error (&item->error);
+}
+
+/* Does the filesystem part of a lookup, without the db lock. Paths
+ * on the fuse filesystem are resolved here, as that must not be done
+ * while holding the db lock. */
+static void
+lookup_item_prepare (LookupItem *item,
+                     const char *filename,
+                     XdpAppInfo *app_info)
+{
+  xdp_autofd int fd = -1;
+  struct stat st_buf;
+
+  fd = open (filename, O_PATH | O_CLOEXEC);
+  if (fd == -1)
+    {
+      int errsv = errno;
+      g_set_error (&item->error,
+                   XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_NOT_FOUND,
+                   "%s", g_strerror (errsv));
+      return;
+    }
+
+  if (!validate_fd (fd, app_info, VALIDATE_FD_FILE_TYPE_ANY, &st_buf,
+                    &item->real_dir_st_buf, &item->path, NULL, &item->error))
+    return;
+
+  item->is_dir = S_ISDIR (st_buf.st_mode);
+
+  if (st_buf.st_dev == fuse_dev)
+    {
+      /* The passed in fd is on the fuse filesystem itself */
+      item->id = xdp_fuse_lookup_id_for_inode (st_buf.st_ino, item->is_dir, NULL);
+      item->resolved = TRUE;
+      g_debug ("path on fuse, id %s", item->id);
+    }
+}
+
+/* Must be called with the db lock held */
+static void
+lookup_item_resolve (LookupItem *item)
+{
+  const char *existing_id;
+  guint32 flags = 0;
+
+  if (item->error != NULL || item->resolved)
+    return;
+
+  if (item->is_dir)
+    flags |= DOCUMENT_ENTRY_FLAG_DIRECTORY;
+
+  existing_id = path_index_lookup (item->path,
+                                   item->real_dir_st_buf.st_dev,
+                                   item->real_dir_st_buf.st_ino,
+                                   flags);
+  if (existing_id == NULL)
+    existing_id = path_index_lookup (item->path,
+                                     item->real_dir_st_buf.st_dev,
+                                     item->real_dir_st_buf.st_ino,
+                                     flags | DOCUMENT_ENTRY_FLAG_TRANSIENT);
+
+  item->id = g_strdup (existing_id);
+  item->resolved = TRUE;
+}
+
 static gboolean
 portal_lookup (GDBusMethodInvocation *invocation,
                GVariant *parameters,
                XdpAppInfo *app_info)
 {
   const char *filename;
-  g_autofree char *path = NULL;
-  xdp_autofd int fd = -1;
-  struct stat st_buf, real_dir_st_buf;
-  g_autofree char *id = NULL;
-  GError *error = NULL;
-  gboolean is_dir;
+  LookupItem item = { 0, };
 
   if (!xdp_app_info_is_host (app_info))
     {
@@ -1209,97 +1722,85 @@ portal_lookup (GDBusMethodInvocation *invocation,
 
   g_variant_get (parameters, "(^&ay)", &filename);
 
-  fd = open (filename, O_PATH | O_CLOEXEC);
-  if (fd == -1)
+  lookup_item_prepare (&item, filename, app_info);
+  if (item.error != NULL)
     {
-      int errsv = errno;
-      g_dbus_method_invocation_return_error (invocation,
-                                             XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_NOT_FOUND,
-                                             "%s", g_strerror (errsv));
+      g_dbus_method_invocation_return_gerror (invocation, item.error);
+      lookup_item_clear (&item);
       return TRUE;
     }
 
-  if (!validate_fd (fd, app_info, VALIDATE_FD_FILE_TYPE_ANY, &st_buf, &real_dir_st_buf, &path, NULL, &error))
+  if (!item.resolved)
     {
-      g_dbus_method_invocation_take_error (invocation, error);
-      return TRUE;
-    }
-
-  is_dir = S_ISDIR (st_buf.st_mode);
-
-  if (st_buf.st_dev == fuse_dev)
-    {
-      /* The passed in fd is on the fuse filesystem itself */
-      id = xdp_fuse_lookup_id_for_inode (st_buf.st_ino, is_dir, NULL);
-      g_debug ("path on fuse, id %s", id);
-    }
-  else
-    {
-      g_autoptr(GVariant) data = NULL;
-      g_autoptr(GVariant) data_transient = NULL;
-      g_auto(GStrv) ids = NULL;
-      guint32 flags = 0;
-
-      if (is_dir)
-        flags |= DOCUMENT_ENTRY_FLAG_DIRECTORY;
-
-      data = g_variant_ref_sink (g_variant_new ("(^ayttu)",
-                                                path,
-                                                (guint64)real_dir_st_buf.st_dev,
-                                                (guint64)real_dir_st_buf.st_ino,
-                                                flags));
-      ids = permission_db_list_ids_by_value (db, data);
-      if (ids[0] != NULL)
-        id = g_strdup (ids[0]);
-
-      if (id == NULL)
-        {
-          g_auto(GStrv) transient_ids = NULL;
-          data_transient = g_variant_ref_sink (g_variant_new ("(^ayttu)",
-                                                              path,
-                                                              (guint64)real_dir_st_buf.st_dev,
-                                                              (guint64)real_dir_st_buf.st_ino,
-                                                              flags|DOCUMENT_ENTRY_FLAG_TRANSIENT));
-          transient_ids = permission_db_list_ids_by_value (db, data_transient);
-          if (transient_ids[0] != NULL)
-            id = g_strdup (transient_ids[0]);
-        }
+      XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
+      lookup_item_resolve (&item);
     }
 
   g_dbus_method_invocation_return_value (invocation,
-                                         g_variant_new ("(s)", id ? id : ""));
+                                         g_variant_new ("(s)", item.id ? item.id : ""));
+  lookup_item_clear (&item);
 
   return TRUE;
 }
 
-static GVariant *
-get_app_permissions (PermissionDbEntry *entry)
+static gboolean
+portal_lookup_many (GDBusMethodInvocation *invocation,
+                    GVariant *parameters,
+                    XdpAppInfo *app_info)
 {
-  g_autofree const char **apps = NULL;
+  g_autofree const char **filenames = NULL;
+  g_autofree LookupItem *items = NULL;
+  gsize n_filenames;
   GVariantBuilder builder;
-  int i;
 
-  apps = permission_db_entry_list_apps (entry);
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sas}"));
+  if (!xdp_app_info_is_host (app_info))
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_NOT_ALLOWED,
+                                             "Not allowed in sandbox");
+      return TRUE;
+    }
+
+  g_variant_get (parameters, "(^a&ay)", &filenames);
+  n_filenames = g_strv_length ((char **) filenames);
+  items = g_new0 (LookupItem, n_filenames);
+
+  for (gsize i = 0; i < n_filenames; i++)
+    lookup_item_prepare (&items[i], filenames[i], app_info);
+
+  {
+    XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
 
-  for (i = 0; apps[i] != NULL; i++)
+    for (gsize i = 0; i < n_filenames; i++)
+      lookup_item_resolve (&items[i]);
+  }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
+  for (gsize i = 0; i < n_filenames; i++)
     {
-      g_autofree const char **permissions = permission_db_entry_list_permissions (entry, apps[i]);
-      g_variant_builder_add_value (&builder,
-                                   g_variant_new ("{s^as}", apps[i], permissions));
+      LookupItem *item = &items[i];
+
+      g_variant_builder_add (&builder, "(ss)",
+                             item->id ? item->id : "",
+                             item->error ? item->error->message : "");
+      lookup_item_clear (item);
     }
 
-  return g_variant_builder_end (&builder);
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(@a(ss))",
+                                                        g_variant_builder_end (&builder)));
+
+  return TRUE;
 }
 
+/* The path is stored as a nul-terminated ay, so it can be passed
+ * on without copying it */
 static GVariant *
 get_path (PermissionDbEntry *entry)
 {
   g_autoptr (GVariant) data = permission_db_entry_get_data (entry);
-  const char *path;
 
-  g_variant_get (data, "(^&ayttu)", &path, NULL, NULL, NULL);
-  return g_variant_new_bytestring (path);
+  return g_variant_get_child_value (data, 0);
 }
 
 static gboolean
@@ -1309,6 +1810,7 @@ portal_info (GDBusMethodInvocation *invocation,
 {
   const char *id = NULL;
   g_autoptr(PermissionDbEntry) entry = NULL;
+  g_autoptr(GVariant) path = NULL;
 
   if (!xdp_app_info_is_host (app_info))
     {
@@ -1320,7 +1822,7 @@ portal_info (GDBusMethodInvocation *invocation,
 
   g_variant_get (parameters, "(&s)", &id);
 
-  XDP_AUTOLOCK (db);
+  XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
 
   entry = permission_db_lookup (db, id);
 
@@ -1332,10 +1834,62 @@ portal_info (GDBusMethodInvocation *invocation,
       return TRUE;
     }
 
+  path = get_path (entry);
   g_dbus_method_invocation_return_value (invocation,
                                          g_variant_new ("(@ay@a{sas})",
-                                                        get_path (entry),
-                                                        get_app_permissions (entry)));
+                                                        path,
+                                                        permission_db_entry_get_app_permissions (entry)));
+
+  return TRUE;
+}
+
+static gboolean
+portal_info_many (GDBusMethodInvocation *invocation,
+                  GVariant *parameters,
+                  XdpAppInfo *app_info)
+{
+  g_autofree const char **ids = NULL;
+  GVariantBuilder builder;
+
+  if (!xdp_app_info_is_host (app_info))
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_NOT_ALLOWED,
+                                             "Not allowed in sandbox");
+      return TRUE;
+    }
+
+  g_variant_get (parameters, "(^a&s)", &ids);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(aya{sas}s)"));
+
+  {
+    XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
+
+    for (gsize i = 0; ids[i] != NULL; i++)
+      {
+        g_autoptr(PermissionDbEntry) entry = permission_db_lookup (db, ids[i]);
+
+        if (entry == NULL)
+          g_variant_builder_add (&builder, "(@ay@a{sas}s)",
+                                 g_variant_new_bytestring (""),
+                                 g_variant_new_array (G_VARIANT_TYPE ("{sas}"), NULL, 0),
+                                 "Invalid ID passed");
+        else
+          {
+            g_autoptr(GVariant) path = get_path (entry);
+
+            g_variant_builder_add (&builder, "(@ay@a{sas}s)",
+                                   path,
+                                   permission_db_entry_get_app_permissions (entry),
+                                   "");
+          }
+      }
+  }
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(@a(aya{sas}s))",
+                                                        g_variant_builder_end (&builder)));
 
   return TRUE;
 }
@@ -1346,9 +1900,10 @@ portal_list (GDBusMethodInvocation *invocation,
              XdpAppInfo *app_info)
 {
   const char *app_id = xdp_app_info_get_id (app_info);
-  g_auto(GStrv) ids = NULL;
+  g_auto(PermissionDbIter) iter = { 0, };
+  const char *id;
+  PermissionDbEntry *entry;
   GVariantBuilder builder;
-  int i;
 
   if (!xdp_app_info_is_host (app_info))
     {
@@ -1360,21 +1915,16 @@ portal_list (GDBusMethodInvocation *invocation,
 
   g_variant_get (parameters, "(&s)", &app_id);
 
-  XDP_AUTOLOCK (db);
+  XDP_METRICS_AUTOLOCK (db, "db/lock-wait");
 
-  if (strcmp (app_id, "") == 0)
-    ids = permission_db_list_ids (db);
-  else
-    ids = permission_db_list_ids_by_app (db, app_id);
+  permission_db_iter_init (&iter, db, strcmp (app_id, "") == 0 ? NULL : app_id);
 
   g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{say}"));
-  for (i = 0; ids[i]; i++)
+  while (permission_db_iter_next (&iter, &id, &entry))
     {
-      g_autoptr(PermissionDbEntry) entry = NULL;
-
-      entry = permission_db_lookup (db, ids[i]);
+      g_autoptr(GVariant) path = get_path (entry);
 
-      g_variant_builder_add (&builder, "{s@ay}", ids[i], get_path (entry));
+      g_variant_builder_add (&builder, "{s@ay}", id, path);
     }
 
   g_dbus_method_invocation_return_value (invocation,
@@ -1390,6 +1940,101 @@ peer_died_cb (const char *name)
   stop_file_transfers_for_sender (name);
 }
 
+#define FUSE_TRACE_INTERFACE "org.freedesktop.portal.Debug.FuseTrace"
+
+static const char fuse_trace_introspection_xml[] =
+  "<node>"
+  "  <interface name='" FUSE_TRACE_INTERFACE "'>"
+  "    <method name='Start'/>"
+  "    <method name='Stop'/>"
+  "    <method name='GetTrace'>"
+  "      <arg type='a(sstxui)' name='ops' direction='out'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
+
+static void
+fuse_trace_method_call (GDBusConnection       *connection,
+                        const char            *sender,
+                        const char            *object_path,
+                        const char            *interface_name,
+                        const char            *method_name,
+                        GVariant              *parameters,
+                        GDBusMethodInvocation *invocation,
+                        gpointer               user_data)
+{
+  g_autoptr(XdpAppInfo) app_info = NULL;
+  g_autoptr(GError) error = NULL;
+
+  app_info = xdp_invocation_lookup_app_info_sync (invocation, NULL, &error);
+  if (app_info == NULL)
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      return;
+    }
+
+  /* The trace shows what other apps are doing */
+  if (!xdp_app_info_is_host (app_info))
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_NOT_ALLOWED,
+                                             "Not allowed in sandbox");
+      return;
+    }
+
+  if (strcmp (method_name, "Start") == 0)
+    {
+      xdp_fuse_trace_set_enabled (TRUE);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else if (strcmp (method_name, "Stop") == 0)
+    {
+      xdp_fuse_trace_set_enabled (FALSE);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else if (strcmp (method_name, "GetTrace") == 0)
+    {
+      GVariant *ops = xdp_fuse_trace_collect ();
+
+      g_dbus_method_invocation_return_value (invocation, g_variant_new_tuple (&ops, 1));
+    }
+  else
+    g_dbus_method_invocation_return_error (invocation,
+                                           G_DBUS_ERROR,
+                                           G_DBUS_ERROR_UNKNOWN_METHOD,
+                                           "Unknown method %s", method_name);
+}
+
+static const GDBusInterfaceVTable fuse_trace_vtable = {
+  fuse_trace_method_call,
+  NULL,
+  NULL,
+};
+
+/* Only exported when tracing was requested on the command line,
+ * since the trace shows what other apps are doing.
+ */
+static void
+export_fuse_trace (GDBusConnection *connection)
+{
+  g_autoptr(GDBusNodeInfo) info = NULL;
+  g_autoptr(GError) error = NULL;
+
+  info = g_dbus_node_info_new_for_xml (fuse_trace_introspection_xml, NULL);
+  if (g_dbus_connection_register_object (connection,
+                                         "/org/freedesktop/portal/documents",
+                                         info->interfaces[0],
+                                         &fuse_trace_vtable,
+                                         NULL, NULL,
+                                         &error) == 0)
+    {
+      g_warning ("error: %s", error->message);
+      return;
+    }
+
+  g_debug ("Providing %s", FUSE_TRACE_INTERFACE);
+}
+
 static void
 on_bus_acquired (GDBusConnection *connection,
                  const gchar     *name,
@@ -1398,9 +2043,11 @@ on_bus_acquired (GDBusConnection *connection,
   GError *error = NULL;
   GDBusInterfaceSkeleton *file_transfer;
 
+  xdp_profile_startup_mark ("bus-acquired");
+
   dbus_api = xdp_dbus_documents_skeleton_new ();
 
-  xdp_dbus_documents_set_version (XDP_DBUS_DOCUMENTS (dbus_api), 4);
+  xdp_dbus_documents_set_version (XDP_DBUS_DOCUMENTS (dbus_api), 5);
 
   g_signal_connect_swapped (dbus_api, "handle-get-mount-point", G_CALLBACK (handle_get_mount_point), NULL);
   g_signal_connect_swapped (dbus_api, "handle-add", G_CALLBACK (handle_method), portal_add);
@@ -1411,7 +2058,9 @@ on_bus_acquired (GDBusConnection *connection,
   g_signal_connect_swapped (dbus_api, "handle-revoke-permissions", G_CALLBACK (handle_method), portal_revoke_permissions);
   g_signal_connect_swapped (dbus_api, "handle-delete", G_CALLBACK (handle_method), portal_delete);
   g_signal_connect_swapped (dbus_api, "handle-lookup", G_CALLBACK (handle_method), portal_lookup);
+  g_signal_connect_swapped (dbus_api, "handle-lookup-many", G_CALLBACK (handle_method), portal_lookup_many);
   g_signal_connect_swapped (dbus_api, "handle-info", G_CALLBACK (handle_method), portal_info);
+  g_signal_connect_swapped (dbus_api, "handle-info-many", G_CALLBACK (handle_method), portal_info_many);
   g_signal_connect_swapped (dbus_api, "handle-list", G_CALLBACK (handle_method), portal_list);
 
   file_transfer = file_transfer_create ();
@@ -1441,6 +2090,20 @@ on_bus_acquired (GDBusConnection *connection,
     }
 
   g_debug ("Providing portal %s", g_dbus_interface_skeleton_get_info (G_DBUS_INTERFACE_SKELETON (file_transfer))->name);
+
+  if (xdp_metrics_enabled)
+    {
+      g_autoptr(GError) metrics_error = NULL;
+
+      xdp_metrics_add_gauge ("fuse/inodes", xdp_fuse_get_n_inodes);
+      xdp_metrics_add_gauge ("fuse/o-path-fds", xdp_fuse_get_n_physical_inodes);
+
+      if (!xdp_metrics_export (connection, "/org/freedesktop/portal/documents", &metrics_error))
+        g_warning ("error: %s", metrics_error->message);
+    }
+
+  if (trace_fuse)
+    export_fuse_trace (connection);
 }
 
 static void
@@ -1451,6 +2114,8 @@ on_name_acquired (GDBusConnection *connection,
   struct stat stbuf;
   gpointer invocation;
 
+  xdp_profile_startup_mark ("name-acquired");
+
   g_debug ("%s acquired", name);
 
   if (!xdp_fuse_init (&exit_error))
@@ -1472,12 +2137,17 @@ on_name_acquired (GDBusConnection *connection,
 
   fuse_dev = stbuf.st_dev;
 
+  xdp_profile_startup_mark ("fuse-mounted");
+
   xdp_set_documents_mountpoint (xdp_fuse_get_mountpoint ());
 
   while ((invocation = g_queue_pop_head (&get_mount_point_invocations)) != NULL)
     {
       xdp_dbus_documents_complete_get_mount_point (dbus_api, invocation, xdp_fuse_get_mountpoint ());
       g_object_unref (invocation);
+
+      if (G_UNLIKELY (xdp_profile_startup_enabled))
+        xdp_profile_startup_done ();
     }
 }
 
@@ -1568,10 +2238,16 @@ set_one_signal_handler (int    sig,
 static gboolean opt_verbose;
 static gboolean opt_replace;
 static gboolean opt_version;
+static gboolean opt_metrics;
+static gboolean opt_trace_fuse;
+static gboolean opt_profile_startup;
 
 static GOptionEntry entries[] = {
   { "verbose", 'v', 0, G_OPTION_ARG_NONE, &opt_verbose, "Print debug information", NULL },
   { "replace", 'r', 0, G_OPTION_ARG_NONE, &opt_replace, "Replace", NULL },
+  { "metrics", 0, 0, G_OPTION_ARG_NONE, &opt_metrics, "Export runtime metrics on the bus", NULL },
+  { "trace-fuse", 0, 0, G_OPTION_ARG_NONE, &opt_trace_fuse, "Record fuse operations and export them on the bus", NULL },
+  { "profile-startup", 0, 0, G_OPTION_ARG_NONE, &opt_profile_startup, "Print a timeline of startup to stderr", NULL },
   { "version", 0, 0, G_OPTION_ARG_NONE, &opt_version, "Print version and exit", NULL },
   { NULL }
 };
@@ -1633,6 +2309,18 @@ main (int    argc,
 
   g_set_prgname (argv[0]);
 
+  if (opt_profile_startup || g_getenv ("XDG_DESKTOP_PORTAL_PROFILE_STARTUP") != NULL)
+    xdp_profile_startup_enable ();
+
+  if (opt_metrics || g_getenv ("XDG_DESKTOP_PORTAL_METRICS") != NULL)
+    xdp_metrics_enable ();
+
+  if (opt_trace_fuse || g_getenv ("XDG_DESKTOP_PORTAL_FUSE_TRACE") != NULL)
+    {
+      trace_fuse = TRUE;
+      xdp_fuse_trace_set_enabled (TRUE);
+    }
+
   loop = g_main_loop_new (NULL, FALSE);
 
   path = g_build_filename (g_get_user_data_dir (), "flatpak/db", TABLE_NAME, NULL);
@@ -1643,6 +2331,11 @@ main (int    argc,
       exit (2);
     }
 
+  transient_restore ();
+  path_index_build ();
+
+  xdp_profile_startup_mark ("db-loaded");
+
   session_bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
   if (session_bus == NULL)
     {
@@ -1660,6 +2353,8 @@ main (int    argc,
       exit (4);
     }
 
+  xdp_profile_startup_mark ("permission-store-connected");
+
   /* We want do do our custom post-mainloop exit */
   g_dbus_connection_set_exit_on_close (session_bus, FALSE);
 
@@ -1694,6 +2389,10 @@ main (int    argc,
 
   xdp_fuse_exit ();
 
+  /* Save pending changes, for the next instance */
+  if (transient_checkpoint_id != 0)
+    transient_checkpoint ();
+
   g_bus_unown_name (owner_id);
 
   return final_exit_status;
@@ -521,6 +521,98 @@ permission_db_lookup (PermissionDb  *self,
   return (PermissionDbEntry *) res;
 }
 
+/* Walks all the entries, or only those of @app if it is not %NULL,
+ * looking each of them up only once. The entries of an app come from
+ * the apps index, so they don't need a walk of the whole db. The db
+ * must not be modified while iterating.
+ */
+void
+permission_db_iter_init (PermissionDbIter *iter,
+                         PermissionDb     *self,
+                         const char       *app)
+{
+  g_return_if_fail (PERMISSION_IS_DB (self));
+
+  memset (iter, 0, sizeof (*iter));
+  iter->db = self;
+
+  if (app != NULL)
+    {
+      iter->by_app = TRUE;
+      iter->ids = permission_db_list_ids_by_app (self, app);
+    }
+  else
+    {
+      iter->in_updates = TRUE;
+      g_hash_table_iter_init (&iter->updates_iter, self->main_updates);
+      if (self->main_table)
+        iter->ids = gvdb_table_get_names (self->main_table, NULL);
+    }
+}
+
+/* The returned id and entry are owned by the iterator, and are valid
+ * until the next call.
+ */
+gboolean
+permission_db_iter_next (PermissionDbIter   *iter,
+                         const char        **id,
+                         PermissionDbEntry **entry)
+{
+  PermissionDb *self = iter->db;
+  gpointer key, value;
+
+  g_clear_pointer (&iter->entry, permission_db_entry_unref);
+
+  if (iter->in_updates)
+    {
+      while (g_hash_table_iter_next (&iter->updates_iter, &key, &value))
+        {
+          if (value == NULL)
+            continue;
+
+          iter->entry = permission_db_entry_ref (value);
+          if (id)
+            *id = key;
+          if (entry)
+            *entry = iter->entry;
+          return TRUE;
+        }
+
+      iter->in_updates = FALSE;
+    }
+
+  if (iter->ids == NULL)
+    return FALSE;
+
+  while (iter->ids[iter->index] != NULL)
+    {
+      const char *current = iter->ids[iter->index++];
+
+      if (iter->by_app)
+        iter->entry = permission_db_lookup (self, current);
+      else if (!g_hash_table_contains (self->main_updates, current))
+        iter->entry = (PermissionDbEntry *) gvdb_table_get_value (self->main_table, current);
+
+      if (iter->entry == NULL)
+        continue;
+
+      if (id)
+        *id = current;
+      if (entry)
+        *entry = iter->entry;
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+void
+permission_db_iter_clear (PermissionDbIter *iter)
+{
+  g_clear_pointer (&iter->ids, g_strfreev);
+  g_clear_pointer (&iter->entry, permission_db_entry_unref);
+}
+
 /* Transfer: full */
 char **
 permission_db_list_ids_by_value (PermissionDb *self,
@@ -961,6 +1053,13 @@ permission_db_entry_get_data (PermissionDbEntry *entry)
   return g_variant_get_child_value (variant, 0);
 }
 
+/* Size of the serialized entry */
+gsize
+permission_db_entry_get_size (PermissionDbEntry *entry)
+{
+  return g_variant_get_size ((GVariant *) entry);
+}
+
 /* Transfer: container */
 const char **
 permission_db_entry_list_apps (PermissionDbEntry *entry)
@@ -995,6 +1094,34 @@ permission_db_entry_list_apps (PermissionDbEntry *entry)
   return (const char **) g_ptr_array_free (res, FALSE);
 }
 
+/* Returns a floating a{sas} of the apps with any permissions */
+GVariant *
+permission_db_entry_get_app_permissions (PermissionDbEntry *entry)
+{
+  GVariant *v = (GVariant *) entry;
+
+  g_autoptr(GVariant) app_array = NULL;
+  GVariantBuilder builder;
+  GVariantIter iter;
+  GVariant *child;
+
+  app_array = g_variant_get_child_value (v, 1);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sas}"));
+  g_variant_iter_init (&iter, app_array);
+  while ((child = g_variant_iter_next_value (&iter)))
+    {
+      g_autoptr(GVariant) permissions = g_variant_get_child_value (child, 1);
+
+      if (g_variant_n_children (permissions) > 0)
+        g_variant_builder_add_value (&builder, child);
+
+      g_variant_unref (child);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
 static GVariant *
 permission_db_entry_get_permissions_variant (PermissionDbEntry *entry,
                                              const char     *app_id)
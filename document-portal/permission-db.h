@@ -31,6 +31,18 @@ G_BEGIN_DECLS
 typedef struct PermissionDb       PermissionDb;
 typedef struct _PermissionDbEntry PermissionDbEntry;
 
+typedef struct
+{
+  /*< private >*/
+  PermissionDb      *db;
+  char             **ids;
+  int                index;
+  gboolean           by_app;
+  gboolean           in_updates;
+  GHashTableIter     updates_iter;
+  PermissionDbEntry *entry;
+} PermissionDbIter;
+
 #define PERMISSION_TYPE_DB (permission_db_get_type ())
 #define PERMISSION_DB(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), PERMISSION_TYPE_DB, PermissionDb))
 #define PERMISSION_IS_DB(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), PERMISSION_TYPE_DB))
@@ -48,6 +60,13 @@ char **        permission_db_list_ids_by_value (PermissionDb *self,
                                                 GVariant  *data);
 PermissionDbEntry *permission_db_lookup (PermissionDb  *self,
                                    const char *id);
+void           permission_db_iter_init (PermissionDbIter *iter,
+                                        PermissionDb     *self,
+                                        const char       *app);
+gboolean       permission_db_iter_next (PermissionDbIter   *iter,
+                                        const char        **id,
+                                        PermissionDbEntry **entry);
+void           permission_db_iter_clear (PermissionDbIter *iter);
 GString *      permission_db_print_string (PermissionDb *self,
                                            GString   *string);
 char *         permission_db_print (PermissionDb *self);
@@ -75,7 +94,9 @@ void           permission_db_set_path (PermissionDb  *self,
 PermissionDbEntry  *permission_db_entry_ref (PermissionDbEntry *entry);
 void            permission_db_entry_unref (PermissionDbEntry *entry);
 GVariant *      permission_db_entry_get_data (PermissionDbEntry *entry);
+gsize           permission_db_entry_get_size (PermissionDbEntry *entry);
 const char **   permission_db_entry_list_apps (PermissionDbEntry *entry);
+GVariant *      permission_db_entry_get_app_permissions (PermissionDbEntry *entry);
 const char **   permission_db_entry_list_permissions (PermissionDbEntry *entry,
                                                       const char     *app);
 gboolean        permission_db_entry_has_permission (PermissionDbEntry *entry,
@@ -98,6 +119,7 @@ PermissionDbEntry  *permission_db_entry_remove_app_permissions (PermissionDbEntr
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (PermissionDb, g_object_unref)
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (PermissionDbEntry, permission_db_entry_unref)
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (PermissionDbIter, permission_db_iter_clear)
 
 G_END_DECLS
 
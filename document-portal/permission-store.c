@@ -24,16 +24,24 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <signal.h>
 #include <gio/gio.h>
+#include <glib-unix.h>
 #include "permission-store-dbus.h"
 #include "xdg-permission-store.h"
+#include "src/xdp-metrics.h"
+#include "src/xdp-profile.h"
 
 static void
 on_bus_acquired (GDBusConnection *connection,
                  const gchar     *name,
                  gpointer         user_data)
 {
+  xdp_profile_startup_mark ("bus-acquired");
+
   xdg_permission_store_start (connection);
+
+  xdp_profile_startup_mark ("store-exported");
 }
 
 static void
@@ -41,6 +49,7 @@ on_name_acquired (GDBusConnection *connection,
                   const gchar     *name,
                   gpointer         user_data)
 {
+  xdp_profile_startup_mark ("name-acquired");
 }
 
 static void
@@ -55,14 +64,34 @@ on_name_lost (GDBusConnection *connection,
 static gboolean opt_verbose;
 static gboolean opt_replace;
 static gboolean opt_version;
+static gboolean opt_metrics;
+static gboolean opt_stats;
+static gboolean opt_profile_startup;
 
 static GOptionEntry entries[] = {
   { "verbose", 'v', 0, G_OPTION_ARG_NONE, &opt_verbose, "Print debug information", NULL },
   { "replace", 'r', 0, G_OPTION_ARG_NONE, &opt_replace, "Replace", NULL },
+  { "metrics", 0, 0, G_OPTION_ARG_NONE, &opt_metrics, "Export runtime metrics on the bus", NULL },
+  { "stats", 0, 0, G_OPTION_ARG_NONE, &opt_stats, "Print write statistics on SIGUSR1 and on exit", NULL },
+  { "profile-startup", 0, 0, G_OPTION_ARG_NONE, &opt_profile_startup, "Print a timeline of startup to stderr", NULL },
   { "version", 0, 0, G_OPTION_ARG_NONE, &opt_version, "Print version and exit", NULL },
   { NULL }
 };
 
+static gboolean
+print_stats_cb (gpointer user_data)
+{
+  xdg_permission_store_print_stats ();
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+quit_cb (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return G_SOURCE_REMOVE;
+}
+
 static void
 message_handler (const gchar   *log_domain,
                  GLogLevelFlags log_level,
@@ -118,6 +147,12 @@ main (int    argc,
 
   g_set_prgname (argv[0]);
 
+  if (opt_profile_startup || g_getenv ("XDG_DESKTOP_PORTAL_PROFILE_STARTUP") != NULL)
+    xdp_profile_startup_enable ();
+
+  if (opt_metrics || g_getenv ("XDG_DESKTOP_PORTAL_METRICS") != NULL)
+    xdp_metrics_enable ();
+
   owner_id = g_bus_own_name (G_BUS_TYPE_SESSION,
                              "org.freedesktop.impl.portal.PermissionStore",
                              G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT | (opt_replace ? G_BUS_NAME_OWNER_FLAGS_REPLACE : 0),
@@ -129,8 +164,19 @@ main (int    argc,
                              NULL);
 
   loop = g_main_loop_new (NULL, FALSE);
+
+  if (opt_stats)
+    {
+      g_unix_signal_add (SIGUSR1, print_stats_cb, NULL);
+      g_unix_signal_add (SIGINT, quit_cb, loop);
+      g_unix_signal_add (SIGTERM, quit_cb, loop);
+    }
+
   g_main_loop_run (loop);
 
+  if (opt_stats)
+    xdg_permission_store_print_stats ();
+
   g_bus_unown_name (owner_id);
 
   return 0;
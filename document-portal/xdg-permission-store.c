@@ -28,6 +28,8 @@
 #include "xdg-permission-store.h"
 #include "permission-db.h"
 #include "src/xdp-utils.h"
+#include "src/xdp-metrics.h"
+#include "src/xdp-profile.h"
 
 GHashTable *tables = NULL;
 
@@ -38,6 +40,15 @@ typedef struct
   GList     *outstanding_writes;
   GList     *current_writes;
   gboolean   writing;
+  gint64     writeout_start;
+
+  /* Logical changes versus what was actually written */
+  guint64    changes;
+  guint64    change_bytes;
+  guint64    writeouts;
+  guint64    writeout_errors;
+  guint64    bytes_written;
+  guint64    fsyncs;
 } Table;
 
 static void start_writeout (Table *table);
@@ -84,9 +95,66 @@ lookup_table (const char            *name,
 
   g_hash_table_insert (tables, table->name, table);
 
+  /* Every method starts by looking up its table, so the first
+   * request always ends up here.
+   */
+  if (G_UNLIKELY (xdp_profile_startup_enabled))
+    {
+      xdp_profile_startup_mark ("table-loaded");
+      xdp_profile_startup_done ();
+    }
+
   return table;
 }
 
+/* Every writeout rewrites the whole file, and GIO syncs the new
+ * file before renaming it over the old one.
+ */
+static void
+record_writeout (Table    *table,
+                 gboolean  ok)
+{
+  GBytes *content = permission_db_get_content (table->db);
+  gsize size = content ? g_bytes_get_size (content) : 0;
+  char name[256];
+
+  if (ok)
+    {
+      table->writeouts++;
+      table->fsyncs++;
+      table->bytes_written += size;
+    }
+  else
+    table->writeout_errors++;
+
+  if (!xdp_metrics_enabled)
+    return;
+
+  g_snprintf (name, sizeof (name), "tables/%s/writeout", table->name);
+  xdp_metrics_histogram_add (xdp_metrics_histogram (name),
+                             g_get_monotonic_time () - table->writeout_start);
+
+  /* Several changes can be coalesced into one writeout */
+  g_snprintf (name, sizeof (name), "tables/%s/writes", table->name);
+  xdp_metrics_counter_add (xdp_metrics_counter (name), g_list_length (table->current_writes));
+
+  if (!ok)
+    {
+      g_snprintf (name, sizeof (name), "tables/%s/writeout-errors", table->name);
+      xdp_metrics_count (name);
+      return;
+    }
+
+  g_snprintf (name, sizeof (name), "tables/%s/writeouts", table->name);
+  xdp_metrics_count (name);
+
+  g_snprintf (name, sizeof (name), "tables/%s/fsyncs", table->name);
+  xdp_metrics_count (name);
+
+  g_snprintf (name, sizeof (name), "tables/%s/bytes-written", table->name);
+  xdp_metrics_counter_add (xdp_metrics_counter (name), size);
+}
+
 static void
 writeout_done (GObject      *source_object,
                GAsyncResult *res,
@@ -100,6 +168,8 @@ writeout_done (GObject      *source_object,
 
   ok = permission_db_save_content_finish (table->db, res, &error);
 
+  record_writeout (table, ok);
+
   for (l = table->current_writes; l != NULL; l = l->next)
     {
       GDBusMethodInvocation *invocation = l->data;
@@ -128,16 +198,33 @@ start_writeout (Table *table)
   table->current_writes = table->outstanding_writes;
   table->outstanding_writes = NULL;
   table->writing = TRUE;
+  table->writeout_start = g_get_monotonic_time ();
 
   permission_db_update (table->db);
 
   permission_db_save_content_async (table->db, NULL, writeout_done, table);
 }
 
+/* The logical size of a change is the id plus the new entry */
 static void
 ensure_writeout (Table                 *table,
-                 GDBusMethodInvocation *invocation)
+                 GDBusMethodInvocation *invocation,
+                 const char            *id,
+                 PermissionDbEntry     *entry)
 {
+  gsize change_size = strlen (id) + (entry ? permission_db_entry_get_size (entry) : 0);
+
+  table->changes++;
+  table->change_bytes += change_size;
+
+  if (xdp_metrics_enabled)
+    {
+      char name[256];
+
+      g_snprintf (name, sizeof (name), "tables/%s/change-bytes", table->name);
+      xdp_metrics_counter_add (xdp_metrics_counter (name), change_size);
+    }
+
   table->outstanding_writes = g_list_prepend (table->outstanding_writes, invocation);
 
   if (!table->writing)
@@ -286,7 +373,7 @@ handle_delete (XdgPermissionStore     *object,
   permission_db_set_entry (table->db, id, NULL);
   emit_deleted (object, table_name, id, entry);
 
-  ensure_writeout (table, invocation);
+  ensure_writeout (table, invocation, id, NULL);
 
   return TRUE;
 }
@@ -320,7 +407,7 @@ handle_delete_permission (XdgPermissionStore     *object,
   permission_db_set_entry (table->db, id, new_entry);
   emit_changed (object, table_name, id, new_entry);
 
-  ensure_writeout (table, invocation);
+  ensure_writeout (table, invocation, id, new_entry);
 
   return TRUE;
 }
@@ -410,7 +497,7 @@ handle_set (XdgPermissionStore     *object,
   permission_db_set_entry (table->db, id, new_entry);
   emit_changed (object, table_name, id, new_entry);
 
-  ensure_writeout (table, invocation);
+  ensure_writeout (table, invocation, id, new_entry);
 
   return TRUE;
 }
@@ -453,7 +540,7 @@ handle_set_permission (XdgPermissionStore     *object,
   permission_db_set_entry (table->db, id, new_entry);
   emit_changed (object, table_name, id, new_entry);
 
-  ensure_writeout (table, invocation);
+  ensure_writeout (table, invocation, id, new_entry);
 
   return TRUE;
 }
@@ -501,11 +588,38 @@ handle_set_value (XdgPermissionStore     *object,
   permission_db_set_entry (table->db, id, new_entry);
   emit_changed (object, table_name, id, new_entry);
 
-  ensure_writeout (table, invocation);
+  ensure_writeout (table, invocation, id, new_entry);
 
   return TRUE;
 }
 
+void
+xdg_permission_store_print_stats (void)
+{
+  GHashTableIter iter;
+  Table *table;
+
+  if (tables == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, tables);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &table))
+    {
+      g_print ("%s: %" G_GUINT64_FORMAT " changes, %" G_GUINT64_FORMAT " bytes changed, "
+               "%" G_GUINT64_FORMAT " writeouts, %" G_GUINT64_FORMAT " errors, "
+               "%" G_GUINT64_FORMAT " bytes written, %" G_GUINT64_FORMAT " fsyncs, "
+               "write amplification %.1f\n",
+               table->name,
+               table->changes,
+               table->change_bytes,
+               table->writeouts,
+               table->writeout_errors,
+               table->bytes_written,
+               table->fsyncs,
+               table->change_bytes > 0 ? (double) table->bytes_written / table->change_bytes : 0.0);
+    }
+}
+
 void
 xdg_permission_store_start (GDBusConnection *connection)
 {
@@ -534,6 +648,12 @@ xdg_permission_store_start (GDBusConnection *connection)
                                          connection,
                                          "/org/freedesktop/impl/portal/PermissionStore",
                                          &error))
+    {
+      g_warning ("error: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  if (!xdp_metrics_export (connection, "/org/freedesktop/impl/portal/PermissionStore", &error))
     {
       g_warning ("error: %s", error->message);
       g_error_free (error);
@@ -21,3 +21,4 @@
 #pragma once
 
 void xdg_permission_store_start (GDBusConnection *connection);
+void xdg_permission_store_print_stats (void);
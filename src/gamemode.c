@@ -156,35 +156,18 @@ game_mode_class_init (GameModeClass *klass)
 static gboolean
 game_mode_is_allowed_for_app (const char *app_id, GError **error)
 {
-  g_autoptr(GVariant) perms = NULL;
-  g_autoptr(GVariant) data = NULL;
-  g_autoptr(GError) err = NULL;
-  const char **stored;
-  gboolean ok;
+  g_auto(GStrv) stored = NULL;
 
-  ok = xdp_impl_permission_store_call_lookup_sync (get_permission_store (),
-                                                   PERMISSION_TABLE,
-                                                   PERMISSION_ID,
-                                                   &perms,
-                                                   &data,
-                                                   NULL,
-                                                   &err);
-
-  if (!ok)
-    {
-      g_dbus_error_strip_remote_error (err);
-      g_debug ("No gamemode permissions found: %s", err->message);
-      g_clear_error (&err);
-    }
-  else if (perms != NULL && g_variant_lookup (perms, app_id, "^a&s", &stored))
+  stored = get_permissions_cached (app_id, PERMISSION_TABLE, PERMISSION_ID);
+  if (stored != NULL)
     {
       g_autofree char *as_str = NULL;
       gboolean allowed;
 
-      as_str = g_strjoinv (" ", (char **)stored);
+      as_str = g_strjoinv (" ", stored);
       g_debug ("GameMode permissions for %s: %s", app_id, as_str);
 
-      allowed = !g_strv_contains (stored, "no");
+      allowed = !g_strv_contains ((const char * const *)stored, "no");
 
       if (!allowed)
         g_set_error (error, XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_NOT_ALLOWED,
@@ -215,96 +198,77 @@ check_pids(const pid_t *pids, gint count, GError **error)
 
 /* generic dbus call handling */
 
-typedef struct CallData_ {
-  GDBusMethodInvocation *inv;
-  XdpAppInfo *app_info;
-
-  char *method;
-
-  int      ids[2];
-  guint    n_ids;
-
-  GUnixFDList *fdlist;
-
-} CallData;
-
-static CallData *
-call_data_new (GDBusMethodInvocation *inv,
-               XdpAppInfo            *app_info,
-               const char            *method)
-{
-  CallData *call;
-
-  call = g_slice_new0 (CallData);
-
-  call->inv = g_object_ref (inv);
-  call->app_info = xdp_app_info_ref (app_info);
-  call->method = g_strdup (method);
-
-  return call;
-}
-
 static void
-call_data_free (gpointer data)
+handle_call_done (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
 {
-  CallData *call = data;
-  if (call == NULL)
-    return;
+  g_autoptr(GDBusMethodInvocation) invocation = user_data;
+  g_autoptr(GVariant) res = NULL;
+  g_autoptr(GError) error = NULL;
+  gint r;
+
+  res = g_dbus_proxy_call_with_unix_fd_list_finish (G_DBUS_PROXY (source_object),
+                                                    NULL,
+                                                    result,
+                                                    &error);
 
-  g_object_unref (call->inv);
-  xdp_app_info_unref (call->app_info);
-  g_free (call->method);
-  g_clear_object(&call->fdlist);
+  r = -2; /* default to "call got rejected" */
+  if (res != NULL)
+    g_variant_get (res, "(i)", &r);
+  else
+    g_debug ("Call to GameMode failed: %s", error->message);
 
-  g_slice_free (CallData, call);
+  g_dbus_method_invocation_return_value (invocation, g_variant_new ("(i)", r));
 }
 
+/* The permission and the pid mapping are cached, so checking them here
+ * is cheap after the first call. The call to the GameMode daemon itself
+ * is asynchronous, so a stalled daemon does not tie up any threads.
+ */
 static void
-handle_call_thread (GTask        *task,
-                    gpointer      source_object,
-                    gpointer      task_data,
-                    GCancellable *cancellable)
+handle_call (const char            *method,
+             GDBusMethodInvocation *invocation,
+             const gint            *ids,
+             guint                  n_ids,
+             GUnixFDList           *fdlist)
 {
   g_autoptr(GError) error = NULL;
-  g_autoptr(GVariant) res = NULL;
-  GUnixFDList *fdlist = NULL;
+  Request *request;
+  XdpAppInfo *app_info;
   GVariant *params;
   const char *app_id;
-  CallData *call;
   gboolean ok;
-  gint r;
 
-  call = (CallData *) task_data;
-  app_id = xdp_app_info_get_id (call->app_info);
+  request = request_from_invocation (invocation);
+  app_info = request->app_info;
+  app_id = xdp_app_info_get_id (app_info);
 
   if (!game_mode_is_allowed_for_app (app_id, &error))
     {
-      g_dbus_method_invocation_return_gerror (call->inv, error);
+      g_dbus_method_invocation_return_gerror (invocation, error);
       return;
     }
 
   /* if we don't have a list of fds, we got pids and need to map them */
-  if (call->fdlist == NULL)
+  if (fdlist == NULL)
     {
       pid_t pids[2] = {0, };
-      guint n_pids;
-
-      n_pids = call->n_ids;
 
-      for (guint i = 0; i < n_pids; i++)
-        pids[0] = (pid_t) call->ids[i];
+      for (guint i = 0; i < n_ids; i++)
+        pids[i] = (pid_t) ids[i];
 
-      ok = xdg_app_info_map_pids (call->app_info, pids, n_pids, &error);
+      ok = xdg_app_info_map_pids (app_info, pids, n_ids, &error);
 
       if (!ok)
         {
           g_prefix_error (&error, "Could not map pids: ");
           g_warning ("GameMode error: %s", error->message);
-          g_dbus_method_invocation_return_gerror (call->inv, error);
+          g_dbus_method_invocation_return_gerror (invocation, error);
           return;
         }
 
-      if (n_pids == 1)
+      if (n_ids == 1)
         params = g_variant_new ("(i)", (gint32) pids[0]);
       else
         params = g_variant_new ("(ii)", (gint32) pids[0], (gint32) pids[1]);
@@ -316,17 +280,15 @@ handle_call_thread (GTask        *task,
       const int *fds;
       gint n_pids;
 
-      fdlist = call->fdlist;
-
       /* verify fds are actually pidfds */
       fds = g_unix_fd_list_peek_fds (fdlist, &n_pids);
 
-      ok = xdg_app_info_pidfds_to_pids (call->app_info, fds, pids, n_pids, &error);
+      ok = xdg_app_info_pidfds_to_pids (app_info, fds, pids, n_pids, &error);
 
       if (!ok || !check_pids (pids, n_pids, &error))
         {
           g_warning ("Pidfd verification error: %s", error->message);
-          g_dbus_method_invocation_return_error (call->inv,
+          g_dbus_method_invocation_return_error (invocation,
                                                  G_DBUS_ERROR,
                                                  G_DBUS_ERROR_INVALID_ARGS,
                                                  "failed to verify fds as pidfds: %s",
@@ -337,36 +299,23 @@ handle_call_thread (GTask        *task,
       params = g_variant_new ("(hh)", 0, 1);
     }
 
-  res = g_dbus_proxy_call_with_unix_fd_list_sync (G_DBUS_PROXY (gamemode->client),
-                                                  call->method,
-                                                  params,
-                                                  G_DBUS_CALL_FLAGS_NONE,
-                                                  -1,
-                                                  fdlist,
-                                                  NULL,
-                                                  NULL, /* cancel */
-                                                  &error);
-
-  r = -2; /* default to "call got rejected" */
-  if (res != NULL)
-    g_variant_get (res, "(i)", &r);
-  else
-    g_debug ("Call to GameMode failed: %s", error->message);
-
-  g_dbus_method_invocation_return_value (call->inv, g_variant_new ("(i)", r));
+  g_dbus_proxy_call_with_unix_fd_list (G_DBUS_PROXY (gamemode->client),
+                                       method,
+                                       params,
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1,
+                                       fdlist,
+                                       NULL, /* cancel */
+                                       handle_call_done,
+                                       g_object_ref (invocation));
 }
 
 static void
-handle_call_in_thread_fds (XdpGameMode           *object,
-                           const char            *method,
-                           GDBusMethodInvocation *invocation,
-                           GUnixFDList           *fdlist)
+handle_call_fds (XdpGameMode           *object,
+                 const char            *method,
+                 GDBusMethodInvocation *invocation,
+                 GUnixFDList           *fdlist)
 {
-  g_autoptr(GTask) task = NULL;
-  XdpAppInfo *app_info;
-  Request  *request;
-  CallData *call;
-
   if (fdlist == NULL || g_unix_fd_list_get_length (fdlist) != 2)
     {
       g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
@@ -374,48 +323,19 @@ handle_call_in_thread_fds (XdpGameMode           *object,
       return;
     }
 
-  request = request_from_invocation (invocation);
-  app_info = request->app_info;
-
-  call = call_data_new (invocation, app_info, method);
-  call->fdlist = g_object_ref (fdlist);
-
-  task = g_task_new (object, NULL, NULL, NULL);
-
-  g_task_set_task_data (task, call, call_data_free);
-  g_task_run_in_thread (task, handle_call_thread);
+  handle_call (method, invocation, NULL, 0, fdlist);
 }
 
 static void
-handle_call_in_thread (XdpGameMode           *object,
-                       const char            *method,
-                       GDBusMethodInvocation *invocation,
-                       gint                   target,
-                       gint                   requester)
+handle_call_pids (XdpGameMode           *object,
+                  const char            *method,
+                  GDBusMethodInvocation *invocation,
+                  gint                   target,
+                  gint                   requester)
 {
-  g_autoptr(GTask) task = NULL;
-  XdpAppInfo *app_info;
-  Request  *request;
-  CallData *call;
-
-  request = request_from_invocation (invocation);
-  app_info = request->app_info;
-
-  call = call_data_new (invocation, app_info, method);
-
-  call->ids[0] = target;
-  call->n_ids = 1;
-
-  if (requester != 0)
-    {
-      call->ids[1] = requester;
-      call->n_ids += 1;
-    }
-
-  task = g_task_new (object, NULL, NULL, NULL);
+  gint ids[2] = { target, requester };
 
-  g_task_set_task_data (task, call, call_data_free);
-  g_task_run_in_thread (task, handle_call_thread);
+  handle_call (method, invocation, ids, requester != 0 ? 2 : 1, NULL);
 }
 
 /* dbus */
@@ -424,7 +344,7 @@ handle_query_status (XdpGameMode           *object,
                      GDBusMethodInvocation *invocation,
                      gint                   pid)
 {
-  handle_call_in_thread (object, "QueryStatus", invocation, pid, 0);
+  handle_call_pids (object, "QueryStatus", invocation, pid, 0);
   return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
 
@@ -433,7 +353,7 @@ handle_register_game (XdpGameMode           *object,
                       GDBusMethodInvocation *invocation,
                       gint                   pid)
 {
-  handle_call_in_thread (object, "RegisterGame", invocation, pid, 0);
+  handle_call_pids (object, "RegisterGame", invocation, pid, 0);
   return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
 
@@ -442,7 +362,7 @@ handle_unregister_game (XdpGameMode *object,
                         GDBusMethodInvocation *invocation,
                         gint pid)
 {
-  handle_call_in_thread (object, "UnregisterGame", invocation, pid, 0);
+  handle_call_pids (object, "UnregisterGame", invocation, pid, 0);
   return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
 
@@ -452,11 +372,11 @@ handle_query_status_by_pid (XdpGameMode *object,
                             gint target,
                             gint requester)
 {
-  handle_call_in_thread (object,
-                         "QueryStatusByPID",
-                         invocation,
-                         target,
-                         requester);
+  handle_call_pids (object,
+                    "QueryStatusByPID",
+                    invocation,
+                    target,
+                    requester);
   return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
 
@@ -466,11 +386,11 @@ handle_register_game_by_pid (XdpGameMode *object,
                              gint target,
                              gint requester)
 {
-  handle_call_in_thread (object,
-                         "RegisterGameByPID",
-                         invocation,
-                         target,
-                         requester);
+  handle_call_pids (object,
+                    "RegisterGameByPID",
+                    invocation,
+                    target,
+                    requester);
   return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
 
@@ -480,11 +400,11 @@ handle_unregister_game_by_pid (XdpGameMode *object,
                                gint target,
                                gint requester)
 {
-  handle_call_in_thread (object,
-                         "UnregisterGameByPID",
-                         invocation,
-                         target,
-                         requester);
+  handle_call_pids (object,
+                    "UnregisterGameByPID",
+                    invocation,
+                    target,
+                    requester);
   return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
 
@@ -496,10 +416,10 @@ handle_query_status_by_pidfd (XdpGameMode *object,
                               GVariant *arg_target,
                               GVariant *arg_requester)
 {
-  handle_call_in_thread_fds (object,
-                             "QueryStatusByPIDFd",
-                             invocation,
-                             fd_list);
+  handle_call_fds (object,
+                   "QueryStatusByPIDFd",
+                   invocation,
+                   fd_list);
 
   return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
@@ -511,10 +431,10 @@ handle_register_game_by_pidfd (XdpGameMode *object,
                                GVariant *arg_target,
                                GVariant *arg_requester)
 {
-  handle_call_in_thread_fds (object,
-                             "RegisterGameByPIDFd",
-                             invocation,
-                             fd_list);
+  handle_call_fds (object,
+                   "RegisterGameByPIDFd",
+                   invocation,
+                   fd_list);
 
   return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
@@ -526,10 +446,10 @@ handle_unregister_game_by_pidfd (XdpGameMode *object,
                                  GVariant *arg_target,
                                  GVariant *arg_requester)
 {
-  handle_call_in_thread_fds (object,
-                             "UnregisterGameByPIDFd",
-                             invocation,
-                             fd_list);
+  handle_call_fds (object,
+                   "UnregisterGameByPIDFd",
+                   invocation,
+                   fd_list);
 
   return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
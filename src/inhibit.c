@@ -101,7 +101,7 @@ get_allowed_inhibit (const char *app_id)
   g_auto(GStrv) perms = NULL;
   guint32 ret = 0;
 
-  perms = get_permissions_sync (app_id, PERMISSION_TABLE, PERMISSION_ID);
+  perms = get_permissions_cached (app_id, PERMISSION_TABLE, PERMISSION_ID);
 
   if (perms != NULL)
     {
@@ -251,6 +251,11 @@ typedef struct _InhibitSession
   Session parent;
 
   gboolean closed;
+
+  /* The last state sent to the app, only used from the main thread */
+  gboolean have_state;
+  gboolean screensaver_active;
+  guint32 session_state;
 } InhibitSession;
 
 typedef struct _InhibitSessionClass
@@ -483,31 +488,102 @@ inhibit_class_init (InhibitClass *klass)
 {
 }
 
+/* Backends tend to send state changes for all sessions in a burst,
+ * and may repeat states that did not actually change. We collect the
+ * latest state per session and deliver them all from a single idle,
+ * skipping sessions that already saw the same state. Only changes of
+ * screensaver-active are coalesced, each session-state transition is
+ * delivered, as apps must see e.g. query-end to respond to it.
+ */
+static GHashTable *pending_states;
+static guint flush_states_id;
+
+static void
+emit_pending_states (void)
+{
+  GDBusConnection *connection = g_dbus_proxy_get_connection (G_DBUS_PROXY (impl));
+  GHashTableIter iter;
+  const char *session_id;
+  GVariant *state;
+
+  g_hash_table_iter_init (&iter, pending_states);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&session_id, (gpointer *)&state))
+    {
+      g_autoptr(Session) session = lookup_session (session_id);
+      InhibitSession *inhibit_session = (InhibitSession *)session;
+      gboolean active = FALSE;
+      guint32 session_state = 0;
+
+      if (!inhibit_session || inhibit_session->closed)
+        continue;
+
+      g_variant_lookup (state, "screensaver-active", "b", &active);
+      g_variant_lookup (state, "session-state", "u", &session_state);
+
+      if (inhibit_session->have_state &&
+          inhibit_session->screensaver_active == active &&
+          inhibit_session->session_state == session_state)
+        {
+          g_debug ("Skipping unchanged state for %s", session_id);
+          continue;
+        }
+
+      inhibit_session->have_state = TRUE;
+      inhibit_session->screensaver_active = active;
+      inhibit_session->session_state = session_state;
+
+      g_dbus_connection_emit_signal (connection,
+                                     session->sender,
+                                     "/org/freedesktop/portal/desktop",
+                                     "org.freedesktop.portal.Inhibit",
+                                     "StateChanged",
+                                     g_variant_new ("(o@a{sv})", session_id, state),
+                                     NULL);
+    }
+
+  g_hash_table_remove_all (pending_states);
+}
+
+static gboolean
+flush_pending_states (gpointer data)
+{
+  flush_states_id = 0;
+
+  emit_pending_states ();
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 state_changed_cb (XdpImplInhibit *impl,
                   const char *session_id,
                   GVariant *state,
                   gpointer data)
 {
-  GDBusConnection *connection = g_dbus_proxy_get_connection (G_DBUS_PROXY (impl));
-  g_autoptr(Session) session = lookup_session (session_id);
-  InhibitSession *inhibit_session = (InhibitSession *)session;
   gboolean active = FALSE;
   guint32 session_state = 0;
+  GVariant *pending;
 
   g_variant_lookup (state, "screensaver-active", "b", &active);
   g_variant_lookup (state, "session-state", "u", &session_state);
   g_debug ("Received state-changed %s: screensaver-active: %d, session-state: %u",
            session_id, active, session_state);
 
-  if (inhibit_session && !inhibit_session->closed)
-    g_dbus_connection_emit_signal (connection,
-                                   session->sender,
-                                   "/org/freedesktop/portal/desktop",
-                                   "org.freedesktop.portal.Inhibit",
-                                   "StateChanged",
-                                   g_variant_new ("(o@a{sv})", session_id, state),
-                                   NULL);
+  /* Don't let a new session-state replace one that wasn't sent yet */
+  pending = g_hash_table_lookup (pending_states, session_id);
+  if (pending != NULL)
+    {
+      guint32 pending_session_state = 0;
+
+      g_variant_lookup (pending, "session-state", "u", &pending_session_state);
+      if (pending_session_state != session_state)
+        emit_pending_states ();
+    }
+
+  g_hash_table_insert (pending_states, g_strdup (session_id), g_variant_ref (state));
+
+  if (flush_states_id == 0)
+    flush_states_id = g_idle_add (flush_pending_states, NULL);
 }
 
 GDBusInterfaceSkeleton *
@@ -531,6 +607,9 @@ inhibit_create (GDBusConnection *connection,
 
   inhibit = g_object_new (inhibit_get_type (), NULL);
 
+  pending_states = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, (GDestroyNotify)g_variant_unref);
+
   g_signal_connect (impl, "state-changed", G_CALLBACK (state_changed_cb), inhibit);
 
   return G_DBUS_INTERFACE_SKELETON (inhibit);
@@ -23,15 +23,39 @@
 #include <string.h>
 
 #include "permissions.h"
+#include "xdp-utils.h"
 
 static XdpImplPermissionStore *permission_store = NULL;
 
-char **
-get_permissions_sync (const char *app_id,
-                      const char *table,
-                      const char *id)
+/* Cache for get_permissions_cached(). Keys are "table\nid\napp_id",
+ * values are the permissions (NULL if there are none). The whole cache
+ * is dropped whenever the permission store reports a change, and the
+ * generation counter keeps lookups that raced with a change from
+ * inserting stale results.
+ */
+G_LOCK_DEFINE_STATIC (permission_cache);
+static GHashTable *permission_cache = NULL;
+static guint permission_cache_generation = 0;
+
+static void
+invalidate_permission_cache (void)
 {
-  g_autoptr(GError) error = NULL;
+  G_LOCK (permission_cache);
+  permission_cache_generation++;
+  if (permission_cache)
+    g_hash_table_remove_all (permission_cache);
+  G_UNLOCK (permission_cache);
+}
+
+/* Returns NULL without setting @error if there are no permissions, and
+ * sets @error if the permission store could not be asked */
+static char **
+lookup_permissions (const char  *app_id,
+                    const char  *table,
+                    const char  *id,
+                    GError     **error)
+{
+  g_autoptr(GError) local_error = NULL;
   g_autoptr(GVariant) out_perms = NULL;
   g_autoptr(GVariant) out_data = NULL;
   g_autofree char **permissions = NULL;
@@ -42,10 +66,20 @@ get_permissions_sync (const char *app_id,
                                                    &out_perms,
                                                    &out_data,
                                                    NULL,
-                                                   &error))
+                                                   &local_error))
     {
-      g_dbus_error_strip_remote_error (error);
-      g_debug ("No '%s' permissions found: %s", table, error->message);
+      g_autofree char *remote_error = g_dbus_error_get_remote_error (local_error);
+      gboolean not_found;
+
+      not_found = g_error_matches (local_error, XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_NOT_FOUND) ||
+                  g_strcmp0 (remote_error, "org.freedesktop.portal.Error.NotFound") == 0;
+
+      g_dbus_error_strip_remote_error (local_error);
+      g_debug ("No '%s' permissions found: %s", table, local_error->message);
+
+      if (!not_found)
+        g_propagate_error (error, g_steal_pointer (&local_error));
+
       return NULL;
     }
 
@@ -59,6 +93,52 @@ get_permissions_sync (const char *app_id,
   return g_strdupv (permissions);
 }
 
+char **
+get_permissions_sync (const char *app_id,
+                      const char *table,
+                      const char *id)
+{
+  return lookup_permissions (app_id, table, id, NULL);
+}
+
+char **
+get_permissions_cached (const char *app_id,
+                        const char *table,
+                        const char *id)
+{
+  g_autofree char *key = NULL;
+  g_autoptr(GError) error = NULL;
+  char **permissions = NULL;
+  gpointer cached;
+  guint generation;
+
+  key = g_strconcat (table, "\n", id, "\n", app_id, NULL);
+
+  G_LOCK (permission_cache);
+  if (permission_cache &&
+      g_hash_table_lookup_extended (permission_cache, key, NULL, &cached))
+    {
+      permissions = g_strdupv (cached);
+      G_UNLOCK (permission_cache);
+      return permissions;
+    }
+  generation = permission_cache_generation;
+  G_UNLOCK (permission_cache);
+
+  permissions = lookup_permissions (app_id, table, id, &error);
+
+  /* Don't remember a failure to reach the store as having no permissions */
+  if (error != NULL)
+    return permissions;
+
+  G_LOCK (permission_cache);
+  if (permission_cache && generation == permission_cache_generation)
+    g_hash_table_insert (permission_cache, g_steal_pointer (&key), g_strdupv (permissions));
+  G_UNLOCK (permission_cache);
+
+  return permissions;
+}
+
 Permission
 permissions_to_tristate (char **permissions)
 {
@@ -134,6 +214,8 @@ set_permissions_sync (const char *app_id,
       g_dbus_error_strip_remote_error (error);
       g_warning ("Error updating permission store: %s", error->message);
     }
+
+  invalidate_permission_cache ();
 }
 
 Permission
@@ -150,6 +232,20 @@ get_permission_sync (const char *app_id,
   return PERMISSION_UNSET;
 }
 
+Permission
+get_permission_cached (const char *app_id,
+                       const char *table,
+                       const char *id)
+{
+  g_auto(GStrv) perms = NULL;
+
+  perms = get_permissions_cached (app_id, table, id);
+  if (perms)
+    return permissions_to_tristate (perms);
+
+  return PERMISSION_UNSET;
+}
+
 void set_permission_sync (const char *app_id,
                           const char *table,
                           const char *id,
@@ -161,6 +257,18 @@ void set_permission_sync (const char *app_id,
   set_permissions_sync (app_id, table, id, (const char * const *)perms);
 }
 
+static void
+permission_store_changed (XdpImplPermissionStore *store,
+                          const char *table,
+                          const char *id,
+                          gboolean deleted,
+                          GVariant *data,
+                          GVariant *permissions,
+                          gpointer user_data)
+{
+  invalidate_permission_cache ();
+}
+
 void
 init_permission_store (GDBusConnection *connection)
 {
@@ -172,7 +280,15 @@ init_permission_store (GDBusConnection *connection)
                                                                "/org/freedesktop/impl/portal/PermissionStore",
                                                                NULL, &error);
   if (permission_store == NULL)
-    g_warning ("No permission store: %s", error->message);
+    {
+      g_warning ("No permission store: %s", error->message);
+      return;
+    }
+
+  permission_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, (GDestroyNotify)g_strfreev);
+  g_signal_connect (permission_store, "changed",
+                    G_CALLBACK (permission_store_changed), NULL);
 }
 
 XdpImplPermissionStore *
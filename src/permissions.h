@@ -44,6 +44,14 @@ Permission get_permission_sync (const char *app_id,
                                 const char *table,
                                 const char *id);
 
+char **get_permissions_cached (const char *app_id,
+                               const char *table,
+                               const char *id);
+
+Permission get_permission_cached (const char *app_id,
+                                  const char *table,
+                                  const char *id);
+
 void set_permission_sync (const char *app_id,
                           const char *table,
                           const char *id,
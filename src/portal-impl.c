@@ -264,3 +264,17 @@ find_all_portal_implementations (const char *interface)
 
   return impls;
 }
+
+GPtrArray *
+get_all_portal_implementations (void)
+{
+  GPtrArray *impls;
+  GList *l;
+
+  impls = g_ptr_array_new ();
+
+  for (l = implementations; l != NULL; l = l->next)
+    g_ptr_array_add (impls, l->data);
+
+  return impls;
+}
@@ -35,5 +35,6 @@ typedef struct {
 void                  load_installed_portals          (gboolean opt_verbose);
 PortalImplementation *find_portal_implementation      (const char *interface);
 GPtrArray            *find_all_portal_implementations (const char *interface);
+GPtrArray            *get_all_portal_implementations  (void);
 
 #endif  /* __PORTAL_IMPL_H__ */
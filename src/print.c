@@ -55,12 +55,136 @@ static XdpImplPrint *impl;
 static Print *print;
 static XdpImplLockdown *lockdown;
 
+/* Results of successful PreparePrint calls, keyed by token and app id,
+ * so that a following Print call can hand them to the backend directly.
+ */
+#define MAX_PREPARED_PRINTS 32
+
+typedef struct {
+  GVariant *settings;
+  GVariant *page_setup;
+} PreparedPrint;
+
+G_LOCK_DEFINE_STATIC (prepared_prints);
+static GHashTable *prepared_prints;
+
 GType print_get_type (void) G_GNUC_CONST;
 static void print_iface_init (XdpPrintIface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (Print, print, XDP_TYPE_PRINT_SKELETON,
                          G_IMPLEMENT_INTERFACE (XDP_TYPE_PRINT, print_iface_init));
 
+static void
+prepared_print_free (PreparedPrint *prepared)
+{
+  g_clear_pointer (&prepared->settings, g_variant_unref);
+  g_clear_pointer (&prepared->page_setup, g_variant_unref);
+  g_free (prepared);
+}
+
+/* Host callers have no app id, so their tokens are kept per
+ * connection, as unique names can't be mistaken for app ids */
+static char *
+prepared_print_key (Request *request,
+                    guint32 token)
+{
+  if (xdp_app_info_is_host (request->app_info))
+    return g_strdup_printf ("%u:%s", token, request->sender);
+
+  return g_strdup_printf ("%u:%s", token, xdp_app_info_get_id (request->app_info));
+}
+
+static void
+remember_prepared_print (Request *request,
+                         GVariant *results)
+{
+  PreparedPrint *prepared;
+  guint32 token;
+
+  if (!g_variant_lookup (results, "token", "u", &token))
+    return;
+
+  prepared = g_new0 (PreparedPrint, 1);
+  prepared->settings = g_variant_lookup_value (results, "settings", G_VARIANT_TYPE_VARDICT);
+  prepared->page_setup = g_variant_lookup_value (results, "page-setup", G_VARIANT_TYPE_VARDICT);
+
+  G_LOCK (prepared_prints);
+
+  /* Tokens that never get used would otherwise pile up */
+  if (g_hash_table_size (prepared_prints) >= MAX_PREPARED_PRINTS)
+    g_hash_table_remove_all (prepared_prints);
+
+  g_hash_table_insert (prepared_prints, prepared_print_key (request, token), prepared);
+
+  G_UNLOCK (prepared_prints);
+}
+
+static PreparedPrint *
+steal_prepared_print (Request *request,
+                      guint32 token)
+{
+  g_autofree char *key = prepared_print_key (request, token);
+  PreparedPrint *prepared = NULL;
+
+  G_LOCK (prepared_prints);
+  g_hash_table_steal_extended (prepared_prints, key, NULL, (gpointer *)&prepared);
+  G_UNLOCK (prepared_prints);
+
+  return prepared;
+}
+
+static gboolean
+validate_print_fd (GUnixFDList *fd_list,
+                   GVariant *arg_fd,
+                   GError **error)
+{
+  int fd_id = g_variant_get_handle (arg_fd);
+  struct stat st_buf;
+  int flags;
+  int fd;
+
+  if (fd_list == NULL || fd_id < 0 || fd_id >= g_unix_fd_list_get_length (fd_list))
+    {
+      g_set_error (error, XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_INVALID_ARGUMENT,
+                   "Bad file descriptor index");
+      return FALSE;
+    }
+
+  fd = g_unix_fd_list_peek_fds (fd_list, NULL)[fd_id];
+
+  flags = fcntl (fd, F_GETFL);
+  if (flags == -1 || fstat (fd, &st_buf) != 0)
+    {
+      g_set_error (error, XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_INVALID_ARGUMENT,
+                   "Invalid file descriptor");
+      return FALSE;
+    }
+
+  /* O_PATH fds don't need read permission to open, so they would not
+   * show that the caller can read the file */
+  if ((flags & O_PATH) == O_PATH ||
+      ((flags & O_ACCMODE) != O_RDONLY && (flags & O_ACCMODE) != O_RDWR))
+    {
+      g_set_error (error, XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_INVALID_ARGUMENT,
+                   "File descriptor is not readable");
+      return FALSE;
+    }
+
+  /* Pipes and sockets let apps stream the document to the backend
+   * while it is being generated.
+   */
+  if (!S_ISREG (st_buf.st_mode) &&
+      !S_ISFIFO (st_buf.st_mode) &&
+      !S_ISSOCK (st_buf.st_mode))
+    {
+      g_set_error (error, XDG_DESKTOP_PORTAL_ERROR, XDG_DESKTOP_PORTAL_ERROR_INVALID_ARGUMENT,
+                   "Can only print regular files, pipes or sockets");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 static void
 print_done (GObject *source,
             GAsyncResult *result,
@@ -116,6 +240,8 @@ handle_print (XdpPrint *object,
   g_autoptr(GError) error = NULL;
   g_autoptr(XdpImplRequest) impl_request = NULL;
   GVariantBuilder opt_builder;
+  PreparedPrint *prepared = NULL;
+  guint32 token;
 
   if (xdp_impl_lockdown_get_disable_printing (lockdown))
     {
@@ -127,6 +253,11 @@ handle_print (XdpPrint *object,
       return G_DBUS_METHOD_INVOCATION_HANDLED;
     }
 
+  if (!validate_print_fd (fd_list, arg_fd, &error))
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      return G_DBUS_METHOD_INVOCATION_HANDLED;
+    }
 
   REQUEST_AUTOLOCK (request);
 
@@ -147,6 +278,19 @@ handle_print (XdpPrint *object,
   g_variant_builder_init (&opt_builder, G_VARIANT_TYPE_VARDICT);
   xdp_filter_options (arg_options, &opt_builder,
                       print_options, G_N_ELEMENTS (print_options), NULL);
+
+  if (g_variant_lookup (arg_options, "token", "u", &token))
+    prepared = steal_prepared_print (request, token);
+
+  if (prepared)
+    {
+      if (prepared->settings)
+        g_variant_builder_add (&opt_builder, "{sv}", "settings", prepared->settings);
+      if (prepared->page_setup)
+        g_variant_builder_add (&opt_builder, "{sv}", "page-setup", prepared->page_setup);
+      prepared_print_free (prepared);
+    }
+
   xdp_impl_print_call_print(impl,
                             request->id,
                             app_id,
@@ -199,9 +343,12 @@ prepare_print_done (GObject *source,
       g_variant_builder_init (&opt_builder, G_VARIANT_TYPE_VARDICT);
 
       if (response == 0)
-        xdp_filter_options (options, &opt_builder,
-                            response_options, G_N_ELEMENTS (response_options),
-                            NULL);
+        {
+          xdp_filter_options (options, &opt_builder,
+                              response_options, G_N_ELEMENTS (response_options),
+                              NULL);
+          remember_prepared_print (request, options);
+        }
 
       xdp_request_emit_response (XDP_REQUEST (request),
                                  response,
@@ -292,6 +439,8 @@ print_init (Print *print)
 static void
 print_class_init (PrintClass *klass)
 {
+  prepared_prints = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, (GDestroyNotify)prepared_print_free);
 }
 
 GDBusInterfaceSkeleton *
@@ -111,7 +111,7 @@ handle_make_thread_realtime_with_pid (XdpRealtime           *object,
       return G_DBUS_METHOD_INVOCATION_HANDLED;
     }
 
-  permission = get_permission_sync (app_id, PERMISSION_TABLE, PERMISSION_ID);
+  permission = get_permission_cached (app_id, PERMISSION_TABLE, PERMISSION_ID);
   if (permission == PERMISSION_NO)
     {
       g_dbus_method_invocation_return_error (invocation,
@@ -161,7 +161,7 @@ handle_make_thread_high_priority_with_pid (XdpRealtime           *object,
       return G_DBUS_METHOD_INVOCATION_HANDLED;
     }
 
-  permission = get_permission_sync (app_id, PERMISSION_TABLE, PERMISSION_ID);
+  permission = get_permission_cached (app_id, PERMISSION_TABLE, PERMISSION_ID);
   if (permission == PERMISSION_NO)
     {
       g_dbus_method_invocation_return_error (invocation,
@@ -439,6 +439,47 @@ request_unexport (Request *request)
   g_object_unref (request);
 }
 
+/* Like xdp_request_emit_response(), but the signal carries @fd_list,
+ * so that handles in @results can refer to it. GDBus skeletons can't
+ * attach fds to signals, so we build the message ourselves.
+ */
+void
+request_emit_response_with_fd_list (Request *request,
+                                    guint response,
+                                    GVariant *results,
+                                    GUnixFDList *fd_list)
+{
+  XdpRequestSkeleton *skeleton = XDP_REQUEST_SKELETON (request);
+  GList      *connections, *l;
+  GVariant   *signal_variant;
+
+  connections = g_dbus_interface_skeleton_get_connections (G_DBUS_INTERFACE_SKELETON (skeleton));
+
+  signal_variant = g_variant_ref_sink (g_variant_new ("(u@a{sv})",
+                                                      response,
+                                                      results));
+  for (l = connections; l != NULL; l = l->next)
+    {
+      GDBusConnection *connection = l->data;
+      g_autoptr(GDBusMessage) message = NULL;
+      g_autoptr(GError) error = NULL;
+
+      message = g_dbus_message_new_signal (g_dbus_interface_skeleton_get_object_path (G_DBUS_INTERFACE_SKELETON (skeleton)),
+                                           "org.freedesktop.portal.Request",
+                                           "Response");
+      g_dbus_message_set_destination (message, request->sender);
+      g_dbus_message_set_body (message, signal_variant);
+      g_dbus_message_set_unix_fd_list (message, fd_list);
+
+      if (!g_dbus_connection_send_message (connection, message,
+                                           G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                           NULL, &error))
+        g_warning ("Failed to emit Response: %s", error->message);
+    }
+  g_variant_unref (signal_variant);
+  g_list_free_full (connections, g_object_unref);
+}
+
 void
 request_set_impl_request (Request *request,
                           XdpImplRequest *impl_request)
@@ -488,6 +529,19 @@ close_requests_in_thread_func (GTask        *task,
   g_slist_free_full (list, g_object_unref);
 }
 
+guint64
+request_get_n_active (void)
+{
+  guint64 n = 0;
+
+  G_LOCK (requests);
+  if (requests)
+    n = g_hash_table_size (requests);
+  G_UNLOCK (requests);
+
+  return n;
+}
+
 void
 close_requests_for_sender (const char *sender)
 {
@@ -61,8 +61,14 @@ Request *request_from_invocation (GDBusMethodInvocation *invocation);
 void request_export (Request *request,
                      GDBusConnection *connection);
 void request_unexport (Request *request);
+void request_emit_response_with_fd_list (Request *request,
+                                         guint response,
+                                         GVariant *results,
+                                         GUnixFDList *fd_list);
 void close_requests_for_sender (const char *sender);
 
+guint64 request_get_n_active (void);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (XdpImplRequest, g_object_unref)
 
 void request_set_impl_request (Request *request,
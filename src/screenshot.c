@@ -26,9 +26,14 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
 
 #include "screenshot.h"
 #include "request.h"
@@ -59,6 +64,42 @@ static void screenshot_iface_init (XdpScreenshotIface *iface);
 G_DEFINE_TYPE_WITH_CODE (Screenshot, screenshot, XDP_TYPE_SCREENSHOT_SKELETON,
                          G_IMPLEMENT_INTERFACE (XDP_TYPE_SCREENSHOT, screenshot_iface_init));
 
+/* Copies the file into a sealed memfd, so the app can't write to the
+ * file in the user's directory and doesn't learn its path */
+static int
+copy_to_sealed_memfd (int      fd,
+                      GError **error)
+{
+  g_autoptr(GInputStream) in = NULL;
+  g_autoptr(GOutputStream) out = NULL;
+  xdp_autofd int memfd = -1;
+
+  memfd = memfd_create ("screenshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd == -1)
+    {
+      int errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "memfd_create: %s", g_strerror (errsv));
+      return -1;
+    }
+
+  in = g_unix_input_stream_new (fd, FALSE);
+  out = g_unix_output_stream_new (memfd, FALSE);
+  if (g_output_stream_splice (out, in, G_OUTPUT_STREAM_SPLICE_NONE, NULL, error) < 0)
+    return -1;
+
+  if (fcntl (memfd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0 ||
+      lseek (memfd, 0, SEEK_SET) != 0)
+    {
+      int errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to seal memfd: %s", g_strerror (errsv));
+      return -1;
+    }
+
+  return xdp_steal_fd (&memfd);
+}
+
 static void
 send_response_in_thread_func (GTask *task,
                               gpointer source_object,
@@ -70,6 +111,7 @@ send_response_in_thread_func (GTask *task,
   guint response;
   GVariant *options;
   g_autoptr(GError) error = NULL;
+  g_autoptr(GUnixFDList) fd_list = NULL;
   const char *retval;
 
   REQUEST_AUTOLOCK (request);
@@ -94,6 +136,56 @@ send_response_in_thread_func (GTask *task,
           goto out;
         }
 
+      if (g_object_get_data (G_OBJECT (request), "return-fd"))
+        {
+          g_autoptr(GFile) file = NULL;
+          g_autofree char *path = NULL;
+          xdp_autofd int fd = -1;
+          xdp_autofd int memfd = -1;
+          int fd_id;
+
+          /* Hand out a sealed copy of the file the backend wrote,
+           * instead of exporting it through the document portal.
+           */
+          file = g_file_new_for_uri (uri);
+          path = g_file_get_path (file);
+          if (path == NULL)
+            {
+              g_warning ("Screenshot %s is not a local file", uri);
+              response = 2;
+              goto out;
+            }
+
+          fd = open (path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+          if (fd == -1)
+            {
+              g_warning ("Failed to open %s: %s", path, g_strerror (errno));
+              response = 2;
+              goto out;
+            }
+
+          memfd = copy_to_sealed_memfd (fd, &error);
+          if (memfd == -1)
+            {
+              g_warning ("Failed to copy %s: %s", path, error->message);
+              response = 2;
+              goto out;
+            }
+
+          fd_list = g_unix_fd_list_new ();
+          fd_id = g_unix_fd_list_append (fd_list, memfd, &error);
+          if (fd_id == -1)
+            {
+              g_warning ("Failed to pass fd for %s: %s", path, error->message);
+              g_clear_object (&fd_list);
+              response = 2;
+              goto out;
+            }
+
+          g_variant_builder_add (&results, "{&sv}", "fd", g_variant_new_handle (fd_id));
+          goto out;
+        }
+
       if (xdp_app_info_is_host (request->app_info))
         ruri = g_strdup (uri);
       else
@@ -124,9 +216,15 @@ send_response_in_thread_func (GTask *task,
 out:
   if (request->exported)
     {
-      xdp_request_emit_response (XDP_REQUEST (request),
-                                 response,
-                                 g_variant_builder_end (&results));
+      if (fd_list)
+        request_emit_response_with_fd_list (request,
+                                            response,
+                                            g_variant_builder_end (&results),
+                                            fd_list);
+      else
+        xdp_request_emit_response (XDP_REQUEST (request),
+                                   response,
+                                   g_variant_builder_end (&results));
       request_unexport (request);
     }
 }
@@ -177,6 +275,7 @@ handle_screenshot (XdpScreenshot *object,
   g_autoptr(GError) error = NULL;
   g_autoptr(XdpImplRequest) impl_request = NULL;
   GVariantBuilder opt_builder;
+  gboolean return_fd = FALSE;
 
   REQUEST_AUTOLOCK (request);
 
@@ -191,6 +290,10 @@ handle_screenshot (XdpScreenshot *object,
       return G_DBUS_METHOD_INVOCATION_HANDLED;
     }
 
+  g_variant_lookup (arg_options, "return_fd", "b", &return_fd);
+  if (return_fd)
+    g_object_set_data (G_OBJECT (request), "return-fd", GINT_TO_POINTER (1));
+
   request_set_impl_request (request, impl_request);
   request_export (request, g_dbus_method_invocation_get_connection (invocation));
 
@@ -303,7 +406,7 @@ screenshot_iface_init (XdpScreenshotIface *iface)
 static void
 screenshot_init (Screenshot *screenshot)
 {
-  xdp_screenshot_set_version (XDP_SCREENSHOT (screenshot), 2);
+  xdp_screenshot_set_version (XDP_SCREENSHOT (screenshot), 3);
 }
 
 static void
@@ -262,6 +262,19 @@ close_sessions_in_thread_func (GTask *task,
   g_slist_free_full (list, g_object_unref);
 }
 
+guint64
+session_get_n_active (void)
+{
+  guint64 n = 0;
+
+  G_LOCK (sessions);
+  if (sessions)
+    n = g_hash_table_size (sessions);
+  G_UNLOCK (sessions);
+
+  return n;
+}
+
 void
 close_sessions_for_sender (const char *sender)
 {
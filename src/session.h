@@ -76,6 +76,8 @@ gboolean session_export (Session *session,
 
 void close_sessions_for_sender (const char *sender);
 
+guint64 session_get_n_active (void);
+
 void session_close (Session *session,
                     gboolean notify_close);
 
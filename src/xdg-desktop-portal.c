@@ -28,10 +28,13 @@
 #include <glib/gi18n.h>
 
 #include "xdp-utils.h"
+#include "xdp-metrics.h"
+#include "xdp-profile.h"
 #include "xdp-dbus.h"
 #include "xdp-impl-dbus.h"
 #include "request.h"
 #include "call.h"
+#include "session.h"
 #include "portal-impl.h"
 #include "documents.h"
 #include "permissions.h"
@@ -65,11 +68,16 @@ static GMainLoop *loop = NULL;
 
 gboolean opt_verbose;
 static gboolean opt_replace;
+static gboolean opt_metrics;
+static gboolean opt_profile_startup;
 static gboolean show_version;
+static GPtrArray *exported_interfaces;
 
 static GOptionEntry entries[] = {
   { "verbose", 'v', 0, G_OPTION_ARG_NONE, &opt_verbose, "Print debug information during command processing", NULL },
   { "replace", 'r', 0, G_OPTION_ARG_NONE, &opt_replace, "Replace a running instance", NULL },
+  { "metrics", 0, 0, G_OPTION_ARG_NONE, &opt_metrics, "Export runtime metrics on the bus", NULL },
+  { "profile-startup", 0, 0, G_OPTION_ARG_NONE, &opt_profile_startup, "Print a timeline of startup to stderr", NULL },
   { "version", 0, 0, G_OPTION_ARG_NONE, &show_version, "Show program version.", NULL},
   { NULL }
 };
@@ -153,6 +161,20 @@ authorize_callback (GDBusInterfaceSkeleton *interface,
 
   g_autoptr(GError) error = NULL;
 
+  if (G_UNLIKELY (xdp_metrics_enabled))
+    {
+      char name[256];
+
+      g_snprintf (name, sizeof (name), "calls/%s.%s",
+                  g_dbus_method_invocation_get_interface_name (invocation),
+                  g_dbus_method_invocation_get_method_name (invocation));
+      xdp_metrics_count (name);
+      xdp_metrics_count ("incoming/started");
+    }
+
+  if (G_UNLIKELY (xdp_profile_startup_enabled))
+    xdp_profile_startup_done ();
+
   app_info = xdp_invocation_lookup_app_info_sync (invocation, NULL, &error);
   if (app_info == NULL)
     {
@@ -197,9 +219,77 @@ export_portal_implementation (GDBusConnection *connection,
       return;
     }
 
+  g_ptr_array_add (exported_interfaces,
+                   g_strdup (g_dbus_interface_skeleton_get_info (skeleton)->name));
+
   g_debug ("providing portal %s", g_dbus_interface_skeleton_get_info (skeleton)->name);
 }
 
+static guint64
+get_app_info_cache_hits (void)
+{
+  guint64 hits, misses, size;
+
+  xdp_get_app_info_cache_stats (&hits, &misses, &size);
+  return hits;
+}
+
+static guint64
+get_app_info_cache_misses (void)
+{
+  guint64 hits, misses, size;
+
+  xdp_get_app_info_cache_stats (&hits, &misses, &size);
+  return misses;
+}
+
+static guint64
+get_app_info_cache_size (void)
+{
+  guint64 hits, misses, size;
+
+  xdp_get_app_info_cache_stats (&hits, &misses, &size);
+  return size;
+}
+
+static void
+export_metrics (GDBusConnection *connection)
+{
+  g_autoptr(GPtrArray) impls = NULL;
+  g_autoptr(GError) error = NULL;
+
+  if (!xdp_metrics_enabled)
+    return;
+
+  xdp_metrics_add_gauge ("requests/active", request_get_n_active);
+  xdp_metrics_add_gauge ("sessions/active", session_get_n_active);
+  xdp_metrics_add_gauge ("app-info/cache-hits", get_app_info_cache_hits);
+  xdp_metrics_add_gauge ("app-info/cache-misses", get_app_info_cache_misses);
+  xdp_metrics_add_gauge ("app-info/cache-size", get_app_info_cache_size);
+
+  /* The portals are all exported at this point, and the set of
+   * tracked interfaces must not change afterwards.
+   */
+  g_ptr_array_add (exported_interfaces, NULL);
+  xdp_metrics_track_calls (connection,
+                           DESKTOP_PORTAL_OBJECT_PATH,
+                           (const char * const *) exported_interfaces->pdata);
+
+  /* Backend and permission store proxies call unique names */
+  impls = get_all_portal_implementations ();
+  for (guint i = 0; i < impls->len; i++)
+    {
+      PortalImplementation *impl = g_ptr_array_index (impls, i);
+
+      xdp_metrics_track_name (connection, impl->dbus_name);
+    }
+  xdp_metrics_track_name (connection, "org.freedesktop.impl.portal.PermissionStore");
+  xdp_metrics_track_name (connection, "org.freedesktop.portal.Documents");
+
+  if (!xdp_metrics_export (connection, DESKTOP_PORTAL_OBJECT_PATH, &error))
+    g_warning ("Failed to export metrics: %s", error->message);
+}
+
 static void
 peer_died_cb (const char *name)
 {
@@ -225,10 +315,16 @@ on_bus_acquired (GDBusConnection *connection,
   /* make sure errors are registered */
   portal_errors = XDG_DESKTOP_PORTAL_ERROR;
 
+  xdp_profile_startup_mark ("bus-acquired");
+
+  exported_interfaces = g_ptr_array_new_with_free_func (g_free);
+
   xdp_connection_track_name_owners (connection, peer_died_cb);
   init_document_proxy (connection);
   init_permission_store (connection);
 
+  xdp_profile_startup_mark ("store-proxies-created");
+
   implementation = find_portal_implementation ("org.freedesktop.impl.portal.Lockdown");
   if (implementation != NULL)
     lockdown = xdp_impl_lockdown_proxy_new_sync (connection,
@@ -343,6 +439,10 @@ on_bus_acquired (GDBusConnection *connection,
     export_portal_implementation (connection,
                                   remote_desktop_create (connection, implementation->dbus_name));
 #endif
+
+  xdp_profile_startup_mark ("portals-exported");
+
+  export_metrics (connection);
 }
 
 static void
@@ -350,6 +450,8 @@ on_name_acquired (GDBusConnection *connection,
                   const gchar     *name,
                   gpointer         user_data)
 {
+  xdp_profile_startup_mark ("name-acquired");
+
   g_debug ("%s acquired", name);
 }
 
@@ -419,8 +521,16 @@ main (int argc, char *argv[])
 
   g_set_prgname (argv[0]);
 
+  if (opt_profile_startup || g_getenv ("XDG_DESKTOP_PORTAL_PROFILE_STARTUP") != NULL)
+    xdp_profile_startup_enable ();
+
+  if (opt_metrics || g_getenv ("XDG_DESKTOP_PORTAL_METRICS") != NULL)
+    xdp_metrics_enable ();
+
   load_installed_portals (opt_verbose);
 
+  xdp_profile_startup_mark ("portals-loaded");
+
   loop = g_main_loop_new (NULL, FALSE);
 
   session_bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
@@ -430,6 +540,8 @@ main (int argc, char *argv[])
       return 2;
     }
 
+  xdp_profile_startup_mark ("bus-connected");
+
   owner_id = g_bus_own_name (G_BUS_TYPE_SESSION,
                              "org.freedesktop.portal.Desktop",
                              G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT | (opt_replace ? G_BUS_NAME_OWNER_FLAGS_REPLACE : 0),
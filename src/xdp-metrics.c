@@ -0,0 +1,626 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "xdp-metrics.h"
+
+/* Metrics are recorded into per-thread shards, which are only written
+ * by their own thread, so recording never takes a lock or contends on
+ * a cache line. A metric is the index of its first slot in the shards.
+ * Readers sum up all the shards under metrics_lock. When a thread
+ * exits, its values are folded into the retired shard.
+ *
+ * Histograms use N_BUCKETS + 2 slots: the number of values, their
+ * sum, and then the buckets. Bucket i counts values below 2^(i+4)
+ * microseconds, the last bucket counts everything else.
+ */
+
+#define MAX_SLOTS 4096
+#define N_BUCKETS 22
+#define HISTOGRAM_SLOTS (N_BUCKETS + 2)
+#define MAX_PENDING_CALLS 4096
+
+typedef enum {
+  METRIC_COUNTER,
+  METRIC_HISTOGRAM,
+} MetricType;
+
+typedef struct {
+  char *name;
+  MetricType type;
+  XdpMetric slot;
+} MetricInfo;
+
+typedef struct {
+  guint64 slots[MAX_SLOTS];
+  GHashTable *names;
+} MetricsShard;
+
+typedef struct {
+  char *name;
+  XdpMetricsGaugeFunc func;
+} Gauge;
+
+typedef struct {
+  char *object_path;
+  GHashTable *interfaces;
+  GHashTable *pending;
+} CallTracker;
+
+typedef struct {
+  XdpMetric metric;
+  gint64 start;
+} PendingCall;
+
+gboolean xdp_metrics_enabled = FALSE;
+
+static void shard_retire (gpointer data);
+
+static GMutex metrics_lock;
+static GPtrArray *metrics;
+static GHashTable *metrics_by_name;
+static guint n_slots;
+static GPtrArray *shards;
+static MetricsShard *retired;
+static GArray *gauges;
+static gboolean tracking_calls;
+static GMutex owners_lock;
+static GHashTable *owners;
+static GHashTable *tracked_names;
+static GPrivate current_shard = G_PRIVATE_INIT (shard_retire);
+
+static GDBusNodeInfo *metrics_introspection_data;
+
+static const char metrics_introspection_xml[] =
+  "<node>"
+  "  <interface name='" XDP_METRICS_INTERFACE "'>"
+  "    <method name='GetMetrics'>"
+  "      <arg type='a{st}' name='counters' direction='out'/>"
+  "      <arg type='a{s(ttat)}' name='histograms' direction='out'/>"
+  "      <arg type='at' name='bucket_bounds' direction='out'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
+
+static void
+metric_info_free (gpointer data)
+{
+  MetricInfo *info = data;
+
+  g_free (info->name);
+  g_free (info);
+}
+
+void
+xdp_metrics_enable (void)
+{
+  g_mutex_lock (&metrics_lock);
+  if (metrics == NULL)
+    {
+      metrics = g_ptr_array_new_with_free_func (metric_info_free);
+      metrics_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+      shards = g_ptr_array_new ();
+      retired = g_new0 (MetricsShard, 1);
+      gauges = g_array_new (FALSE, FALSE, sizeof (Gauge));
+    }
+  g_mutex_unlock (&metrics_lock);
+
+  xdp_metrics_enabled = TRUE;
+}
+
+static void
+shard_retire (gpointer data)
+{
+  MetricsShard *shard = data;
+
+  g_mutex_lock (&metrics_lock);
+  for (guint i = 0; i < n_slots; i++)
+    retired->slots[i] += __atomic_load_n (&shard->slots[i], __ATOMIC_RELAXED);
+  g_ptr_array_remove_fast (shards, shard);
+  g_mutex_unlock (&metrics_lock);
+
+  g_hash_table_unref (shard->names);
+  g_free (shard);
+}
+
+static MetricsShard *
+get_shard (void)
+{
+  MetricsShard *shard = g_private_get (&current_shard);
+
+  if (G_LIKELY (shard != NULL))
+    return shard;
+
+  shard = g_new0 (MetricsShard, 1);
+  shard->names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  g_mutex_lock (&metrics_lock);
+  g_ptr_array_add (shards, shard);
+  g_mutex_unlock (&metrics_lock);
+
+  g_private_set (&current_shard, shard);
+
+  return shard;
+}
+
+/* Only the owning thread writes to a shard, so a relaxed load and
+ * store is enough, and avoids a locked instruction.
+ */
+static inline void
+shard_add (MetricsShard *shard,
+           guint         slot,
+           guint64       value)
+{
+  guint64 old = __atomic_load_n (&shard->slots[slot], __ATOMIC_RELAXED);
+
+  __atomic_store_n (&shard->slots[slot], old + value, __ATOMIC_RELAXED);
+}
+
+static XdpMetric
+lookup_metric (const char *name,
+               MetricType  type)
+{
+  MetricsShard *shard;
+  MetricInfo *info;
+  gpointer cached;
+  XdpMetric slot;
+
+  if (!xdp_metrics_enabled)
+    return XDP_METRICS_INVALID;
+
+  /* Each thread caches the names it has used, so the shared
+   * registry is only consulted the first time.
+   */
+  shard = get_shard ();
+  cached = g_hash_table_lookup (shard->names, name);
+  if (cached)
+    return GPOINTER_TO_UINT (cached) - 1;
+
+  g_mutex_lock (&metrics_lock);
+
+  info = g_hash_table_lookup (metrics_by_name, name);
+  if (info == NULL)
+    {
+      guint size = type == METRIC_HISTOGRAM ? HISTOGRAM_SLOTS : 1;
+
+      if (n_slots + size > MAX_SLOTS)
+        {
+          g_mutex_unlock (&metrics_lock);
+          g_warning ("Too many metrics, not recording %s", name);
+          return XDP_METRICS_INVALID;
+        }
+
+      info = g_new0 (MetricInfo, 1);
+      info->name = g_strdup (name);
+      info->type = type;
+      info->slot = n_slots;
+      n_slots += size;
+
+      g_ptr_array_add (metrics, info);
+      g_hash_table_insert (metrics_by_name, info->name, info);
+    }
+
+  slot = info->slot;
+
+  g_mutex_unlock (&metrics_lock);
+
+  if (info->type != type)
+    {
+      g_warning ("Metric %s used with the wrong type", name);
+      return XDP_METRICS_INVALID;
+    }
+
+  g_hash_table_insert (shard->names, g_strdup (name), GUINT_TO_POINTER (slot + 1));
+
+  return slot;
+}
+
+XdpMetric
+xdp_metrics_counter (const char *name)
+{
+  return lookup_metric (name, METRIC_COUNTER);
+}
+
+XdpMetric
+xdp_metrics_histogram (const char *name)
+{
+  return lookup_metric (name, METRIC_HISTOGRAM);
+}
+
+void
+xdp_metrics_counter_add (XdpMetric metric,
+                         guint64   value)
+{
+  if (metric == XDP_METRICS_INVALID)
+    return;
+
+  shard_add (get_shard (), metric, value);
+}
+
+static guint
+bucket_for_value (guint64 usec)
+{
+  guint bits = g_bit_storage (usec);
+
+  return MIN (MAX (bits, 4) - 4, N_BUCKETS - 1);
+}
+
+static guint64
+bucket_bound (guint bucket)
+{
+  if (bucket == N_BUCKETS - 1)
+    return G_MAXUINT64;
+
+  return G_GUINT64_CONSTANT (1) << (bucket + 4);
+}
+
+void
+xdp_metrics_histogram_add (XdpMetric metric,
+                           gint64    usec)
+{
+  MetricsShard *shard;
+
+  if (metric == XDP_METRICS_INVALID)
+    return;
+
+  if (usec < 0)
+    usec = 0;
+
+  shard = get_shard ();
+  shard_add (shard, metric, 1);
+  shard_add (shard, metric + 1, usec);
+  shard_add (shard, metric + 2 + bucket_for_value (usec), 1);
+}
+
+GMutexLocker *
+xdp_metrics_mutex_locker_new (GMutex     *mutex,
+                              const char *metric)
+{
+  GMutexLocker *locker;
+  gint64 start;
+
+  if (G_LIKELY (!xdp_metrics_enabled))
+    return g_mutex_locker_new (mutex);
+
+  start = g_get_monotonic_time ();
+  locker = g_mutex_locker_new (mutex);
+  xdp_metrics_histogram_add (xdp_metrics_histogram (metric),
+                             g_get_monotonic_time () - start);
+
+  return locker;
+}
+
+void
+xdp_metrics_add_gauge (const char          *name,
+                       XdpMetricsGaugeFunc  func)
+{
+  Gauge gauge = { g_strdup (name), func };
+
+  if (!xdp_metrics_enabled)
+    return;
+
+  g_mutex_lock (&metrics_lock);
+  g_array_append_val (gauges, gauge);
+  g_mutex_unlock (&metrics_lock);
+}
+
+static guint64
+sum_slot (guint slot)
+{
+  guint64 value = retired->slots[slot];
+
+  for (guint i = 0; i < shards->len; i++)
+    {
+      MetricsShard *shard = g_ptr_array_index (shards, i);
+
+      value += __atomic_load_n (&shard->slots[slot], __ATOMIC_RELAXED);
+    }
+
+  return value;
+}
+
+static GVariant *
+collect_metrics (void)
+{
+  GVariantBuilder counters;
+  GVariantBuilder histograms;
+  GVariantBuilder bounds;
+  g_autoptr(GArray) current_gauges = NULL;
+  guint64 received = 0;
+  guint64 started = 0;
+
+  g_variant_builder_init (&counters, G_VARIANT_TYPE ("a{st}"));
+  g_variant_builder_init (&histograms, G_VARIANT_TYPE ("a{s(ttat)}"));
+  g_variant_builder_init (&bounds, G_VARIANT_TYPE ("at"));
+
+  g_mutex_lock (&metrics_lock);
+
+  for (guint i = 0; i < metrics->len; i++)
+    {
+      MetricInfo *info = g_ptr_array_index (metrics, i);
+
+      if (info->type == METRIC_COUNTER)
+        {
+          guint64 value = sum_slot (info->slot);
+
+          if (strcmp (info->name, "incoming/received") == 0)
+            received = value;
+          else if (strcmp (info->name, "incoming/started") == 0)
+            started = value;
+
+          g_variant_builder_add (&counters, "{st}", info->name, value);
+        }
+      else
+        {
+          GVariantBuilder buckets;
+
+          g_variant_builder_init (&buckets, G_VARIANT_TYPE ("at"));
+          for (guint j = 0; j < N_BUCKETS; j++)
+            g_variant_builder_add (&buckets, "t", sum_slot (info->slot + 2 + j));
+
+          g_variant_builder_add (&histograms, "{s(tt@at)}",
+                                 info->name,
+                                 sum_slot (info->slot),
+                                 sum_slot (info->slot + 1),
+                                 g_variant_builder_end (&buckets));
+        }
+    }
+
+  current_gauges = g_array_sized_new (FALSE, FALSE, sizeof (Gauge), gauges->len);
+  g_array_append_vals (current_gauges, gauges->data, gauges->len);
+
+  g_mutex_unlock (&metrics_lock);
+
+  /* Gauges may take other locks, so don't call them with ours held */
+  for (guint i = 0; i < current_gauges->len; i++)
+    {
+      Gauge *gauge = &g_array_index (current_gauges, Gauge, i);
+
+      g_variant_builder_add (&counters, "{st}", gauge->name, gauge->func ());
+    }
+
+  if (tracking_calls)
+    g_variant_builder_add (&counters, "{st}", "incoming/queued",
+                           received > started ? received - started : 0);
+
+  for (guint j = 0; j < N_BUCKETS; j++)
+    g_variant_builder_add (&bounds, "t", bucket_bound (j));
+
+  return g_variant_new ("(a{st}a{s(ttat)}at)", &counters, &histograms, &bounds);
+}
+
+static void
+metrics_method_call (GDBusConnection       *connection,
+                     const char            *sender,
+                     const char            *object_path,
+                     const char            *interface_name,
+                     const char            *method_name,
+                     GVariant              *parameters,
+                     GDBusMethodInvocation *invocation,
+                     gpointer               user_data)
+{
+  if (strcmp (method_name, "GetMetrics") == 0)
+    g_dbus_method_invocation_return_value (invocation, collect_metrics ());
+  else
+    g_dbus_method_invocation_return_error (invocation,
+                                           G_DBUS_ERROR,
+                                           G_DBUS_ERROR_UNKNOWN_METHOD,
+                                           "Unknown method %s", method_name);
+}
+
+static const GDBusInterfaceVTable metrics_vtable = {
+  metrics_method_call,
+  NULL,
+  NULL,
+};
+
+gboolean
+xdp_metrics_export (GDBusConnection  *connection,
+                    const char       *object_path,
+                    GError          **error)
+{
+  if (!xdp_metrics_enabled)
+    return TRUE;
+
+  if (metrics_introspection_data == NULL)
+    metrics_introspection_data = g_dbus_node_info_new_for_xml (metrics_introspection_xml, NULL);
+
+  if (g_dbus_connection_register_object (connection,
+                                         object_path,
+                                         metrics_introspection_data->interfaces[0],
+                                         &metrics_vtable,
+                                         NULL, NULL,
+                                         error) == 0)
+    return FALSE;
+
+  g_debug ("providing %s at %s", XDP_METRICS_INTERFACE, object_path);
+
+  return TRUE;
+}
+
+/* Filters run in the GDBus worker thread, for both incoming and
+ * outgoing messages, so the pending table needs no lock.
+ */
+static GDBusMessage *
+track_calls_filter (GDBusConnection *connection,
+                    GDBusMessage    *message,
+                    gboolean         incoming,
+                    gpointer         user_data)
+{
+  CallTracker *tracker = user_data;
+  GDBusMessageType type = g_dbus_message_get_message_type (message);
+
+  if (incoming && type == G_DBUS_MESSAGE_TYPE_METHOD_CALL)
+    {
+      const char *interface = g_dbus_message_get_interface (message);
+
+      if (interface != NULL &&
+          g_strcmp0 (g_dbus_message_get_path (message), tracker->object_path) == 0 &&
+          g_hash_table_contains (tracker->interfaces, interface))
+        xdp_metrics_count ("incoming/received");
+    }
+  else if (incoming &&
+           (type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN ||
+            type == G_DBUS_MESSAGE_TYPE_ERROR))
+    {
+      guint32 serial = g_dbus_message_get_reply_serial (message);
+      PendingCall *call;
+
+      call = g_hash_table_lookup (tracker->pending, GUINT_TO_POINTER (serial));
+      if (call)
+        {
+          xdp_metrics_histogram_add (call->metric, g_get_monotonic_time () - call->start);
+          g_hash_table_remove (tracker->pending, GUINT_TO_POINTER (serial));
+        }
+    }
+  else if (!incoming &&
+           type == G_DBUS_MESSAGE_TYPE_METHOD_CALL &&
+           (g_dbus_message_get_flags (message) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED) == 0)
+    {
+      const char *destination = g_dbus_message_get_destination (message);
+      g_autofree char *owned_name = NULL;
+      char name[512];
+      PendingCall *call;
+
+      if (destination == NULL ||
+          strcmp (destination, "org.freedesktop.DBus") == 0)
+        return message;
+
+      /* Proxies call the unique name of a service. Only record calls
+       * to tracked services, not to clients.
+       */
+      if (destination[0] == ':')
+        {
+          g_mutex_lock (&owners_lock);
+          if (owners)
+            owned_name = g_strdup (g_hash_table_lookup (owners, destination));
+          g_mutex_unlock (&owners_lock);
+
+          if (owned_name == NULL)
+            return message;
+
+          destination = owned_name;
+        }
+
+      /* Don't let calls that never get a reply pile up */
+      if (g_hash_table_size (tracker->pending) >= MAX_PENDING_CALLS)
+        g_hash_table_remove_all (tracker->pending);
+
+      g_snprintf (name, sizeof (name), "call-latency/%s/%s.%s",
+                  destination,
+                  g_dbus_message_get_interface (message),
+                  g_dbus_message_get_member (message));
+
+      call = g_new (PendingCall, 1);
+      call->metric = xdp_metrics_histogram (name);
+      call->start = g_get_monotonic_time ();
+      g_hash_table_insert (tracker->pending,
+                           GUINT_TO_POINTER (g_dbus_message_get_serial (message)),
+                           call);
+    }
+
+  return message;
+}
+
+/* Records the latency of outgoing method calls to other services,
+ * and counts incoming calls to @interfaces on @object_path, to
+ * compute how many are queued but not yet handled. Handlers must
+ * call xdp_metrics_count ("incoming/started") for that to work.
+ */
+void
+xdp_metrics_track_calls (GDBusConnection    *connection,
+                         const char         *object_path,
+                         const char * const *interfaces)
+{
+  CallTracker *tracker;
+
+  if (!xdp_metrics_enabled)
+    return;
+
+  tracker = g_new0 (CallTracker, 1);
+  tracker->object_path = g_strdup (object_path);
+  tracker->interfaces = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  tracker->pending = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  for (guint i = 0; interfaces && interfaces[i]; i++)
+    g_hash_table_add (tracker->interfaces, g_strdup (interfaces[i]));
+
+  tracking_calls = interfaces != NULL && interfaces[0] != NULL;
+
+  g_dbus_connection_add_filter (connection, track_calls_filter, tracker, NULL);
+}
+
+static void
+tracked_name_appeared (GDBusConnection *connection,
+                       const char      *name,
+                       const char      *name_owner,
+                       gpointer         user_data)
+{
+  g_mutex_lock (&owners_lock);
+  g_hash_table_insert (owners, g_strdup (name_owner), g_strdup (name));
+  g_mutex_unlock (&owners_lock);
+}
+
+static gboolean
+is_owner_of (gpointer key,
+             gpointer value,
+             gpointer user_data)
+{
+  return strcmp (value, user_data) == 0;
+}
+
+static void
+tracked_name_vanished (GDBusConnection *connection,
+                       const char      *name,
+                       gpointer         user_data)
+{
+  g_mutex_lock (&owners_lock);
+  g_hash_table_foreach_remove (owners, is_owner_of, (gpointer) name);
+  g_mutex_unlock (&owners_lock);
+}
+
+/* Records the latency of calls to the unique name that owns @name,
+ * under @name. Must be called from the main thread.
+ */
+void
+xdp_metrics_track_name (GDBusConnection *connection,
+                        const char      *name)
+{
+  if (!xdp_metrics_enabled)
+    return;
+
+  if (tracked_names == NULL)
+    {
+      tracked_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+      g_mutex_lock (&owners_lock);
+      owners = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+      g_mutex_unlock (&owners_lock);
+    }
+
+  if (g_hash_table_contains (tracked_names, name))
+    return;
+
+  g_hash_table_add (tracked_names, g_strdup (name));
+
+  g_bus_watch_name_on_connection (connection, name,
+                                  G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                  tracked_name_appeared,
+                                  tracked_name_vanished,
+                                  NULL, NULL);
+}
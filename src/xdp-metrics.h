@@ -0,0 +1,70 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#define XDP_METRICS_INTERFACE "org.freedesktop.portal.Debug.Metrics"
+
+#define XDP_METRICS_INVALID G_MAXUINT
+
+typedef guint XdpMetric;
+
+typedef guint64 (*XdpMetricsGaugeFunc) (void);
+
+extern gboolean xdp_metrics_enabled;
+
+void      xdp_metrics_enable          (void);
+
+XdpMetric xdp_metrics_counter         (const char *name);
+XdpMetric xdp_metrics_histogram       (const char *name);
+
+void      xdp_metrics_counter_add     (XdpMetric   metric,
+                                       guint64     value);
+void      xdp_metrics_histogram_add   (XdpMetric   metric,
+                                       gint64      usec);
+
+void      xdp_metrics_add_gauge       (const char          *name,
+                                       XdpMetricsGaugeFunc  func);
+
+gboolean  xdp_metrics_export          (GDBusConnection  *connection,
+                                       const char       *object_path,
+                                       GError          **error);
+
+void      xdp_metrics_track_calls     (GDBusConnection    *connection,
+                                       const char         *object_path,
+                                       const char * const *interfaces);
+
+void      xdp_metrics_track_name      (GDBusConnection    *connection,
+                                       const char         *name);
+
+GMutexLocker *xdp_metrics_mutex_locker_new (GMutex     *mutex,
+                                            const char *metric);
+
+/* Cheap when metrics are disabled: the name is only looked up
+ * when metrics are enabled.
+ */
+#define xdp_metrics_count(name) \
+  G_STMT_START { \
+    if (G_UNLIKELY (xdp_metrics_enabled)) \
+      xdp_metrics_counter_add (xdp_metrics_counter (name), 1); \
+  } G_STMT_END
+
+/* Like XDP_AUTOLOCK, but records the time spent waiting for the lock */
+#define XDP_METRICS_AUTOLOCK(name, metric) \
+  g_autoptr(GMutexLocker) G_PASTE (name ## locker, __LINE__) = \
+    xdp_metrics_mutex_locker_new (&G_LOCK_NAME (name), metric); \
+  (void) G_PASTE (name ## locker, __LINE__);
@@ -0,0 +1,103 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "xdp-profile.h"
+
+/* Startup profiling records the monotonic time at which each startup
+ * phase finished. When the first request is served, the timeline is
+ * written to stderr as a single line of JSON:
+ *
+ *   {"pid":N,"timeline":[{"phase":"main","time":T},...]}
+ *
+ * Times are CLOCK_MONOTONIC in microseconds, so they can be compared
+ * with timestamps taken by another process, such as the one that
+ * started the daemon.
+ */
+
+typedef struct {
+  const char *phase;
+  gint64 time;
+} Mark;
+
+gboolean xdp_profile_startup_enabled = FALSE;
+
+static GArray *marks;
+static gboolean done;
+G_LOCK_DEFINE_STATIC (marks);
+
+void
+xdp_profile_startup_enable (void)
+{
+  marks = g_array_new (FALSE, FALSE, sizeof (Mark));
+  xdp_profile_startup_enabled = TRUE;
+
+  xdp_profile_startup_mark_real ("main");
+}
+
+/* The phase must be a static string */
+void
+xdp_profile_startup_mark_real (const char *phase)
+{
+  Mark mark = { phase, g_get_monotonic_time () };
+
+  G_LOCK (marks);
+  if (!done)
+    g_array_append_val (marks, mark);
+  G_UNLOCK (marks);
+}
+
+/* Called when the first request is served. Later calls do nothing. */
+void
+xdp_profile_startup_done (void)
+{
+  g_autoptr(GString) json = NULL;
+
+  if (!xdp_profile_startup_enabled)
+    return;
+
+  xdp_profile_startup_mark_real ("first-request");
+
+  G_LOCK (marks);
+
+  if (done)
+    {
+      G_UNLOCK (marks);
+      return;
+    }
+  done = TRUE;
+
+  json = g_string_new (NULL);
+  g_string_append_printf (json, "{\"pid\":%d,\"timeline\":[", (int) getpid ());
+  for (guint i = 0; i < marks->len; i++)
+    {
+      Mark *mark = &g_array_index (marks, Mark, i);
+
+      g_string_append_printf (json, "%s{\"phase\":\"%s\",\"time\":%" G_GINT64_FORMAT "}",
+                              i > 0 ? "," : "", mark->phase, mark->time);
+    }
+  g_string_append (json, "]}\n");
+
+  g_clear_pointer (&marks, g_array_unref);
+
+  G_UNLOCK (marks);
+
+  fputs (json->str, stderr);
+  fflush (stderr);
+}
@@ -0,0 +1,31 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+extern gboolean xdp_profile_startup_enabled;
+
+void xdp_profile_startup_enable   (void);
+void xdp_profile_startup_mark_real (const char *phase);
+void xdp_profile_startup_done     (void);
+
+/* Cheap when profiling is disabled */
+#define xdp_profile_startup_mark(phase) \
+  G_STMT_START { \
+    if (G_UNLIKELY (xdp_profile_startup_enabled)) \
+      xdp_profile_startup_mark_real (phase); \
+  } G_STMT_END
@@ -48,6 +48,8 @@
 
 G_LOCK_DEFINE (app_infos);
 static GHashTable *app_info_by_unique_name;
+static guint64 app_info_cache_hits;
+static guint64 app_info_cache_misses;
 
 /* Based on g_mkstemp from glib */
 
@@ -127,6 +129,9 @@ struct _XdpAppInfo {
 	   /* pid namespace mapping */
           GMutex pidns_lock;
           ino_t   pidns_id;
+          /* inside pid -> XdpPidMapping, see xdg_app_info_map_pids */
+          GMutex pid_cache_lock;
+          GHashTable *pid_cache;
         } flatpak;
       struct
         {
@@ -233,6 +238,7 @@ xdp_app_info_free (XdpAppInfo *app_info)
     {
     case XDP_APP_INFO_KIND_FLATPAK:
       g_clear_pointer (&app_info->u.flatpak.keyfile, g_key_file_free);
+      g_clear_pointer (&app_info->u.flatpak.pid_cache, g_hash_table_unref);
       break;
 
     case XDP_APP_INFO_KIND_SNAP:
@@ -842,6 +848,11 @@ lookup_cached_app_info_by_sender (const char *sender)
       if (app_info)
         xdp_app_info_ref (app_info);
     }
+
+  if (app_info)
+    app_info_cache_hits++;
+  else
+    app_info_cache_misses++;
   G_UNLOCK (app_infos);
 
   return app_info;
@@ -900,6 +911,18 @@ xdp_connection_lookup_app_info_sync (GDBusConnection       *connection,
   return g_steal_pointer (&app_info);
 }
 
+void
+xdp_get_app_info_cache_stats (guint64 *hits,
+                              guint64 *misses,
+                              guint64 *size)
+{
+  G_LOCK (app_infos);
+  *hits = app_info_cache_hits;
+  *misses = app_info_cache_misses;
+  *size = app_info_by_unique_name ? g_hash_table_size (app_info_by_unique_name) : 0;
+  G_UNLOCK (app_infos);
+}
+
 XdpAppInfo *
 xdp_invocation_lookup_app_info_sync (GDBusMethodInvocation *invocation,
                                      GCancellable          *cancellable,
@@ -1740,6 +1763,57 @@ parse_status_file (int    pid_fd,
   return 0;
 }
 
+/* Reads the start time (field 22 of /proc/pid/stat), which together
+ * with the pid identifies a process, even across pid reuse.
+ */
+static int
+parse_start_time (int      pid_fd,
+                  guint64 *start_time)
+{
+  xdp_autofd int fd = -1;
+  char buf[1024];
+  char *p, *end;
+  ssize_t n;
+
+  fd = openat (pid_fd, "stat", O_RDONLY | O_CLOEXEC | O_NOCTTY);
+  if (fd == -1)
+    return -errno;
+
+  do
+    n = read (fd, buf, sizeof (buf) - 1);
+  while (n == -1 && errno == EINTR);
+
+  if (n == -1)
+    return -errno;
+
+  buf[n] = '\0';
+
+  /* The command name may contain spaces and parentheses,
+   * so start looking after the last ')' */
+  p = strrchr (buf, ')');
+  if (p == NULL || p[1] != ' ')
+    return -ENXIO;
+  p += 2;
+
+  /* p now points at field 3 (state) */
+  for (int i = 3; i < 22; i++)
+    {
+      p = strchr (p, ' ');
+      if (p == NULL)
+        return -ENXIO;
+      p++;
+    }
+
+  errno = 0;
+  *start_time = g_ascii_strtoull (p, &end, 10);
+  if (end == p)
+    return -ENXIO;
+  else if (errno != 0)
+    return -errno;
+
+  return 0;
+}
+
 static int
 lookup_ns_from_pid_fd (int    pid_fd,
                        ino_t *ns)
@@ -2131,6 +2205,127 @@ xdg_app_info_ensure_pidns (XdpAppInfo  *app_info,
 
 
 
+/* Mapping pids requires scanning all of /proc, which is expensive,
+ * and apps tend to ask for the same processes over and over (e.g. for
+ * every new audio thread). So we remember the pids we mapped, along
+ * with the start time of the outside process, which lets us detect
+ * when the pid has been reused by a different process.
+ */
+#define PID_CACHE_MAX_SIZE 128
+
+typedef struct {
+  pid_t outside;
+  guint64 start_time;
+} XdpPidMapping;
+
+static gboolean
+pid_mapping_is_current (XdpPidMapping *mapping)
+{
+  char path[32];
+  xdp_autofd int pid_fd = -1;
+  guint64 start_time;
+
+  snprintf (path, sizeof (path), "/proc/%u", (guint) mapping->outside);
+
+  pid_fd = open (path, O_RDONLY | O_NONBLOCK | O_DIRECTORY | O_CLOEXEC | O_NOCTTY);
+  if (pid_fd == -1)
+    return FALSE;
+
+  if (parse_start_time (pid_fd, &start_time) < 0)
+    return FALSE;
+
+  return start_time == mapping->start_time;
+}
+
+static gboolean
+lookup_cached_pids (XdpAppInfo *app_info,
+                    pid_t      *pids,
+                    guint       n_pids)
+{
+  g_autoptr(GMutexLocker) guard = NULL;
+  pid_t *res;
+
+  guard = g_mutex_locker_new (&(app_info->u.flatpak.pid_cache_lock));
+
+  if (app_info->u.flatpak.pid_cache == NULL)
+    return FALSE;
+
+  res = g_alloca (sizeof (pid_t) * n_pids);
+
+  for (guint i = 0; i < n_pids; i++)
+    {
+      XdpPidMapping *mapping;
+
+      mapping = g_hash_table_lookup (app_info->u.flatpak.pid_cache,
+                                     GINT_TO_POINTER (pids[i]));
+      if (mapping == NULL)
+        return FALSE;
+
+      if (!pid_mapping_is_current (mapping))
+        {
+          g_hash_table_remove (app_info->u.flatpak.pid_cache,
+                               GINT_TO_POINTER (pids[i]));
+          return FALSE;
+        }
+
+      res[i] = mapping->outside;
+    }
+
+  memcpy (pids, res, sizeof (pid_t) * n_pids);
+
+  return TRUE;
+}
+
+static void
+cache_pids (XdpAppInfo  *app_info,
+            DIR         *proc,
+            ino_t        pidns,
+            const pid_t *inside,
+            const pid_t *outside,
+            guint        n_pids)
+{
+  g_autoptr(GMutexLocker) guard = NULL;
+
+  guard = g_mutex_locker_new (&(app_info->u.flatpak.pid_cache_lock));
+
+  if (app_info->u.flatpak.pid_cache == NULL)
+    app_info->u.flatpak.pid_cache = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  if (g_hash_table_size (app_info->u.flatpak.pid_cache) + n_pids > PID_CACHE_MAX_SIZE)
+    g_hash_table_remove_all (app_info->u.flatpak.pid_cache);
+
+  for (guint i = 0; i < n_pids; i++)
+    {
+      xdp_autofd int pid_fd = -1;
+      XdpPidMapping *mapping;
+      guint64 start_time;
+      pid_t pid;
+      ino_t ns;
+
+      pid_fd = open_pid_fd (dirfd (proc), outside[i], NULL);
+      if (pid_fd == -1)
+        continue;
+
+      /* The process could have gone away since we mapped it */
+      if (lookup_ns_from_pid_fd (pid_fd, &ns) < 0 || ns != pidns)
+        continue;
+
+      if (parse_status_file (pid_fd, &pid, NULL) < 0 || pid != inside[i])
+        continue;
+
+      if (parse_start_time (pid_fd, &start_time) < 0)
+        continue;
+
+      mapping = g_new0 (XdpPidMapping, 1);
+      mapping->outside = outside[i];
+      mapping->start_time = start_time;
+
+      g_hash_table_insert (app_info->u.flatpak.pid_cache,
+                           GINT_TO_POINTER (inside[i]),
+                           mapping);
+    }
+}
+
 gboolean
 xdg_app_info_map_pids (XdpAppInfo  *app_info,
                        pid_t       *pids,
@@ -2141,6 +2336,7 @@ xdg_app_info_map_pids (XdpAppInfo  *app_info,
   DIR *proc;
   uid_t uid;
   ino_t ns;
+  pid_t *inside;
 
   g_return_val_if_fail (app_info != NULL, FALSE);
   g_return_val_if_fail (pids != NULL, FALSE);
@@ -2152,6 +2348,12 @@ xdg_app_info_map_pids (XdpAppInfo  *app_info,
       return FALSE;
     }
 
+  if (lookup_cached_pids (app_info, pids, n_pids))
+    return TRUE;
+
+  inside = g_alloca (sizeof (pid_t) * n_pids);
+  memcpy (inside, pids, sizeof (pid_t) * n_pids);
+
   proc = opendir ("/proc");
   if (proc == NULL)
     {
@@ -2176,6 +2378,9 @@ xdg_app_info_map_pids (XdpAppInfo  *app_info,
   ns = app_info->u.flatpak.pidns_id;
   ok = map_pids (proc, ns, pids, n_pids, uid, error);
 
+  if (ok)
+    cache_pids (app_info, proc, ns, inside, pids, n_pids);
+
  out:
   closedir (proc);
   return ok;
@@ -118,6 +118,9 @@ XdpAppInfo *xdp_invocation_lookup_app_info_sync (GDBusMethodInvocation *invocati
                                                  GError               **error);
 void   xdp_connection_track_name_owners  (GDBusConnection       *connection,
                                           XdpPeerDiedCallback    peer_died_cb);
+void   xdp_get_app_info_cache_stats      (guint64 *hits,
+                                          guint64 *misses,
+                                          guint64 *size);
 
 
 typedef struct {
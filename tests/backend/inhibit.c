@@ -352,7 +352,13 @@ change_session_state (gpointer data)
 
   g_debug ("change session state: %s\n", change);
 
-  if (change && g_str_has_prefix (change, "query-end"))
+  if (g_strcmp0 (change, "query-end-running") == 0)
+    {
+      /* Logout cancelled right away, both in one burst */
+      set_session_state (QUERY_END);
+      set_session_state (RUNNING);
+    }
+  else if (change && g_str_has_prefix (change, "query-end"))
     {
       wait_for_query_end_response (NULL);
       set_session_state (QUERY_END);
@@ -0,0 +1,692 @@
+/*
+ * Benchmark for the document portal fuse filesystem.
+ *
+ * This starts a document portal on a private session bus, exports
+ * some files and directories to a fake app and measures common
+ * operations through the app-visible paths. With --db, the portal
+ * starts from a copy of a store written by gen-doc-store, whose files
+ * stay where they are, and listing and looking up its documents is
+ * measured too. The results are printed as JSON on stdout, so they
+ * can be compared between releases.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+#include "document-portal/document-portal-dbus.h"
+#include "document-portal/document-enums.h"
+
+#include "can-use-fuse.h"
+#include "utils.h"
+
+#define BENCH_APP_ID "org.test.Bench"
+
+static BenchEnv *env;
+static XdpDbusDocuments *documents;
+static char *mountpoint;
+
+static int opt_duration = 2;
+static int opt_file_size = 64;
+static int opt_dir_entries = 10000;
+static int opt_threads = 8;
+static char *opt_db = NULL;
+
+static GOptionEntry entries[] = {
+  { "duration", 0, 0, G_OPTION_ARG_INT, &opt_duration, "Seconds to run each measurement", "SECONDS" },
+  { "file-size", 0, 0, G_OPTION_ARG_INT, &opt_file_size, "Size of the read/write test file", "MiB" },
+  { "dir-entries", 0, 0, G_OPTION_ARG_INT, &opt_dir_entries, "Number of entries in the readdir test directory", "N" },
+  { "threads", 0, 0, G_OPTION_ARG_INT, &opt_threads, "Maximum number of threads for parallel stat", "N" },
+  { "db", 0, 0, G_OPTION_ARG_FILENAME, &opt_db, "Also benchmark a copy of the store generated by gen-doc-store in DIR", "DIR" },
+  { NULL }
+};
+
+static char *
+export_path (const char *path,
+             guint32     flags)
+{
+  const char *permissions[] = { "read", "write", "grant-permissions", "delete", NULL };
+  g_autoptr(GUnixFDList) fd_list = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree const char **doc_ids = NULL;
+  int fd, fd_id;
+
+  fd = open (path, O_PATH | O_CLOEXEC);
+  if (fd == -1)
+    g_error ("Can't open %s: %s", path, g_strerror (errno));
+
+  fd_list = g_unix_fd_list_new ();
+  fd_id = g_unix_fd_list_append (fd_list, fd, &error);
+  g_assert_no_error (error);
+  close (fd);
+
+  reply = g_dbus_connection_call_with_unix_fd_list_sync (env->bus,
+                                                         "org.freedesktop.portal.Documents",
+                                                         "/org/freedesktop/portal/documents",
+                                                         "org.freedesktop.portal.Documents",
+                                                         "AddFull",
+                                                         g_variant_new ("(@ahus^as)",
+                                                                        g_variant_new_fixed_array (G_VARIANT_TYPE_HANDLE,
+                                                                                                   &fd_id, 1, sizeof (gint32)),
+                                                                        flags,
+                                                                        BENCH_APP_ID,
+                                                                        permissions),
+                                                         G_VARIANT_TYPE ("(asa{sv})"),
+                                                         G_DBUS_CALL_FLAGS_NONE,
+                                                         30000,
+                                                         fd_list, NULL,
+                                                         NULL,
+                                                         &error);
+  g_assert_no_error (error);
+
+  g_variant_get (reply, "(^a&s@a{sv})", &doc_ids, NULL);
+  g_assert (doc_ids != NULL && doc_ids[0] != NULL);
+
+  return g_strdup (doc_ids[0]);
+}
+
+static char *
+make_app_path (const char *doc_id,
+               const char *basename)
+{
+  return g_build_filename (mountpoint, "by-app", BENCH_APP_ID, doc_id, basename, NULL);
+}
+
+static double
+elapsed_seconds (gint64 start)
+{
+  return (g_get_monotonic_time () - start) / (double) G_USEC_PER_SEC;
+}
+
+static void
+bench_stat (JsonBuilder *builder,
+            const char  *path)
+{
+  gint64 start, end;
+  guint64 ops = 0;
+  struct stat buf;
+
+  start = g_get_monotonic_time ();
+  end = start + opt_duration * G_USEC_PER_SEC;
+
+  while (g_get_monotonic_time () < end)
+    {
+      for (int i = 0; i < 100; i++)
+        {
+          if (stat (path, &buf) != 0)
+            g_error ("stat %s failed: %s", path, g_strerror (errno));
+        }
+      ops += 100;
+    }
+
+  json_builder_set_member_name (builder, "getattr_ops_per_sec");
+  json_builder_add_double_value (builder, ops / elapsed_seconds (start));
+}
+
+/* LOOKUP is only sent for names the kernel doesn't have in its dcache,
+ * so look up names that don't exist, which are not cached.
+ */
+static void
+bench_lookup (JsonBuilder *builder,
+              const char  *doc_id)
+{
+  gint64 start, end;
+  guint64 ops = 0;
+  struct stat buf;
+
+  start = g_get_monotonic_time ();
+  end = start + opt_duration * G_USEC_PER_SEC;
+
+  while (g_get_monotonic_time () < end)
+    {
+      g_autofree char *name = g_strdup_printf ("missing-%" G_GUINT64_FORMAT, ops);
+      g_autofree char *path = make_app_path (doc_id, name);
+
+      if (stat (path, &buf) == 0 || errno != ENOENT)
+        g_error ("Unexpected result looking up %s", path);
+      ops++;
+    }
+
+  json_builder_set_member_name (builder, "lookup_ops_per_sec");
+  json_builder_add_double_value (builder, ops / elapsed_seconds (start));
+}
+
+/* Tools like rsync and tar set the mode, times and size of every file
+ * they write, each of which is a separate SETATTR */
+static void
+bench_setattr (JsonBuilder *builder,
+               const char  *path)
+{
+  gint64 start, end;
+  guint64 ops = 0;
+
+  start = g_get_monotonic_time ();
+  end = start + opt_duration * G_USEC_PER_SEC;
+
+  while (g_get_monotonic_time () < end)
+    {
+      for (int i = 0; i < 100; i++)
+        {
+          struct timespec times[2] = { { i, 0 }, { i, 0 } };
+
+          if (chmod (path, (i % 2) ? 0600 : 0644) != 0)
+            g_error ("chmod %s failed: %s", path, g_strerror (errno));
+          if (utimensat (AT_FDCWD, path, times, 0) != 0)
+            g_error ("utimensat %s failed: %s", path, g_strerror (errno));
+          if (truncate (path, i) != 0)
+            g_error ("truncate %s failed: %s", path, g_strerror (errno));
+        }
+      ops += 300;
+    }
+
+  json_builder_set_member_name (builder, "setattr_ops_per_sec");
+  json_builder_add_double_value (builder, ops / elapsed_seconds (start));
+}
+
+/* Re-exporting a file inside a directory document through its fuse
+ * path resolves the host path of the file */
+static void
+bench_reexport (JsonBuilder *builder,
+                const char  *path)
+{
+  gint64 start, end;
+  guint64 ops = 0;
+
+  start = g_get_monotonic_time ();
+  end = start + opt_duration * G_USEC_PER_SEC;
+
+  while (g_get_monotonic_time () < end)
+    {
+      g_autofree char *doc_id = export_path (path, DOCUMENT_ADD_FLAGS_REUSE_EXISTING);
+      ops++;
+    }
+
+  json_builder_set_member_name (builder, "reexport_ops_per_sec");
+  json_builder_add_double_value (builder, ops / elapsed_seconds (start));
+}
+
+static void
+bench_sequential (JsonBuilder *builder,
+                  const char  *path)
+{
+  gsize block_size = 1024 * 1024;
+  gsize n_blocks = opt_file_size;
+  g_autofree char *block = g_malloc (block_size);
+  gint64 start;
+  int fd;
+
+  memset (block, 'x', block_size);
+
+  fd = open (path, O_RDWR | O_TRUNC | O_CLOEXEC);
+  if (fd == -1)
+    g_error ("Can't open %s: %s", path, g_strerror (errno));
+
+  start = g_get_monotonic_time ();
+  for (gsize i = 0; i < n_blocks; i++)
+    {
+      if (write (fd, block, block_size) != (gssize) block_size)
+        g_error ("write failed: %s", g_strerror (errno));
+    }
+  fsync (fd);
+
+  json_builder_set_member_name (builder, "seq_write_mb_per_sec");
+  json_builder_add_double_value (builder, n_blocks / elapsed_seconds (start));
+
+  close (fd);
+
+  /* Reopen, so that we don't just read from the page cache of the write */
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    g_error ("Can't open %s: %s", path, g_strerror (errno));
+
+  posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+
+  start = g_get_monotonic_time ();
+  for (gsize i = 0; i < n_blocks; i++)
+    {
+      if (read (fd, block, block_size) != (gssize) block_size)
+        g_error ("read failed: %s", g_strerror (errno));
+    }
+
+  json_builder_set_member_name (builder, "seq_read_mb_per_sec");
+  json_builder_add_double_value (builder, n_blocks / elapsed_seconds (start));
+
+  close (fd);
+}
+
+static void
+bench_random (JsonBuilder *builder,
+              const char  *path)
+{
+  gsize block_size = 64 * 1024;
+  gsize file_size = (gsize) opt_file_size * 1024 * 1024;
+  guint64 n_blocks = file_size / block_size;
+  g_autofree char *block = g_malloc (block_size);
+  g_autoptr(GRand) rand = g_rand_new_with_seed (42);
+  gint64 start, end;
+  guint64 ops;
+  int fd;
+
+  memset (block, 'y', block_size);
+
+  fd = open (path, O_RDWR | O_CLOEXEC);
+  if (fd == -1)
+    g_error ("Can't open %s: %s", path, g_strerror (errno));
+
+  ops = 0;
+  start = g_get_monotonic_time ();
+  end = start + opt_duration * G_USEC_PER_SEC;
+  while (g_get_monotonic_time () < end)
+    {
+      off_t offset = g_rand_int_range (rand, 0, n_blocks) * block_size;
+
+      if (pread (fd, block, block_size, offset) != (gssize) block_size)
+        g_error ("pread failed: %s", g_strerror (errno));
+      ops++;
+    }
+
+  json_builder_set_member_name (builder, "rand_read_mb_per_sec");
+  json_builder_add_double_value (builder, ops * block_size / (1024.0 * 1024.0) / elapsed_seconds (start));
+
+  ops = 0;
+  start = g_get_monotonic_time ();
+  end = start + opt_duration * G_USEC_PER_SEC;
+  while (g_get_monotonic_time () < end)
+    {
+      off_t offset = g_rand_int_range (rand, 0, n_blocks) * block_size;
+
+      if (pwrite (fd, block, block_size, offset) != (gssize) block_size)
+        g_error ("pwrite failed: %s", g_strerror (errno));
+      ops++;
+    }
+  fsync (fd);
+
+  json_builder_set_member_name (builder, "rand_write_mb_per_sec");
+  json_builder_add_double_value (builder, ops * block_size / (1024.0 * 1024.0) / elapsed_seconds (start));
+
+  /* Small synchronous writes, as done by e.g. databases and loggers */
+  ops = 0;
+  start = g_get_monotonic_time ();
+  end = start + opt_duration * G_USEC_PER_SEC;
+  while (g_get_monotonic_time () < end)
+    {
+      off_t offset = g_rand_int_range (rand, 0, file_size / 4096) * 4096;
+
+      if (pwrite (fd, block, 4096, offset) != 4096)
+        g_error ("pwrite failed: %s", g_strerror (errno));
+      fdatasync (fd);
+      ops++;
+    }
+
+  json_builder_set_member_name (builder, "small_write_iops");
+  json_builder_add_double_value (builder, ops / elapsed_seconds (start));
+
+  close (fd);
+}
+
+static void
+bench_readdir (JsonBuilder *builder,
+               const char  *path)
+{
+  gint64 start, end;
+  guint64 listings = 0;
+  guint64 entries_seen = 0;
+
+  start = g_get_monotonic_time ();
+  end = start + opt_duration * G_USEC_PER_SEC;
+
+  do
+    {
+      struct dirent *de;
+      DIR *dir;
+
+      dir = opendir (path);
+      if (dir == NULL)
+        g_error ("Can't open dir %s: %s", path, g_strerror (errno));
+
+      while ((de = readdir (dir)) != NULL)
+        entries_seen++;
+
+      closedir (dir);
+      listings++;
+    }
+  while (g_get_monotonic_time () < end);
+
+  json_builder_set_member_name (builder, "readdir_entries");
+  json_builder_add_int_value (builder, opt_dir_entries);
+  json_builder_set_member_name (builder, "readdir_listings_per_sec");
+  json_builder_add_double_value (builder, listings / elapsed_seconds (start));
+  json_builder_set_member_name (builder, "readdir_entries_per_sec");
+  json_builder_add_double_value (builder, entries_seen / elapsed_seconds (start));
+}
+
+typedef struct {
+  const char *dir;
+  guint seed;
+  gint64 end;
+  guint64 ops;
+} StatThread;
+
+static gpointer
+stat_thread_func (gpointer data)
+{
+  StatThread *thread = data;
+  g_autoptr(GRand) rand = g_rand_new_with_seed (thread->seed);
+  struct stat buf;
+
+  while (g_get_monotonic_time () < thread->end)
+    {
+      char name[32];
+      g_autofree char *path = NULL;
+
+      g_snprintf (name, sizeof (name), "file-%d", g_rand_int_range (rand, 0, opt_dir_entries));
+      path = g_build_filename (thread->dir, name, NULL);
+
+      if (stat (path, &buf) != 0)
+        g_error ("stat %s failed: %s", path, g_strerror (errno));
+      thread->ops++;
+    }
+
+  return NULL;
+}
+
+static void
+bench_parallel_stat (JsonBuilder *builder,
+                     const char  *dir)
+{
+  json_builder_set_member_name (builder, "parallel_stat_ops_per_sec");
+  json_builder_begin_object (builder);
+
+  for (int n_threads = 1; n_threads <= opt_threads; n_threads *= 2)
+    {
+      g_autofree StatThread *threads = g_new0 (StatThread, n_threads);
+      g_autofree GThread **handles = g_new0 (GThread *, n_threads);
+      g_autofree char *key = g_strdup_printf ("%d", n_threads);
+      gint64 start, end;
+      guint64 total = 0;
+
+      start = g_get_monotonic_time ();
+      end = start + opt_duration * G_USEC_PER_SEC;
+
+      for (int i = 0; i < n_threads; i++)
+        {
+          threads[i].dir = dir;
+          threads[i].seed = i;
+          threads[i].end = end;
+          handles[i] = g_thread_new ("stat", stat_thread_func, &threads[i]);
+        }
+
+      for (int i = 0; i < n_threads; i++)
+        {
+          g_thread_join (handles[i]);
+          total += threads[i].ops;
+        }
+
+      json_builder_set_member_name (builder, key);
+      json_builder_add_double_value (builder, total / elapsed_seconds (start));
+    }
+
+  json_builder_end_object (builder);
+}
+
+static GPtrArray *
+list_dir (const char *path)
+{
+  GPtrArray *names = g_ptr_array_new_with_free_func (g_free);
+  struct dirent *de;
+  DIR *dir;
+
+  dir = opendir (path);
+  if (dir == NULL)
+    g_error ("Can't open dir %s: %s", path, g_strerror (errno));
+
+  while ((de = readdir (dir)) != NULL)
+    {
+      if (strcmp (de->d_name, ".") != 0 && strcmp (de->d_name, "..") != 0)
+        g_ptr_array_add (names, g_strdup (de->d_name));
+    }
+
+  closedir (dir);
+
+  return names;
+}
+
+/* Lists the documents of every app in the store, and then looks up
+ * random documents of the app with the most documents.
+ */
+static void
+bench_store (JsonBuilder *builder)
+{
+  g_autofree char *by_app = g_build_filename (mountpoint, "by-app", NULL);
+  g_autoptr(GPtrArray) apps = NULL;
+  g_autoptr(GPtrArray) docs = NULL;
+  g_autoptr(GRand) rand = g_rand_new_with_seed (42);
+  g_autofree char *popular_dir = NULL;
+  guint64 n_docs = 0;
+  guint64 ops = 0;
+  gint64 start, end;
+  struct stat buf;
+
+  json_builder_set_member_name (builder, "store");
+  json_builder_begin_object (builder);
+
+  start = g_get_monotonic_time ();
+  apps = list_dir (by_app);
+  for (guint i = 0; i < apps->len; i++)
+    {
+      g_autofree char *app_dir = g_build_filename (by_app, g_ptr_array_index (apps, i), NULL);
+      g_autoptr(GPtrArray) app_docs = list_dir (app_dir);
+
+      n_docs += app_docs->len;
+      if (docs == NULL || app_docs->len > docs->len)
+        {
+          g_clear_pointer (&docs, g_ptr_array_unref);
+          docs = g_steal_pointer (&app_docs);
+          g_free (popular_dir);
+          popular_dir = g_steal_pointer (&app_dir);
+        }
+    }
+
+  json_builder_set_member_name (builder, "apps");
+  json_builder_add_int_value (builder, apps->len);
+  json_builder_set_member_name (builder, "app_documents");
+  json_builder_add_int_value (builder, n_docs);
+  json_builder_set_member_name (builder, "list_all_apps_ms");
+  json_builder_add_double_value (builder, elapsed_seconds (start) * 1000.0);
+
+  if (docs != NULL && docs->len > 0)
+    {
+      start = g_get_monotonic_time ();
+      end = start + opt_duration * G_USEC_PER_SEC;
+      while (g_get_monotonic_time () < end)
+        {
+          const char *doc = g_ptr_array_index (docs, g_rand_int_range (rand, 0, docs->len));
+          g_autofree char *path = g_build_filename (popular_dir, doc, NULL);
+
+          if (stat (path, &buf) != 0)
+            g_error ("stat %s failed: %s", path, g_strerror (errno));
+          ops++;
+        }
+
+      json_builder_set_member_name (builder, "popular_app_documents");
+      json_builder_add_int_value (builder, docs->len);
+      json_builder_set_member_name (builder, "popular_app_stat_ops_per_sec");
+      json_builder_add_double_value (builder, ops / elapsed_seconds (start));
+    }
+
+  json_builder_end_object (builder);
+}
+
+/* The portal loads the store when it is activated, so this must be
+ * called before the first call to it.
+ */
+static void
+copy_store (const char *dir)
+{
+  g_autoptr(GFile) src = NULL;
+  g_autoptr(GFile) dest = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *src_path = NULL;
+  g_autofree char *dest_dir = NULL;
+  g_autofree char *dest_path = NULL;
+
+  src_path = g_build_filename (dir, "flatpak", "db", "documents", NULL);
+  dest_dir = g_build_filename (env->outdir, "flatpak", "db", NULL);
+  dest_path = g_build_filename (dest_dir, "documents", NULL);
+
+  if (g_mkdir_with_parents (dest_dir, 0700) != 0)
+    g_error ("Can't create %s: %s", dest_dir, g_strerror (errno));
+
+  src = g_file_new_for_path (src_path);
+  dest = g_file_new_for_path (dest_path);
+  if (!g_file_copy (src, dest, G_FILE_COPY_NONE, NULL, NULL, NULL, &error))
+    g_error ("Can't copy %s: %s", src_path, error->message);
+}
+
+static void
+create_test_files (char **file_path_out,
+                   char **dir_path_out)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree char *file_path = NULL;
+  g_autofree char *dir_path = NULL;
+
+  file_path = g_build_filename (env->outdir, "bench-file", NULL);
+  g_file_set_contents (file_path, "", 0, &error);
+  g_assert_no_error (error);
+
+  dir_path = g_build_filename (env->outdir, "bench-dir", NULL);
+  if (g_mkdir (dir_path, 0700) != 0)
+    g_error ("Can't create %s: %s", dir_path, g_strerror (errno));
+
+  for (int i = 0; i < opt_dir_entries; i++)
+    {
+      g_autofree char *name = g_strdup_printf ("file-%d", i);
+      g_autofree char *path = g_build_filename (dir_path, name, NULL);
+
+      g_file_set_contents (path, "", 0, &error);
+      g_assert_no_error (error);
+    }
+
+  *file_path_out = g_steal_pointer (&file_path);
+  *dir_path_out = g_steal_pointer (&dir_path);
+}
+
+static void
+global_setup (void)
+{
+  g_autoptr(GError) error = NULL;
+
+  env = bench_env_new ();
+
+  if (opt_db)
+    copy_store (opt_db);
+
+  documents = xdp_dbus_documents_proxy_new_sync (env->bus, 0,
+                                                 "org.freedesktop.portal.Documents",
+                                                 "/org/freedesktop/portal/documents",
+                                                 NULL, &error);
+  g_assert_no_error (error);
+
+  xdp_dbus_documents_call_get_mount_point_sync (documents, &mountpoint, NULL, &error);
+  g_assert_no_error (error);
+}
+
+static void
+global_teardown (void)
+{
+  char *argv[] = { "fusermount3", "-u", NULL, NULL };
+  g_autoptr(GError) error = NULL;
+
+  argv[2] = mountpoint;
+  g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH,
+                NULL, NULL, NULL, NULL, NULL, &error);
+  if (error)
+    g_warning ("Failed to unmount %s: %s", mountpoint, error->message);
+
+  g_clear_object (&documents);
+  bench_env_free (env);
+
+  g_free (mountpoint);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(JsonBuilder) builder = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *file_path = NULL;
+  g_autofree char *dir_path = NULL;
+  g_autofree char *file_doc = NULL;
+  g_autofree char *dir_doc = NULL;
+  g_autofree char *app_file = NULL;
+  g_autofree char *app_dir = NULL;
+  g_autofree char *app_dir_file = NULL;
+
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  context = g_option_context_new ("- benchmark the document portal fuse filesystem");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (!check_fuse ())
+    {
+      g_printerr ("Can't use fuse: %s\n", cannot_use_fuse);
+      return 77;
+    }
+
+  global_setup ();
+
+  create_test_files (&file_path, &dir_path);
+
+  file_doc = export_path (file_path, 0);
+  dir_doc = export_path (dir_path, DOCUMENT_ADD_FLAGS_DIRECTORY);
+
+  app_file = make_app_path (file_doc, "bench-file");
+  app_dir = make_app_path (dir_doc, "bench-dir");
+  app_dir_file = g_build_filename (app_dir, "file-0", NULL);
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+
+  bench_stat (builder, app_file);
+  bench_lookup (builder, file_doc);
+  bench_setattr (builder, app_file);
+  bench_reexport (builder, app_dir_file);
+  bench_sequential (builder, app_file);
+  bench_random (builder, app_file);
+  bench_readdir (builder, app_dir);
+  bench_parallel_stat (builder, app_dir);
+
+  if (opt_db)
+    bench_store (builder);
+
+  json_builder_end_object (builder);
+
+  bench_print_json (builder);
+
+  global_teardown ();
+
+  return 0;
+}
@@ -0,0 +1,411 @@
+/*
+ * Benchmark for PermissionDb.
+ *
+ * This generates synthetic databases of increasing size, with entries
+ * that look like document portal entries and a skewed distribution of
+ * apps per entry, and times the main PermissionDb operations on them.
+ * Listing all entries, as the document portal's List method does,
+ * is timed both by looking up every id and with a PermissionDbIter.
+ * With --db, the lookups and queries are run on a store written by
+ * gen-doc-store instead. The results are printed as JSON on stdout.
+ */
+
+#include "config.h"
+
+#include <locale.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+#include <document-portal/permission-db.h>
+
+#include "utils.h"
+
+static int opt_max_entries = 1000000;
+static int opt_apps = 500;
+static int opt_lookups = 100000;
+static int opt_queries = 20;
+static char *opt_db = NULL;
+
+static GOptionEntry entries[] = {
+  { "max-entries", 0, 0, G_OPTION_ARG_INT, &opt_max_entries, "Largest database to generate", "N" },
+  { "apps", 0, 0, G_OPTION_ARG_INT, &opt_apps, "Number of distinct apps", "N" },
+  { "lookups", 0, 0, G_OPTION_ARG_INT, &opt_lookups, "Number of lookups per database", "N" },
+  { "queries", 0, 0, G_OPTION_ARG_INT, &opt_queries, "Number of list queries per database", "N" },
+  { "db", 0, 0, G_OPTION_ARG_FILENAME, &opt_db, "Use the store generated by gen-doc-store in DIR", "DIR" },
+  { NULL }
+};
+
+static const char *permissions_rw[] = { "read", "write", NULL };
+static const char *permissions_r[] = { "read", NULL };
+
+static char **app_ids;
+
+static double
+elapsed_ms (gint64 start)
+{
+  return (g_get_monotonic_time () - start) / 1000.0;
+}
+
+/* Resets the peak RSS of the process, so that each database size is
+ * measured separately. Only works on Linux, otherwise the peak is
+ * cumulative.
+ */
+static void
+reset_peak_rss (void)
+{
+  g_file_set_contents ("/proc/self/clear_refs", "5", -1, NULL);
+}
+
+static gint64
+get_peak_rss_kb (void)
+{
+  g_autofree char *status = NULL;
+  const char *line;
+
+  if (!g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+    return -1;
+
+  line = strstr (status, "VmHWM:");
+  if (line == NULL)
+    return -1;
+
+  return g_ascii_strtoll (line + strlen ("VmHWM:"), NULL, 10);
+}
+
+static GVariant *
+make_data (guint i)
+{
+  g_autofree char *path = g_strdup_printf ("/home/user/Documents/dir%u/file%u.txt", i % 1000, i);
+
+  return g_variant_new ("(^ayttu)", path, (guint64) 64769, (guint64) i + 1000, 0);
+}
+
+static void
+populate_db (PermissionDb *db,
+             int           n_entries,
+             GRand        *rand)
+{
+  for (int i = 0; i < n_entries; i++)
+    {
+      g_autoptr(PermissionDbEntry) entry = NULL;
+      g_autofree char *id = bench_make_id (i);
+      int n_apps = 1 + g_rand_int_range (rand, 0, 3);
+
+      entry = permission_db_entry_new (make_data (i));
+
+      for (int j = 0; j < n_apps; j++)
+        {
+          PermissionDbEntry *new_entry;
+
+          new_entry = permission_db_entry_set_app_permissions (entry, bench_pick_app (rand, app_ids, opt_apps),
+                                                              j == 0 ? permissions_rw : permissions_r);
+          permission_db_entry_unref (entry);
+          entry = new_entry;
+        }
+
+      permission_db_set_entry (db, id, entry);
+    }
+}
+
+/* Times the read side on a loaded database */
+static void
+bench_queries (JsonBuilder  *builder,
+               PermissionDb *db,
+               GRand        *rand,
+               const char   *popular_app,
+               const char   *rare_app)
+{
+  g_auto(GStrv) all_ids = permission_db_list_ids (db);
+  guint n_entries = g_strv_length (all_ids);
+  gint64 start;
+  guint64 n_found;
+
+  if (n_entries == 0)
+    return;
+
+  n_found = 0;
+  start = g_get_monotonic_time ();
+  for (int i = 0; i < opt_lookups; i++)
+    {
+      const char *id = all_ids[g_rand_int_range (rand, 0, n_entries)];
+      g_autoptr(PermissionDbEntry) entry = permission_db_lookup (db, id);
+
+      if (entry)
+        n_found++;
+    }
+  g_assert_cmpuint (n_found, ==, opt_lookups);
+  json_builder_set_member_name (builder, "lookup_ns");
+  json_builder_add_double_value (builder, elapsed_ms (start) * 1000000.0 / opt_lookups);
+
+  /* The most popular and the least popular app */
+  for (int k = 0; k < 2; k++)
+    {
+      const char *app = k == 0 ? popular_app : rare_app;
+
+      start = g_get_monotonic_time ();
+      for (int i = 0; i < opt_queries; i++)
+        {
+          g_auto(GStrv) ids = permission_db_list_ids_by_app (db, app);
+        }
+      json_builder_set_member_name (builder, k == 0 ? "list_ids_by_popular_app_ms" : "list_ids_by_rare_app_ms");
+      json_builder_add_double_value (builder, elapsed_ms (start) / opt_queries);
+    }
+
+  start = g_get_monotonic_time ();
+  for (int i = 0; i < opt_queries; i++)
+    {
+      const char *id = all_ids[g_rand_int_range (rand, 0, n_entries)];
+      g_autoptr(PermissionDbEntry) entry = permission_db_lookup (db, id);
+      g_autoptr(GVariant) data = permission_db_entry_get_data (entry);
+      g_auto(GStrv) ids = permission_db_list_ids_by_value (db, data);
+
+      g_assert (ids[0] != NULL);
+    }
+  json_builder_set_member_name (builder, "list_ids_by_value_ms");
+  json_builder_add_double_value (builder, elapsed_ms (start) / opt_queries);
+
+  /* List every entry with its path, the old way and with an iterator */
+  start = g_get_monotonic_time ();
+  for (int i = 0; i < opt_queries; i++)
+    {
+      g_auto(GStrv) ids = permission_db_list_ids (db);
+
+      n_found = 0;
+      for (int j = 0; ids[j] != NULL; j++)
+        {
+          g_autoptr(PermissionDbEntry) entry = permission_db_lookup (db, ids[j]);
+          g_autoptr(GVariant) data = permission_db_entry_get_data (entry);
+          const char *entry_path;
+
+          g_variant_get (data, "(^&ayttu)", &entry_path, NULL, NULL, NULL);
+          n_found++;
+        }
+      g_assert_cmpuint (n_found, ==, n_entries);
+    }
+  json_builder_set_member_name (builder, "list_all_by_lookup_ms");
+  json_builder_add_double_value (builder, elapsed_ms (start) / opt_queries);
+
+  start = g_get_monotonic_time ();
+  for (int i = 0; i < opt_queries; i++)
+    {
+      g_auto(PermissionDbIter) iter = { 0, };
+      PermissionDbEntry *entry;
+
+      n_found = 0;
+      permission_db_iter_init (&iter, db, NULL);
+      while (permission_db_iter_next (&iter, NULL, &entry))
+        {
+          g_autoptr(GVariant) data = permission_db_entry_get_data (entry);
+          const char *entry_path;
+
+          g_variant_get (data, "(^&ayttu)", &entry_path, NULL, NULL, NULL);
+          n_found++;
+        }
+      g_assert_cmpuint (n_found, ==, n_entries);
+    }
+  json_builder_set_member_name (builder, "list_all_by_iter_ms");
+  json_builder_add_double_value (builder, elapsed_ms (start) / opt_queries);
+}
+
+static void
+bench_size (JsonBuilder *builder,
+            const char  *dir,
+            int          n_entries)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (n_entries);
+  g_autoptr(PermissionDb) db = NULL;
+  g_autoptr(PermissionDb) loaded = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *filename = NULL;
+  gint64 start;
+  GStatBuf buf;
+
+  reset_peak_rss ();
+
+  filename = g_strdup_printf ("bench-%d", n_entries);
+  path = g_build_filename (dir, filename, NULL);
+
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "entries");
+  json_builder_add_int_value (builder, n_entries);
+
+  db = permission_db_new (path, FALSE, &error);
+  g_assert_no_error (error);
+
+  start = g_get_monotonic_time ();
+  populate_db (db, n_entries, rand);
+  json_builder_set_member_name (builder, "set_entry_ms");
+  json_builder_add_double_value (builder, elapsed_ms (start));
+
+  start = g_get_monotonic_time ();
+  permission_db_update (db);
+  json_builder_set_member_name (builder, "update_ms");
+  json_builder_add_double_value (builder, elapsed_ms (start));
+
+  start = g_get_monotonic_time ();
+  permission_db_save_content (db, &error);
+  g_assert_no_error (error);
+  json_builder_set_member_name (builder, "save_content_ms");
+  json_builder_add_double_value (builder, elapsed_ms (start));
+
+  if (g_stat (path, &buf) == 0)
+    {
+      json_builder_set_member_name (builder, "file_size");
+      json_builder_add_int_value (builder, buf.st_size);
+    }
+
+  start = g_get_monotonic_time ();
+  loaded = permission_db_new (path, TRUE, &error);
+  g_assert_no_error (error);
+  json_builder_set_member_name (builder, "load_ms");
+  json_builder_add_double_value (builder, elapsed_ms (start));
+
+  bench_queries (builder, loaded, rand, app_ids[0], app_ids[opt_apps - 1]);
+
+  json_builder_set_member_name (builder, "peak_rss_kb");
+  json_builder_add_int_value (builder, get_peak_rss_kb ());
+
+  json_builder_end_object (builder);
+
+  g_unlink (path);
+}
+
+/* Runs the read side on a documents database written by gen-doc-store */
+static gboolean
+bench_store (JsonBuilder  *builder,
+             const char   *dir,
+             GError      **error)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (1);
+  g_autoptr(PermissionDb) loaded = NULL;
+  g_autoptr(GHashTable) app_counts = NULL;
+  g_auto(PermissionDbIter) iter = { 0, };
+  g_autofree char *path = NULL;
+  g_auto(GStrv) ids = NULL;
+  PermissionDbEntry *entry;
+  GHashTableIter apps_iter;
+  const char *popular_app = NULL;
+  const char *rare_app = NULL;
+  gpointer app, count;
+  gint64 start;
+  GStatBuf buf;
+
+  reset_peak_rss ();
+
+  path = g_build_filename (dir, "flatpak", "db", "documents", NULL);
+
+  start = g_get_monotonic_time ();
+  loaded = permission_db_new (path, TRUE, error);
+  if (loaded == NULL)
+    return FALSE;
+
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "load_ms");
+  json_builder_add_double_value (builder, elapsed_ms (start));
+
+  ids = permission_db_list_ids (loaded);
+  json_builder_set_member_name (builder, "entries");
+  json_builder_add_int_value (builder, g_strv_length (ids));
+
+  if (g_stat (path, &buf) == 0)
+    {
+      json_builder_set_member_name (builder, "file_size");
+      json_builder_add_int_value (builder, buf.st_size);
+    }
+
+  app_counts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  permission_db_iter_init (&iter, loaded, NULL);
+  while (permission_db_iter_next (&iter, NULL, &entry))
+    {
+      g_autofree const char **apps = permission_db_entry_list_apps (entry);
+
+      for (int i = 0; apps[i] != NULL; i++)
+        {
+          count = g_hash_table_lookup (app_counts, apps[i]);
+          g_hash_table_insert (app_counts, g_strdup (apps[i]),
+                               GUINT_TO_POINTER (GPOINTER_TO_UINT (count) + 1));
+        }
+    }
+
+  g_hash_table_iter_init (&apps_iter, app_counts);
+  while (g_hash_table_iter_next (&apps_iter, &app, &count))
+    {
+      if (popular_app == NULL ||
+          GPOINTER_TO_UINT (count) > GPOINTER_TO_UINT (g_hash_table_lookup (app_counts, popular_app)))
+        popular_app = app;
+      if (rare_app == NULL ||
+          GPOINTER_TO_UINT (count) < GPOINTER_TO_UINT (g_hash_table_lookup (app_counts, rare_app)))
+        rare_app = app;
+    }
+
+  if (popular_app != NULL)
+    bench_queries (builder, loaded, rand, popular_app, rare_app);
+
+  json_builder_set_member_name (builder, "peak_rss_kb");
+  json_builder_add_int_value (builder, get_peak_rss_kb ());
+
+  json_builder_end_object (builder);
+
+  return TRUE;
+}
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(JsonBuilder) builder = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *dir = NULL;
+
+  setlocale (LC_ALL, "");
+
+  context = g_option_context_new ("- benchmark the permission database");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (opt_apps < 1 || opt_max_entries < 1 || opt_lookups < 1 || opt_queries < 1)
+    {
+      g_printerr ("Invalid arguments\n");
+      return 1;
+    }
+
+  builder = json_builder_new ();
+  json_builder_begin_array (builder);
+
+  if (opt_db)
+    {
+      if (!bench_store (builder, opt_db, &error))
+        {
+          g_printerr ("%s\n", error->message);
+          return 1;
+        }
+    }
+  else
+    {
+      dir = g_dir_make_tmp ("xdp-bench-db-XXXXXX", &error);
+      g_assert_no_error (error);
+
+      app_ids = bench_make_app_ids (opt_apps);
+
+      for (int n_entries = 1000; n_entries <= opt_max_entries; n_entries *= 10)
+        bench_size (builder, dir, n_entries);
+
+      g_rmdir (dir);
+      g_strfreev (app_ids);
+    }
+
+  json_builder_end_array (builder);
+
+  bench_print_json (builder);
+
+  return 0;
+}
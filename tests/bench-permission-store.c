@@ -0,0 +1,369 @@
+/*
+ * Write amplification benchmark for the permission store.
+ *
+ * This starts the permission store on a private session bus and replays
+ * a sequence of SetPermission calls against it, either read from a file
+ * or generated. Each line of a replay file has the form
+ *
+ *   TABLE ID APP PERMISSION,PERMISSION...
+ *
+ * and lines starting with '#' are ignored. The store is run with metrics
+ * enabled, and the logical size of the changes is compared with the
+ * bytes it wrote out. The results are printed as JSON on stdout.
+ */
+
+#include "config.h"
+
+#include <locale.h>
+#include <string.h>
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "utils.h"
+
+#define STORE_BUS_NAME "org.freedesktop.impl.portal.PermissionStore"
+#define STORE_OBJECT_PATH "/org/freedesktop/impl/portal/PermissionStore"
+#define STORE_INTERFACE "org.freedesktop.impl.portal.PermissionStore"
+
+static char *opt_replay = NULL;
+static int opt_calls = 10000;
+static int opt_ids = 1000;
+static int opt_prefill = 0;
+static int opt_window = 1;
+
+static GOptionEntry entries[] = {
+  { "replay", 0, 0, G_OPTION_ARG_FILENAME, &opt_replay, "Replay the calls in FILE", "FILE" },
+  { "calls", 0, 0, G_OPTION_ARG_INT, &opt_calls, "Number of generated calls", "N" },
+  { "ids", 0, 0, G_OPTION_ARG_INT, &opt_ids, "Number of distinct generated ids", "N" },
+  { "prefill", 0, 0, G_OPTION_ARG_INT, &opt_prefill, "Entries to create before measuring", "N" },
+  { "window", 0, 0, G_OPTION_ARG_INT, &opt_window, "Number of calls in flight", "N" },
+  { NULL }
+};
+
+typedef struct {
+  char *table;
+  char *id;
+  char *app;
+  char **permissions;
+} Call;
+
+static void
+call_clear (Call *call)
+{
+  g_free (call->table);
+  g_free (call->id);
+  g_free (call->app);
+  g_strfreev (call->permissions);
+}
+
+static GArray *
+load_replay (const char  *path,
+             GError     **error)
+{
+  g_autoptr(GArray) calls = g_array_new (FALSE, TRUE, sizeof (Call));
+  g_autofree char *contents = NULL;
+  g_auto(GStrv) lines = NULL;
+
+  g_array_set_clear_func (calls, (GDestroyNotify) call_clear);
+
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    return NULL;
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (int i = 0; lines[i]; i++)
+    {
+      g_auto(GStrv) fields = NULL;
+      Call call;
+
+      g_strstrip (lines[i]);
+      if (lines[i][0] == 0 || lines[i][0] == '#')
+        continue;
+
+      fields = g_strsplit_set (lines[i], " \t", -1);
+      if (g_strv_length (fields) != 4)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Invalid line %d in %s", i + 1, path);
+          return NULL;
+        }
+
+      call.table = g_strdup (fields[0]);
+      call.id = g_strdup (fields[1]);
+      call.app = g_strdup (fields[2]);
+      call.permissions = g_strsplit (fields[3], ",", -1);
+      g_array_append_val (calls, call);
+    }
+
+  return g_steal_pointer (&calls);
+}
+
+/* Mostly updates to a small set of ids, like the document portal
+ * granting and revoking access to recently used files.
+ */
+static GArray *
+generate_calls (int n_calls,
+                int first_id)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (n_calls);
+  GArray *calls = g_array_new (FALSE, TRUE, sizeof (Call));
+
+  g_array_set_clear_func (calls, (GDestroyNotify) call_clear);
+
+  for (int i = 0; i < n_calls; i++)
+    {
+      double r = g_rand_double (rand);
+      Call call;
+
+      call.table = g_strdup ("documents");
+      call.id = g_strdup_printf ("%08x", first_id + (int) (r * r * opt_ids));
+      call.app = g_strdup_printf ("org.test.App%d", g_rand_int_range (rand, 0, 20));
+      call.permissions = g_strsplit (g_rand_boolean (rand) ? "read,write" : "read", ",", -1);
+      g_array_append_val (calls, call);
+    }
+
+  return calls;
+}
+
+typedef struct {
+  GDBusConnection *bus;
+  GArray *calls;
+  guint next;
+  guint n_pending;
+  guint64 n_errors;
+} Replay;
+
+static void start_call (Replay *replay);
+
+static void
+call_done (GObject      *source,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+  Replay *replay = user_data;
+  g_autoptr(GVariant) ret = NULL;
+  g_autoptr(GError) error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (ret == NULL)
+    replay->n_errors++;
+
+  replay->n_pending--;
+  start_call (replay);
+}
+
+static void
+start_call (Replay *replay)
+{
+  Call *call;
+
+  if (replay->next >= replay->calls->len)
+    return;
+
+  call = &g_array_index (replay->calls, Call, replay->next++);
+  replay->n_pending++;
+
+  g_dbus_connection_call (replay->bus,
+                          STORE_BUS_NAME,
+                          STORE_OBJECT_PATH,
+                          STORE_INTERFACE,
+                          "SetPermission",
+                          g_variant_new ("(sbss^as)",
+                                         call->table, TRUE,
+                                         call->id, call->app,
+                                         call->permissions),
+                          NULL,
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          call_done,
+                          replay);
+}
+
+static guint64
+replay_calls (GDBusConnection *bus,
+              GArray          *calls)
+{
+  Replay replay = { bus, calls, 0, 0, 0 };
+
+  for (int i = 0; i < opt_window; i++)
+    start_call (&replay);
+
+  while (replay.n_pending > 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  return replay.n_errors;
+}
+
+static GVariant *
+get_counters (GDBusConnection *bus)
+{
+  g_autoptr(GVariant) ret = NULL;
+  g_autoptr(GError) error = NULL;
+
+  ret = g_dbus_connection_call_sync (bus,
+                                     STORE_BUS_NAME,
+                                     STORE_OBJECT_PATH,
+                                     "org.freedesktop.portal.Debug.Metrics",
+                                     "GetMetrics",
+                                     NULL,
+                                     G_VARIANT_TYPE ("(a{st}a{s(ttat)}at)"),
+                                     G_DBUS_CALL_FLAGS_NONE,
+                                     -1,
+                                     NULL,
+                                     &error);
+  g_assert_no_error (error);
+
+  return g_variant_get_child_value (ret, 0);
+}
+
+static guint64
+counter_delta (GVariant   *before,
+               GVariant   *after,
+               const char *table,
+               const char *counter)
+{
+  g_autofree char *name = g_strdup_printf ("tables/%s/%s", table, counter);
+  guint64 a = 0;
+  guint64 b = 0;
+
+  g_variant_lookup (before, name, "t", &b);
+  g_variant_lookup (after, name, "t", &a);
+
+  return a - b;
+}
+
+static void
+add_table_results (JsonBuilder *builder,
+                   GVariant    *before,
+                   GVariant    *after,
+                   const char  *table)
+{
+  guint64 change_bytes = counter_delta (before, after, table, "change-bytes");
+  guint64 bytes_written = counter_delta (before, after, table, "bytes-written");
+
+  json_builder_set_member_name (builder, table);
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "changes");
+  json_builder_add_int_value (builder, counter_delta (before, after, table, "writes"));
+  json_builder_set_member_name (builder, "change_bytes");
+  json_builder_add_int_value (builder, change_bytes);
+  json_builder_set_member_name (builder, "writeouts");
+  json_builder_add_int_value (builder, counter_delta (before, after, table, "writeouts"));
+  json_builder_set_member_name (builder, "fsyncs");
+  json_builder_add_int_value (builder, counter_delta (before, after, table, "fsyncs"));
+  json_builder_set_member_name (builder, "bytes_written");
+  json_builder_add_int_value (builder, bytes_written);
+  json_builder_set_member_name (builder, "write_amplification");
+  json_builder_add_double_value (builder, change_bytes > 0 ? (double) bytes_written / change_bytes : 0.0);
+  json_builder_end_object (builder);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(JsonBuilder) builder = NULL;
+  g_autoptr(GHashTable) tables = NULL;
+  g_autoptr(GArray) calls = NULL;
+  g_autoptr(GVariant) before = NULL;
+  g_autoptr(GVariant) after = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *store = NULL;
+  BenchEnv *env;
+  GDBusConnection *bus;
+  GHashTableIter iter;
+  const char *table;
+  guint64 n_errors;
+  gint64 start;
+  double seconds;
+
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  context = g_option_context_new ("- replay calls against the permission store");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (opt_calls < 1 || opt_ids < 1 || opt_prefill < 0 || opt_window < 1)
+    {
+      g_printerr ("Invalid arguments\n");
+      return 1;
+    }
+
+  if (opt_replay)
+    {
+      calls = load_replay (opt_replay, &error);
+      if (calls == NULL)
+        {
+          g_printerr ("%s\n", error->message);
+          return 1;
+        }
+    }
+  else
+    calls = generate_calls (opt_calls, opt_prefill);
+
+  env = bench_env_new ();
+  bus = env->bus;
+
+  store = g_test_build_filename (G_TEST_BUILT, "..", "xdg-permission-store", NULL);
+  bench_env_launch (env, STORE_BUS_NAME, store, "--replace", "--metrics", NULL);
+
+  /* The size of the database is what drives the amplification */
+  if (opt_prefill > 0)
+    {
+      g_autoptr(GArray) prefill = generate_calls (opt_prefill, 0);
+
+      /* One entry per id */
+      for (guint i = 0; i < prefill->len; i++)
+        {
+          Call *call = &g_array_index (prefill, Call, i);
+
+          g_free (call->id);
+          call->id = g_strdup_printf ("%08x", i);
+        }
+
+      replay_calls (bus, prefill);
+    }
+
+  before = get_counters (bus);
+
+  start = g_get_monotonic_time ();
+  n_errors = replay_calls (bus, calls);
+  seconds = (g_get_monotonic_time () - start) / (double) G_USEC_PER_SEC;
+
+  after = get_counters (bus);
+
+  tables = g_hash_table_new (g_str_hash, g_str_equal);
+  for (guint i = 0; i < calls->len; i++)
+    g_hash_table_add (tables, g_array_index (calls, Call, i).table);
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "calls");
+  json_builder_add_int_value (builder, calls->len);
+  json_builder_set_member_name (builder, "errors");
+  json_builder_add_int_value (builder, n_errors);
+  json_builder_set_member_name (builder, "window");
+  json_builder_add_int_value (builder, opt_window);
+  json_builder_set_member_name (builder, "calls_per_sec");
+  json_builder_add_double_value (builder, calls->len / seconds);
+  json_builder_set_member_name (builder, "tables");
+  json_builder_begin_object (builder);
+  g_hash_table_iter_init (&iter, tables);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &table, NULL))
+    add_table_results (builder, before, after, table);
+  json_builder_end_object (builder);
+  json_builder_end_object (builder);
+
+  bench_print_json (builder);
+
+  bench_env_free (env);
+
+  return 0;
+}
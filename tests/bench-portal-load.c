@@ -0,0 +1,489 @@
+/*
+ * Load generator for xdg-desktop-portal.
+ *
+ * This starts xdg-desktop-portal, the permission store and the test
+ * backends on a private session bus, and then drives a number of
+ * concurrent clients against the frontend. Each client has its own bus
+ * connection and keeps one call in flight at a time, picking calls
+ * from a configurable mix. For every number of clients, the latency
+ * percentiles per call and the total throughput are printed as JSON.
+ */
+
+#include "config.h"
+
+#include <locale.h>
+#include <string.h>
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "utils.h"
+
+#define PORTAL_BUS_NAME "org.freedesktop.portal.Desktop"
+#define PORTAL_OBJECT_PATH "/org/freedesktop/portal/desktop"
+#define BACKEND_BUS_NAME "org.freedesktop.impl.portal.Test"
+
+static BenchEnv *env;
+
+static int opt_clients = 64;
+static int opt_duration = 5;
+static char *opt_mix = NULL;
+
+static GOptionEntry entries[] = {
+  { "clients", 0, 0, G_OPTION_ARG_INT, &opt_clients, "Maximum number of concurrent clients", "N" },
+  { "duration", 0, 0, G_OPTION_ARG_INT, &opt_duration, "Seconds to run each client count", "SECONDS" },
+  { "mix", 0, 0, G_OPTION_ARG_STRING, &opt_mix, "Weighted mix of calls, e.g. screenshot=1,settings=4", "MIX" },
+  { NULL }
+};
+
+typedef enum {
+  CALL_SCREENSHOT,
+  CALL_PICK_COLOR,
+  CALL_OPEN_FILE,
+  CALL_SETTINGS,
+  N_CALLS
+} CallType;
+
+static const struct {
+  const char *name;
+  const char *interface;
+  const char *method;
+  gboolean is_request;
+} calls[N_CALLS] = {
+  { "screenshot", "org.freedesktop.portal.Screenshot", "Screenshot", TRUE },
+  { "pick-color", "org.freedesktop.portal.Screenshot", "PickColor", TRUE },
+  { "open-file", "org.freedesktop.portal.FileChooser", "OpenFile", TRUE },
+  { "settings", "org.freedesktop.portal.Settings", "ReadAll", FALSE },
+};
+
+static guint weights[N_CALLS] = { 1, 1, 1, 1 };
+static guint total_weight = 4;
+
+typedef struct {
+  GDBusConnection *connection;
+  char *sender;
+  GRand *rand;
+  guint counter;
+  CallType type;
+  gint64 start;
+  guint signal_id;
+} Client;
+
+static GArray *latencies[N_CALLS];
+static guint64 n_errors;
+static gint64 run_until;
+static guint n_running;
+
+static void start_call (Client *client);
+
+static gboolean
+parse_mix (const char  *mix,
+           GError     **error)
+{
+  g_auto(GStrv) parts = g_strsplit (mix, ",", -1);
+
+  memset (weights, 0, sizeof (weights));
+  total_weight = 0;
+
+  for (int i = 0; parts[i]; i++)
+    {
+      g_auto(GStrv) kv = g_strsplit (parts[i], "=", 2);
+      guint64 weight = 1;
+      int j;
+
+      if (kv[1] != NULL &&
+          !g_ascii_string_to_unsigned (kv[1], 10, 0, 1000, &weight, error))
+        return FALSE;
+
+      for (j = 0; j < N_CALLS; j++)
+        {
+          if (strcmp (calls[j].name, kv[0]) == 0)
+            break;
+        }
+
+      if (j == N_CALLS)
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "Unknown call %s", kv[0]);
+          return FALSE;
+        }
+
+      weights[j] = weight;
+      total_weight += weight;
+    }
+
+  if (total_weight == 0)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "Empty call mix");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static CallType
+pick_call (Client *client)
+{
+  guint r = g_rand_int_range (client->rand, 0, total_weight);
+
+  for (int i = 0; i < N_CALLS; i++)
+    {
+      if (r < weights[i])
+        return i;
+      r -= weights[i];
+    }
+
+  g_assert_not_reached ();
+}
+
+static void
+finish_call (Client   *client,
+             gboolean  success)
+{
+  double ms = (g_get_monotonic_time () - client->start) / 1000.0;
+
+  if (success)
+    g_array_append_val (latencies[client->type], ms);
+  else
+    n_errors++;
+
+  if (g_get_monotonic_time () < run_until)
+    start_call (client);
+  else
+    {
+      n_running--;
+      g_main_context_wakeup (NULL);
+    }
+}
+
+static void
+response_received (GDBusConnection *connection,
+                   const char      *sender_name,
+                   const char      *object_path,
+                   const char      *interface_name,
+                   const char      *signal_name,
+                   GVariant        *parameters,
+                   gpointer         user_data)
+{
+  Client *client = user_data;
+  guint32 response;
+
+  g_variant_get (parameters, "(u@a{sv})", &response, NULL);
+
+  g_dbus_connection_signal_unsubscribe (client->connection, client->signal_id);
+  client->signal_id = 0;
+
+  finish_call (client, response == 0 || client->type == CALL_OPEN_FILE);
+}
+
+static void
+call_done (GObject      *source,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+  Client *client = user_data;
+  g_autoptr(GVariant) ret = NULL;
+  g_autoptr(GError) error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (ret == NULL)
+    {
+      g_printerr ("%s failed: %s\n", calls[client->type].name, error->message);
+      if (client->signal_id)
+        {
+          g_dbus_connection_signal_unsubscribe (client->connection, client->signal_id);
+          client->signal_id = 0;
+        }
+      finish_call (client, FALSE);
+      return;
+    }
+
+  /* Requests finish when the Response signal arrives */
+  if (!calls[client->type].is_request)
+    finish_call (client, TRUE);
+}
+
+static void
+start_call (Client *client)
+{
+  g_autofree char *token = NULL;
+  g_autofree char *handle = NULL;
+  GVariantBuilder options;
+  GVariant *parameters;
+
+  client->type = pick_call (client);
+  client->start = g_get_monotonic_time ();
+
+  if (calls[client->type].is_request)
+    {
+      token = g_strdup_printf ("bench%u", client->counter++);
+      handle = g_strdup_printf ("/org/freedesktop/portal/desktop/request/%s/%s",
+                                client->sender, token);
+
+      /* Subscribe before calling, so we can't miss the response */
+      client->signal_id =
+        g_dbus_connection_signal_subscribe (client->connection,
+                                            NULL,
+                                            "org.freedesktop.portal.Request",
+                                            "Response",
+                                            handle,
+                                            NULL,
+                                            G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE,
+                                            response_received,
+                                            client, NULL);
+
+      g_variant_builder_init (&options, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add (&options, "{sv}", "handle_token", g_variant_new_string (token));
+
+      if (client->type == CALL_OPEN_FILE)
+        parameters = g_variant_new ("(ssa{sv})", "", "Open", &options);
+      else
+        parameters = g_variant_new ("(sa{sv})", "", &options);
+    }
+  else
+    {
+      const char *namespaces[] = { "", NULL };
+
+      parameters = g_variant_new ("(^as)", namespaces);
+    }
+
+  g_dbus_connection_call (client->connection,
+                          PORTAL_BUS_NAME,
+                          PORTAL_OBJECT_PATH,
+                          calls[client->type].interface,
+                          calls[client->type].method,
+                          parameters,
+                          NULL,
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          call_done,
+                          client);
+}
+
+static Client *
+client_new (guint seed)
+{
+  g_autoptr(GError) error = NULL;
+  Client *client;
+  char *p;
+
+  client = g_new0 (Client, 1);
+  client->rand = g_rand_new_with_seed (seed);
+  client->connection =
+    g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (env->dbus),
+                                            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                            G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                            NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  /* Match any Response signal, and filter by path locally */
+  g_dbus_connection_call_sync (client->connection,
+                               "org.freedesktop.DBus",
+                               "/org/freedesktop/DBus",
+                               "org.freedesktop.DBus",
+                               "AddMatch",
+                               g_variant_new ("(s)", "type='signal',interface='org.freedesktop.portal.Request',member='Response'"),
+                               NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+  g_assert_no_error (error);
+
+  client->sender = g_strdup (g_dbus_connection_get_unique_name (client->connection) + 1);
+  for (p = client->sender; *p; p++)
+    {
+      if (*p == '.')
+        *p = '_';
+    }
+
+  return client;
+}
+
+static void
+client_free (Client *client)
+{
+  g_dbus_connection_close_sync (client->connection, NULL, NULL);
+  g_object_unref (client->connection);
+  g_rand_free (client->rand);
+  g_free (client->sender);
+  g_free (client);
+}
+
+static int
+compare_double (gconstpointer a,
+                gconstpointer b)
+{
+  double da = *(const double *) a;
+  double db = *(const double *) b;
+
+  return (da > db) - (da < db);
+}
+
+static double
+percentile (GArray *array,
+            double  p)
+{
+  guint index;
+
+  if (array->len == 0)
+    return 0;
+
+  index = (guint) (p * (array->len - 1) + 0.5);
+  return g_array_index (array, double, index);
+}
+
+static void
+run_level (JsonBuilder *builder,
+           GPtrArray   *clients,
+           guint        n_clients)
+{
+  guint64 total = 0;
+  gint64 start;
+  double elapsed;
+
+  while (clients->len < n_clients)
+    g_ptr_array_add (clients, client_new (clients->len));
+
+  for (int i = 0; i < N_CALLS; i++)
+    g_array_set_size (latencies[i], 0);
+  n_errors = 0;
+
+  start = g_get_monotonic_time ();
+  run_until = start + opt_duration * G_USEC_PER_SEC;
+  n_running = n_clients;
+
+  for (guint i = 0; i < n_clients; i++)
+    start_call (g_ptr_array_index (clients, i));
+
+  while (n_running > 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  elapsed = (g_get_monotonic_time () - start) / (double) G_USEC_PER_SEC;
+
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "clients");
+  json_builder_add_int_value (builder, n_clients);
+
+  json_builder_set_member_name (builder, "calls");
+  json_builder_begin_object (builder);
+  for (int i = 0; i < N_CALLS; i++)
+    {
+      GArray *array = latencies[i];
+
+      if (weights[i] == 0)
+        continue;
+
+      g_array_sort (array, compare_double);
+      total += array->len;
+
+      json_builder_set_member_name (builder, calls[i].name);
+      json_builder_begin_object (builder);
+      json_builder_set_member_name (builder, "count");
+      json_builder_add_int_value (builder, array->len);
+      json_builder_set_member_name (builder, "p50_ms");
+      json_builder_add_double_value (builder, percentile (array, 0.5));
+      json_builder_set_member_name (builder, "p99_ms");
+      json_builder_add_double_value (builder, percentile (array, 0.99));
+      json_builder_set_member_name (builder, "p999_ms");
+      json_builder_add_double_value (builder, percentile (array, 0.999));
+      json_builder_end_object (builder);
+    }
+  json_builder_end_object (builder);
+
+  json_builder_set_member_name (builder, "errors");
+  json_builder_add_int_value (builder, n_errors);
+  json_builder_set_member_name (builder, "calls_per_sec");
+  json_builder_add_double_value (builder, total / elapsed);
+  json_builder_end_object (builder);
+}
+
+static void
+write_backend_config (const char *name,
+                      const char *uri,
+                      int         response)
+{
+  g_autoptr(GKeyFile) keyfile = g_key_file_new ();
+  g_autoptr(GError) error = NULL;
+  g_autofree char *path = NULL;
+  const char *uris[] = { uri, NULL };
+
+  g_key_file_set_integer (keyfile, "backend", "delay", 0);
+  g_key_file_set_integer (keyfile, "backend", "response", response);
+  g_key_file_set_string (keyfile, "result", "uri", uri);
+  g_key_file_set_string_list (keyfile, "result", "uris", uris, 1);
+  g_key_file_set_double (keyfile, "result", "red", 0.5);
+  g_key_file_set_double (keyfile, "result", "green", 0.5);
+  g_key_file_set_double (keyfile, "result", "blue", 0.5);
+
+  path = g_build_filename (env->outdir, name, NULL);
+  g_key_file_save_to_file (keyfile, path, &error);
+  g_assert_no_error (error);
+}
+
+static void
+global_setup (void)
+{
+  g_autofree char *backends = NULL;
+  g_autofree char *portal = NULL;
+  g_autofree char *store = NULL;
+
+  env = bench_env_new ();
+
+  /* The file chooser is cancelled, so no documents are created */
+  write_backend_config ("screenshot", "file:///test/image", 0);
+  write_backend_config ("filechooser", "file:///test/file", 1);
+
+  backends = g_test_build_filename (G_TEST_BUILT, "test-backends", NULL);
+  portal = g_test_build_filename (G_TEST_BUILT, "..", "xdg-desktop-portal", NULL);
+  store = g_test_build_filename (G_TEST_BUILT, "..", "xdg-permission-store", NULL);
+
+  bench_env_launch (env, BACKEND_BUS_NAME, backends, NULL);
+  bench_env_launch (env, PORTAL_BUS_NAME, portal, NULL);
+  bench_env_launch (env, "org.freedesktop.impl.portal.PermissionStore", store, "--replace", NULL);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(JsonBuilder) builder = NULL;
+  g_autoptr(GPtrArray) clients = NULL;
+  g_autoptr(GError) error = NULL;
+
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  context = g_option_context_new ("- generate load on xdg-desktop-portal");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error) ||
+      (opt_mix && !parse_mix (opt_mix, &error)))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  for (int i = 0; i < N_CALLS; i++)
+    latencies[i] = g_array_new (FALSE, FALSE, sizeof (double));
+
+  global_setup ();
+
+  clients = g_ptr_array_new_with_free_func ((GDestroyNotify) client_free);
+
+  builder = json_builder_new ();
+  json_builder_begin_array (builder);
+
+  for (int n_clients = 1; n_clients <= opt_clients; n_clients *= 2)
+    run_level (builder, clients, n_clients);
+
+  json_builder_end_array (builder);
+
+  bench_print_json (builder);
+
+  g_clear_pointer (&clients, g_ptr_array_unref);
+  bench_env_free (env);
+
+  for (int i = 0; i < N_CALLS; i++)
+    g_array_unref (latencies[i]);
+
+  return 0;
+}
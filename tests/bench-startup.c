@@ -0,0 +1,295 @@
+/*
+ * Startup benchmark for xdg-desktop-portal, the document portal and
+ * the permission store.
+ *
+ * Each daemon is started repeatedly on a private session bus with
+ * --profile-startup. For every run, the time until its name appears
+ * on the bus and until the first request is answered is measured, and
+ * the timeline it prints on stderr is collected. Times are relative to
+ * spawning the daemon, and the medians are printed as JSON.
+ */
+
+#include "config.h"
+
+#include <locale.h>
+#include <signal.h>
+#include <string.h>
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "utils.h"
+
+static BenchEnv *env;
+
+static int opt_iterations = 10;
+static char *opt_daemon = NULL;
+
+static GOptionEntry entries[] = {
+  { "iterations", 0, 0, G_OPTION_ARG_INT, &opt_iterations, "Number of times to start each daemon", "N" },
+  { "daemon", 0, 0, G_OPTION_ARG_STRING, &opt_daemon, "Only start this daemon", "NAME" },
+  { NULL }
+};
+
+typedef struct {
+  const char *name;
+  const char *executable;
+  const char *bus_name;
+  const char *object_path;
+  const char *interface;
+  const char *method;
+  const char *parameters;
+} Daemon;
+
+static const Daemon daemons[] = {
+  {
+    "xdg-desktop-portal", "xdg-desktop-portal",
+    "org.freedesktop.portal.Desktop",
+    "/org/freedesktop/portal/desktop",
+    "org.freedesktop.portal.Settings", "ReadAll", "(@as [])"
+  },
+  {
+    "document-portal", "xdg-document-portal",
+    "org.freedesktop.portal.Documents",
+    "/org/freedesktop/portal/documents",
+    "org.freedesktop.portal.Documents", "GetMountPoint", "()"
+  },
+  {
+    "permission-store", "xdg-permission-store",
+    "org.freedesktop.impl.portal.PermissionStore",
+    "/org/freedesktop/impl/portal/PermissionStore",
+    "org.freedesktop.impl.portal.PermissionStore", "List", "('bench',)"
+  },
+};
+
+static int
+compare_double (gconstpointer a,
+                gconstpointer b)
+{
+  double da = *(const double *) a;
+  double db = *(const double *) b;
+
+  return (da > db) - (da < db);
+}
+
+static double
+median (GArray *array)
+{
+  if (array->len == 0)
+    return 0;
+
+  g_array_sort (array, compare_double);
+  return g_array_index (array, double, array->len / 2);
+}
+
+static char *
+get_name_owner (GDBusConnection *bus,
+                const char      *name)
+{
+  g_autoptr(GVariant) ret = NULL;
+  char *owner = NULL;
+
+  ret = g_dbus_connection_call_sync (bus,
+                                     "org.freedesktop.DBus",
+                                     "/org/freedesktop/DBus",
+                                     "org.freedesktop.DBus",
+                                     "GetNameOwner",
+                                     g_variant_new ("(s)", name),
+                                     G_VARIANT_TYPE ("(s)"),
+                                     G_DBUS_CALL_FLAGS_NONE,
+                                     -1,
+                                     NULL,
+                                     NULL);
+  if (ret)
+    g_variant_get (ret, "(s)", &owner);
+
+  return owner;
+}
+
+/* Adds the phases of the timeline line in the daemon's stderr */
+static void
+collect_timeline (const char *output,
+                  gint64      start,
+                  GHashTable *phases,
+                  GPtrArray  *phase_names)
+{
+  g_auto(GStrv) lines = g_strsplit (output, "\n", -1);
+
+  for (int i = 0; lines[i]; i++)
+    {
+      g_autoptr(JsonParser) parser = NULL;
+      JsonArray *timeline;
+
+      if (!g_str_has_prefix (lines[i], "{\"pid\""))
+        continue;
+
+      parser = json_parser_new ();
+      if (!json_parser_load_from_data (parser, lines[i], -1, NULL))
+        continue;
+
+      timeline = json_object_get_array_member (json_node_get_object (json_parser_get_root (parser)),
+                                               "timeline");
+      for (guint j = 0; j < json_array_get_length (timeline); j++)
+        {
+          JsonObject *mark = json_array_get_object_element (timeline, j);
+          const char *phase = json_object_get_string_member (mark, "phase");
+          double ms = (json_object_get_int_member (mark, "time") - start) / 1000.0;
+          GArray *times = g_hash_table_lookup (phases, phase);
+
+          if (times == NULL)
+            {
+              times = g_array_new (FALSE, FALSE, sizeof (double));
+              g_ptr_array_add (phase_names, g_strdup (phase));
+              g_hash_table_insert (phases, g_strdup (phase), times);
+            }
+
+          g_array_append_val (times, ms);
+        }
+    }
+}
+
+static void
+bench_daemon (JsonBuilder     *builder,
+              GDBusConnection *bus,
+              const Daemon    *daemon)
+{
+  g_autoptr(GArray) name_times = g_array_new (FALSE, FALSE, sizeof (double));
+  g_autoptr(GArray) reply_times = g_array_new (FALSE, FALSE, sizeof (double));
+  g_autoptr(GHashTable) phases = NULL;
+  g_autoptr(GPtrArray) phase_names = g_ptr_array_new_with_free_func (g_free);
+  g_autofree char *path = g_test_build_filename (G_TEST_BUILT, "..", daemon->executable, NULL);
+  guint n_failed = 0;
+
+  phases = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_array_unref);
+
+  for (int i = 0; i < opt_iterations; i++)
+    {
+      g_autoptr(GSubprocess) subprocess = NULL;
+      g_autoptr(GVariant) ret = NULL;
+      g_autoptr(GError) error = NULL;
+      g_autofree char *output = NULL;
+      g_autofree char *old_owner = NULL;
+      double ms;
+      gint64 start;
+
+      old_owner = get_name_owner (bus, daemon->bus_name);
+
+      start = g_get_monotonic_time ();
+      subprocess = bench_env_spawn (env, G_SUBPROCESS_FLAGS_STDERR_PIPE, &error,
+                                    path, "--replace", "--profile-startup", NULL);
+      g_assert_no_error (error);
+
+      if (!bench_wait_for_name (bus, daemon->bus_name, old_owner))
+        {
+          g_printerr ("%s did not appear on the bus\n", daemon->name);
+          g_subprocess_force_exit (subprocess);
+          g_subprocess_wait (subprocess, NULL, NULL);
+          n_failed++;
+          continue;
+        }
+
+      ms = (g_get_monotonic_time () - start) / 1000.0;
+      g_array_append_val (name_times, ms);
+
+      ret = g_dbus_connection_call_sync (bus,
+                                         daemon->bus_name,
+                                         daemon->object_path,
+                                         daemon->interface,
+                                         daemon->method,
+                                         g_variant_new_parsed (daemon->parameters),
+                                         NULL,
+                                         G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                         10000,
+                                         NULL,
+                                         &error);
+      if (ret != NULL)
+        {
+          ms = (g_get_monotonic_time () - start) / 1000.0;
+          g_array_append_val (reply_times, ms);
+        }
+      else
+        {
+          g_printerr ("%s.%s failed: %s\n", daemon->interface, daemon->method, error->message);
+          n_failed++;
+        }
+
+      g_subprocess_send_signal (subprocess, SIGTERM);
+      g_subprocess_communicate_utf8 (subprocess, NULL, NULL, NULL, &output, NULL);
+
+      if (output)
+        collect_timeline (output, start, phases, phase_names);
+    }
+
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "daemon");
+  json_builder_add_string_value (builder, daemon->name);
+  json_builder_set_member_name (builder, "iterations");
+  json_builder_add_int_value (builder, opt_iterations);
+  json_builder_set_member_name (builder, "failed");
+  json_builder_add_int_value (builder, n_failed);
+  json_builder_set_member_name (builder, "name_acquired_ms");
+  json_builder_add_double_value (builder, median (name_times));
+  json_builder_set_member_name (builder, "first_reply_ms");
+  json_builder_add_double_value (builder, median (reply_times));
+  json_builder_set_member_name (builder, "phases_ms");
+  json_builder_begin_object (builder);
+  for (guint i = 0; i < phase_names->len; i++)
+    {
+      const char *phase = g_ptr_array_index (phase_names, i);
+
+      json_builder_set_member_name (builder, phase);
+      json_builder_add_double_value (builder, median (g_hash_table_lookup (phases, phase)));
+    }
+  json_builder_end_object (builder);
+  json_builder_end_object (builder);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(JsonBuilder) builder = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *backends = NULL;
+
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  context = g_option_context_new ("- measure daemon startup");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (opt_iterations < 1)
+    {
+      g_printerr ("Invalid arguments\n");
+      return 1;
+    }
+
+  env = bench_env_new ();
+
+  /* The frontend needs backends to export its portals */
+  backends = g_test_build_filename (G_TEST_BUILT, "test-backends", NULL);
+  bench_env_launch (env, "org.freedesktop.impl.portal.Test", backends, NULL);
+
+  builder = json_builder_new ();
+  json_builder_begin_array (builder);
+
+  for (gsize i = 0; i < G_N_ELEMENTS (daemons); i++)
+    {
+      if (opt_daemon == NULL || strcmp (opt_daemon, daemons[i].name) == 0)
+        bench_daemon (builder, env->bus, &daemons[i]);
+    }
+
+  json_builder_end_array (builder);
+
+  bench_print_json (builder);
+
+  bench_env_free (env);
+
+  return 0;
+}
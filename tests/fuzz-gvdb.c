@@ -0,0 +1,364 @@
+/*
+ * Fuzzing and benchmark harness for the gvdb reader.
+ *
+ * LLVMFuzzerTestOneInput() loads the input as an untrusted gvdb file
+ * and walks it the way PermissionDb does. When built with
+ * XDP_LIBFUZZER, libFuzzer drives it. Otherwise main() builds large
+ * tables laid out like a PermissionDb, times lookups and name
+ * enumeration on them, and then feeds randomly corrupted copies, plus
+ * any files given on the command line, to the fuzz target.
+ */
+
+#include "config.h"
+
+#include <locale.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+#include "document-portal/gvdb/gvdb-builder.h"
+#include "document-portal/gvdb/gvdb-reader.h"
+
+#include "utils.h"
+
+int LLVMFuzzerTestOneInput (const uint8_t *data,
+                            size_t         size);
+
+static void
+walk_table (GvdbTable *table,
+            int        depth)
+{
+  g_auto(GStrv) names = NULL;
+  gint n_names;
+
+  names = gvdb_table_get_names (table, &n_names);
+
+  for (gint i = 0; i < n_names; i++)
+    {
+      g_autoptr(GVariant) value = NULL;
+      g_autoptr(GVariant) raw_value = NULL;
+      g_auto(GStrv) list = NULL;
+
+      if (names[i] == NULL)
+        continue;
+
+      gvdb_table_has_value (table, names[i]);
+      value = gvdb_table_get_value (table, names[i]);
+      raw_value = gvdb_table_get_raw_value (table, names[i]);
+      list = gvdb_table_list (table, names[i]);
+
+      /* What PermissionDb does with the values */
+      if (value && g_variant_is_normal_form (value))
+        g_variant_get_size (value);
+
+      if (depth < 2)
+        {
+          GvdbTable *subtable = gvdb_table_get_table (table, names[i]);
+
+          if (subtable)
+            {
+              walk_table (subtable, depth + 1);
+              gvdb_table_free (subtable);
+            }
+        }
+    }
+
+  /* Lookups of keys that aren't there */
+  gvdb_table_has_value (table, "");
+  gvdb_table_has_value (table, "missing");
+}
+
+int
+LLVMFuzzerTestOneInput (const uint8_t *data,
+                        size_t         size)
+{
+  g_autoptr(GBytes) bytes = g_bytes_new (data, size);
+  GvdbTable *table;
+
+  table = gvdb_table_new_from_bytes (bytes, FALSE, NULL);
+  if (table == NULL)
+    return 0;
+
+  gvdb_table_is_valid (table);
+  walk_table (table, 0);
+  gvdb_table_free (table);
+
+  return 0;
+}
+
+#ifndef XDP_LIBFUZZER
+
+static int opt_max_entries = 1000000;
+static int opt_apps = 500;
+static int opt_lookups = 1000000;
+static int opt_mutations = 10000;
+
+static GOptionEntry entries[] = {
+  { "max-entries", 0, 0, G_OPTION_ARG_INT, &opt_max_entries, "Largest table to generate", "N" },
+  { "apps", 0, 0, G_OPTION_ARG_INT, &opt_apps, "Number of distinct apps", "N" },
+  { "lookups", 0, 0, G_OPTION_ARG_INT, &opt_lookups, "Number of lookups per table", "N" },
+  { "mutations", 0, 0, G_OPTION_ARG_INT, &opt_mutations, "Number of corrupted inputs to try", "N" },
+  { NULL }
+};
+
+/* The same layout as a PermissionDb: a "main" table of entries and
+ * an "apps" table listing the ids each app has permissions for.
+ */
+static GBytes *
+build_table (int n_entries)
+{
+  g_autoptr(GHashTable) root = gvdb_hash_table_new (NULL, NULL);
+  g_autoptr(GPtrArray) app_ids = g_ptr_array_new_with_free_func ((GDestroyNotify) g_ptr_array_unref);
+  GHashTable *main_h = gvdb_hash_table_new (root, "main");
+  GHashTable *apps_h = gvdb_hash_table_new (root, "apps");
+
+  for (int i = 0; i < opt_apps; i++)
+    g_ptr_array_add (app_ids, g_ptr_array_new_with_free_func (g_free));
+
+  for (int i = 0; i < n_entries; i++)
+    {
+      g_autofree char *id = bench_make_id (i);
+      g_autofree char *path = g_strdup_printf ("/home/user/Documents/dir%d/file%d.txt", i % 1000, i);
+      const char *permissions[] = { "read", "write", NULL };
+      int app = (i * 7) % opt_apps;
+      g_autofree char *app_id = g_strdup_printf ("org.test.App%d", app);
+      GVariantBuilder builder;
+      GvdbItem *item;
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sas}"));
+      g_variant_builder_add (&builder, "{s^as}", app_id, permissions);
+
+      item = gvdb_hash_table_insert (main_h, id);
+      gvdb_item_set_value (item, g_variant_new ("(v@a{sas})",
+                                                g_variant_new ("(^ayttu)", path, (guint64) 64769, (guint64) i, 0),
+                                                g_variant_builder_end (&builder)));
+
+      g_ptr_array_add (g_ptr_array_index (app_ids, app), g_steal_pointer (&id));
+    }
+
+  for (int i = 0; i < opt_apps; i++)
+    {
+      GPtrArray *ids = g_ptr_array_index (app_ids, i);
+      g_autofree char *app_id = g_strdup_printf ("org.test.App%d", i);
+      GvdbItem *item;
+
+      item = gvdb_hash_table_insert (apps_h, app_id);
+      gvdb_item_set_value (item, g_variant_new_strv ((const char * const *) ids->pdata, ids->len));
+    }
+
+  return gvdb_table_get_content (root, FALSE);
+}
+
+static double
+elapsed_ns_per_op (gint64 start,
+                   int    n_ops)
+{
+  return (g_get_monotonic_time () - start) * 1000.0 / n_ops;
+}
+
+static void
+bench_size (JsonBuilder *builder,
+            int          n_entries)
+{
+  g_autoptr(GBytes) bytes = build_table (n_entries);
+  g_autoptr(GRand) rand = g_rand_new_with_seed (n_entries);
+  g_autoptr(GError) error = NULL;
+  GvdbTable *table;
+  GvdbTable *main_table;
+  GvdbTable *apps_table;
+  guint n_found = 0;
+  gint64 start;
+  int n_rounds;
+
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "entries");
+  json_builder_add_int_value (builder, n_entries);
+  json_builder_set_member_name (builder, "file_size");
+  json_builder_add_int_value (builder, g_bytes_get_size (bytes));
+
+  /* PermissionDb loads its own file as trusted */
+  table = gvdb_table_new_from_bytes (bytes, TRUE, &error);
+  g_assert_no_error (error);
+
+  start = g_get_monotonic_time ();
+  for (int i = 0; i < opt_lookups; i++)
+    {
+      main_table = gvdb_table_get_table (table, "main");
+      gvdb_table_free (main_table);
+    }
+  json_builder_set_member_name (builder, "get_table_ns");
+  json_builder_add_double_value (builder, elapsed_ns_per_op (start, opt_lookups));
+
+  main_table = gvdb_table_get_table (table, "main");
+  apps_table = gvdb_table_get_table (table, "apps");
+
+  start = g_get_monotonic_time ();
+  for (int i = 0; i < opt_lookups; i++)
+    {
+      g_autofree char *id = bench_make_id (g_rand_int_range (rand, 0, n_entries));
+      g_autoptr(GVariant) value = gvdb_table_get_value (main_table, id);
+
+      if (value)
+        n_found++;
+    }
+  g_assert_cmpuint (n_found, ==, opt_lookups);
+  json_builder_set_member_name (builder, "get_value_hit_ns");
+  json_builder_add_double_value (builder, elapsed_ns_per_op (start, opt_lookups));
+
+  start = g_get_monotonic_time ();
+  for (int i = 0; i < opt_lookups; i++)
+    {
+      g_autofree char *id = bench_make_id (n_entries + g_rand_int_range (rand, 0, n_entries));
+      g_autoptr(GVariant) value = gvdb_table_get_value (main_table, id);
+
+      g_assert (value == NULL);
+    }
+  json_builder_set_member_name (builder, "get_value_miss_ns");
+  json_builder_add_double_value (builder, elapsed_ns_per_op (start, opt_lookups));
+
+  start = g_get_monotonic_time ();
+  for (int i = 0; i < opt_lookups; i++)
+    {
+      g_autofree char *app_id = g_strdup_printf ("org.test.App%d", g_rand_int_range (rand, 0, opt_apps));
+      g_autoptr(GVariant) value = gvdb_table_get_value (apps_table, app_id);
+
+      g_assert (value != NULL);
+    }
+  json_builder_set_member_name (builder, "get_app_ids_ns");
+  json_builder_add_double_value (builder, elapsed_ns_per_op (start, opt_lookups));
+
+  /* Enough rounds to take a measurable time on small tables */
+  n_rounds = MAX (1, 1000000 / n_entries);
+  start = g_get_monotonic_time ();
+  for (int i = 0; i < n_rounds; i++)
+    {
+      g_auto(GStrv) names = NULL;
+      gint n_names;
+
+      names = gvdb_table_get_names (main_table, &n_names);
+      g_assert_cmpint (n_names, ==, n_entries);
+    }
+  json_builder_set_member_name (builder, "get_names_per_sec");
+  json_builder_add_double_value (builder,
+                                 (double) n_entries * n_rounds * G_USEC_PER_SEC /
+                                 MAX (1, g_get_monotonic_time () - start));
+
+  gvdb_table_free (apps_table);
+  gvdb_table_free (main_table);
+  gvdb_table_free (table);
+
+  json_builder_end_object (builder);
+}
+
+/* Bit flips, overwritten words and truncation */
+static void
+fuzz_mutations (JsonBuilder *builder)
+{
+  g_autoptr(GBytes) bytes = build_table (100);
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0);
+  gsize size;
+  const guint8 *orig = g_bytes_get_data (bytes, &size);
+  gint64 start = g_get_monotonic_time ();
+
+  for (int i = 0; i < opt_mutations; i++)
+    {
+      g_autofree guint8 *data = g_memdup (orig, size);
+      gsize len = size;
+      int n_changes = g_rand_int_range (rand, 1, 8);
+
+      for (int j = 0; j < n_changes; j++)
+        {
+          gsize offset = g_rand_int_range (rand, 0, len);
+
+          switch (g_rand_int_range (rand, 0, 3))
+            {
+            case 0:
+              data[offset] ^= 1 << g_rand_int_range (rand, 0, 8);
+              break;
+            case 1:
+              if (offset + 4 <= len)
+                {
+                  guint32 word = g_rand_boolean (rand) ? G_MAXUINT32 : g_rand_int (rand);
+                  memcpy (data + offset, &word, 4);
+                }
+              break;
+            default:
+              len = offset;
+              break;
+            }
+
+          if (len == 0)
+            break;
+        }
+
+      LLVMFuzzerTestOneInput (data, len);
+    }
+
+  json_builder_set_member_name (builder, "mutations");
+  json_builder_add_int_value (builder, opt_mutations);
+  json_builder_set_member_name (builder, "mutations_per_sec");
+  json_builder_add_double_value (builder,
+                                 (double) opt_mutations * G_USEC_PER_SEC /
+                                 MAX (1, g_get_monotonic_time () - start));
+}
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(JsonBuilder) builder = NULL;
+  g_autoptr(GError) error = NULL;
+
+  setlocale (LC_ALL, "");
+
+  context = g_option_context_new ("[FILE…] - benchmark and fuzz the gvdb reader");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (opt_apps < 1 || opt_max_entries < 1 || opt_lookups < 1 || opt_mutations < 0)
+    {
+      g_printerr ("Invalid arguments\n");
+      return 1;
+    }
+
+  /* Replay inputs, e.g. a corpus or crashers from libFuzzer */
+  for (int i = 1; i < argc; i++)
+    {
+      g_autofree char *contents = NULL;
+      gsize length;
+
+      if (!g_file_get_contents (argv[i], &contents, &length, &error))
+        {
+          g_printerr ("%s\n", error->message);
+          return 1;
+        }
+
+      LLVMFuzzerTestOneInput ((const uint8_t *) contents, length);
+    }
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "sizes");
+  json_builder_begin_array (builder);
+
+  for (int n_entries = 1000; n_entries <= opt_max_entries; n_entries *= 10)
+    bench_size (builder, n_entries);
+
+  json_builder_end_array (builder);
+
+  fuzz_mutations (builder);
+
+  json_builder_end_object (builder);
+
+  bench_print_json (builder);
+
+  return 0;
+}
+
+#endif /* !XDP_LIBFUZZER */
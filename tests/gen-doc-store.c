@@ -0,0 +1,266 @@
+/*
+ * Generator for large synthetic document stores.
+ *
+ * This writes a documents database in the format used by the document
+ * portal, along with the files and directories it refers to:
+ *
+ *   OUTPUT/flatpak/db/documents
+ *   OUTPUT/files/dirN/fileN
+ *   OUTPUT/files/dirN/folderN/
+ *
+ * so running the document portal with XDG_DATA_HOME=OUTPUT exposes all
+ * the documents. The number of documents, the number of apps and how
+ * many of them each document is shared with, and the fraction of
+ * directory and transient documents can be chosen. The same seed
+ * always generates the same store. bench-doc-fuse and
+ * bench-permission-db take the output directory with --db.
+ */
+
+#include "config.h"
+
+#include <locale.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <document-portal/permission-db.h>
+#include <document-portal/document-store.h>
+
+#include "utils.h"
+
+static char *opt_output = NULL;
+static int opt_documents = 100000;
+static int opt_apps = 500;
+static int opt_max_apps_per_doc = 3;
+static int opt_docs_per_dir = 1000;
+static double opt_directories = 0.1;
+static double opt_transient = 0.0;
+static int opt_seed = 1;
+
+static GOptionEntry entries[] = {
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output, "Directory to create the store in", "DIR" },
+  { "documents", 0, 0, G_OPTION_ARG_INT, &opt_documents, "Number of documents", "N" },
+  { "apps", 0, 0, G_OPTION_ARG_INT, &opt_apps, "Number of distinct apps", "N" },
+  { "max-apps-per-doc", 0, 0, G_OPTION_ARG_INT, &opt_max_apps_per_doc, "Maximum number of apps per document", "N" },
+  { "docs-per-dir", 0, 0, G_OPTION_ARG_INT, &opt_docs_per_dir, "Number of documents per backing directory", "N" },
+  { "directories", 0, 0, G_OPTION_ARG_DOUBLE, &opt_directories, "Fraction of directory documents", "FRACTION" },
+  { "transient", 0, 0, G_OPTION_ARG_DOUBLE, &opt_transient, "Fraction of transient documents", "FRACTION" },
+  { "seed", 0, 0, G_OPTION_ARG_INT, &opt_seed, "Random seed", "N" },
+  { NULL }
+};
+
+static const char *permissions_owner[] = { "read", "write", "grant-permissions", "delete", NULL };
+static const char *permissions_rw[] = { "read", "write", NULL };
+static const char *permissions_r[] = { "read", NULL };
+
+static char **app_ids;
+
+static char *
+new_doc_id (GRand      *rand,
+            GHashTable *used)
+{
+  while (TRUE)
+    {
+      g_autofree char *id = g_strdup_printf ("%x", g_rand_int (rand));
+
+      if (!g_hash_table_contains (used, id))
+        {
+          g_hash_table_add (used, g_strdup (id));
+          return g_steal_pointer (&id);
+        }
+    }
+}
+
+/* Creates the backing file or directory and returns the entry data,
+ * which holds the device and inode of the directory for directory
+ * documents, and of the parent directory for file documents.
+ */
+static GVariant *
+create_backing (const char  *files_dir,
+                int          i,
+                gboolean     directory,
+                guint32      flags,
+                GError     **error)
+{
+  g_autofree char *dir_name = g_strdup_printf ("dir%d", i / opt_docs_per_dir);
+  g_autofree char *dir = g_build_filename (files_dir, dir_name, NULL);
+  g_autofree char *name = g_strdup_printf (directory ? "folder%d" : "file%d.txt", i);
+  g_autofree char *path = g_build_filename (dir, name, NULL);
+  struct stat st;
+
+  if (g_mkdir_with_parents (dir, 0755) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Can't create %s: %s", dir, g_strerror (errno));
+      return NULL;
+    }
+
+  if (directory)
+    {
+      if (g_mkdir (path, 0755) != 0 && errno != EEXIST)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Can't create %s: %s", path, g_strerror (errno));
+          return NULL;
+        }
+    }
+  else
+    {
+      int fd = open (path, O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+
+      if (fd < 0)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Can't create %s: %s", path, g_strerror (errno));
+          return NULL;
+        }
+      close (fd);
+    }
+
+  if (g_stat (directory ? path : dir, &st) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Can't stat %s: %s", path, g_strerror (errno));
+      return NULL;
+    }
+
+  return g_variant_new ("(^ayttu)",
+                        path,
+                        (guint64) st.st_dev,
+                        (guint64) st.st_ino,
+                        flags);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GRand) rand = NULL;
+  g_autoptr(GHashTable) used_ids = NULL;
+  g_autoptr(PermissionDb) db = NULL;
+  g_autofree char *db_dir = NULL;
+  g_autofree char *db_path = NULL;
+  g_autofree char *files_dir = NULL;
+  int n_directories = 0;
+  int n_transient = 0;
+  guint64 n_grants = 0;
+
+  setlocale (LC_ALL, "");
+
+  context = g_option_context_new ("- generate a document store");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (opt_output == NULL)
+    {
+      g_printerr ("No output directory given\n");
+      return 1;
+    }
+
+  if (opt_documents < 0 || opt_apps < 1 || opt_max_apps_per_doc < 1 ||
+      opt_docs_per_dir < 1 ||
+      opt_directories < 0 || opt_directories > 1 ||
+      opt_transient < 0 || opt_transient > 1)
+    {
+      g_printerr ("Invalid arguments\n");
+      return 1;
+    }
+
+  db_dir = g_build_filename (opt_output, "flatpak", "db", NULL);
+  db_path = g_build_filename (db_dir, "documents", NULL);
+  files_dir = g_build_filename (opt_output, "files", NULL);
+
+  if (g_mkdir_with_parents (db_dir, 0755) != 0)
+    {
+      g_printerr ("Can't create %s: %s\n", db_dir, g_strerror (errno));
+      return 1;
+    }
+
+  /* Start from scratch, so the store has exactly the requested contents */
+  g_unlink (db_path);
+
+  db = permission_db_new (db_path, FALSE, &error);
+  if (db == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  app_ids = bench_make_app_ids (opt_apps);
+
+  rand = g_rand_new_with_seed (opt_seed);
+  used_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (int i = 0; i < opt_documents; i++)
+    {
+      g_autoptr(PermissionDbEntry) entry = NULL;
+      g_autofree char *id = NULL;
+      gboolean directory = g_rand_double (rand) < opt_directories;
+      gboolean transient = g_rand_double (rand) < opt_transient;
+      int n_apps = g_rand_int_range (rand, 1, opt_max_apps_per_doc + 1);
+      guint32 flags = 0;
+      GVariant *data;
+
+      if (directory)
+        {
+          flags |= DOCUMENT_ENTRY_FLAG_DIRECTORY;
+          n_directories++;
+        }
+      if (transient)
+        {
+          flags |= DOCUMENT_ENTRY_FLAG_TRANSIENT;
+          n_transient++;
+        }
+
+      data = create_backing (files_dir, i, directory, flags, &error);
+      if (data == NULL)
+        {
+          g_printerr ("%s\n", error->message);
+          return 1;
+        }
+
+      id = new_doc_id (rand, used_ids);
+      entry = permission_db_entry_new (data);
+
+      for (int j = 0; j < n_apps; j++)
+        {
+          PermissionDbEntry *new_entry;
+          const char **permissions;
+
+          if (j == 0)
+            permissions = permissions_owner;
+          else
+            permissions = g_rand_boolean (rand) ? permissions_rw : permissions_r;
+
+          new_entry = permission_db_entry_set_app_permissions (entry, bench_pick_app (rand, app_ids, opt_apps), permissions);
+          permission_db_entry_unref (entry);
+          entry = new_entry;
+        }
+
+      n_grants += n_apps;
+      permission_db_set_entry (db, id, entry);
+    }
+
+  permission_db_update (db);
+  if (!permission_db_save_content (db, &error))
+    {
+      g_printerr ("Can't save %s: %s\n", db_path, error->message);
+      return 1;
+    }
+
+  g_print ("Wrote %d documents (%d directories, %d transient) with %" G_GUINT64_FORMAT " grants to %s\n",
+           opt_documents, n_directories, n_transient, n_grants, db_path);
+
+  g_strfreev (app_ids);
+
+  return 0;
+}
@@ -402,3 +402,60 @@ test_inhibit_monitor (void)
   while (got_info < 1)
     g_main_context_iteration (NULL, TRUE);
 }
+
+static void
+session_state_record_cb (XdpPortal *portal,
+                         gboolean screensaver_active,
+                         XdpLoginSessionState state,
+                         gpointer data)
+{
+  GArray *states = data;
+
+  g_array_append_val (states, state);
+  got_info += 1;
+}
+
+/* A query-end directly followed by running must not be coalesced away */
+void
+test_inhibit_monitor_query_end_burst (void)
+{
+  g_autoptr(XdpPortal) portal = NULL;
+  g_autoptr(GKeyFile) keyfile = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GArray) states = NULL;
+  g_autofree char *path = NULL;
+
+  if (g_getenv ("TEST_IN_CI"))
+    {
+      g_test_skip ("Skip tests that are unreliable in CI");
+      return;
+    }
+
+  keyfile = g_key_file_new ();
+
+  g_key_file_set_integer (keyfile, "backend", "delay", 200);
+  g_key_file_set_string (keyfile, "backend", "change", "query-end-running");
+
+  path = g_build_filename (outdir, "inhibit", NULL);
+  g_key_file_save_to_file (keyfile, path, &error);
+  g_assert_no_error (error);
+
+  portal = xdp_portal_new ();
+  states = g_array_new (FALSE, FALSE, sizeof (XdpLoginSessionState));
+
+  g_signal_connect (portal, "session-state-changed", G_CALLBACK (session_state_record_cb), states);
+
+  got_info = 0;
+  xdp_portal_session_monitor_start (portal, NULL, 0, NULL, monitor_cb, NULL);
+
+  /* monitor_cb, the initial state, query-end and running */
+  while (got_info < 4)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (states->len, ==, 3);
+  g_assert_cmpint (g_array_index (states, XdpLoginSessionState, 0), ==, XDP_LOGIN_SESSION_RUNNING);
+  g_assert_cmpint (g_array_index (states, XdpLoginSessionState, 1), ==, XDP_LOGIN_SESSION_QUERY_END);
+  g_assert_cmpint (g_array_index (states, XdpLoginSessionState, 2), ==, XDP_LOGIN_SESSION_RUNNING);
+
+  xdp_portal_session_monitor_stop (portal);
+}
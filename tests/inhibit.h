@@ -8,3 +8,4 @@ void test_inhibit_parallel (void);
 void test_inhibit_permissions (void);
 
 void test_inhibit_monitor (void);
+void test_inhibit_monitor_query_end_burst (void);
@@ -3,6 +3,11 @@
 #include "screenshot.h"
 
 #include <libportal/portal.h>
+#include <gio/gunixfdlist.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 extern char outdir[];
 
@@ -212,6 +217,225 @@ test_screenshot_parallel (void)
     g_main_context_iteration (NULL, TRUE);
 }
 
+/* libportal doesn't know about return_fd, so the tests below talk
+ * to the portal directly and catch the Response message with a filter,
+ * as signal subscriptions don't give access to the fds. */
+
+typedef struct {
+  char *request_path;
+  GDBusMessage *response;
+} FdResponse;
+
+static GDBusMessage *
+response_filter (GDBusConnection *connection,
+                 GDBusMessage    *message,
+                 gboolean         incoming,
+                 gpointer         user_data)
+{
+  FdResponse *data = user_data;
+
+  if (incoming &&
+      g_dbus_message_get_message_type (message) == G_DBUS_MESSAGE_TYPE_SIGNAL &&
+      g_strcmp0 (g_dbus_message_get_member (message), "Response") == 0 &&
+      g_strcmp0 (g_dbus_message_get_path (message), data->request_path) == 0)
+    {
+      g_atomic_pointer_set (&data->response, g_object_ref (message));
+      g_main_context_wakeup (NULL);
+    }
+
+  return message;
+}
+
+/* Takes a screenshot with return_fd set, returning the response code
+ * and the fd, or -1 if none was returned */
+static guint
+take_screenshot_fd (const char *uri,
+                    int        *fd_out)
+{
+  g_autoptr(GDBusConnection) connection = NULL;
+  g_autoptr(GKeyFile) keyfile = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GVariant) results = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *sender = NULL;
+  FdResponse data = { NULL, NULL };
+  GVariantBuilder options;
+  GDBusMessage *response;
+  guint32 handle;
+  guint response_code;
+  guint filter_id;
+
+  keyfile = g_key_file_new ();
+  g_key_file_set_integer (keyfile, "backend", "delay", 0);
+  g_key_file_set_integer (keyfile, "backend", "response", 0);
+  g_key_file_set_string (keyfile, "result", "uri", uri);
+
+  path = g_build_filename (outdir, "screenshot", NULL);
+  g_key_file_save_to_file (keyfile, path, &error);
+  g_assert_no_error (error);
+
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  g_assert_no_error (error);
+
+  sender = g_strdup (g_dbus_connection_get_unique_name (connection) + 1);
+  g_strdelimit (sender, ".", '_');
+  data.request_path = g_strdup_printf ("/org/freedesktop/portal/desktop/request/%s/screenshot_fd", sender);
+
+  filter_id = g_dbus_connection_add_filter (connection, response_filter, &data, NULL);
+
+  g_variant_builder_init (&options, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&options, "{sv}", "handle_token", g_variant_new_string ("screenshot_fd"));
+  g_variant_builder_add (&options, "{sv}", "return_fd", g_variant_new_boolean (TRUE));
+
+  reply = g_dbus_connection_call_sync (connection,
+                                       "org.freedesktop.portal.Desktop",
+                                       "/org/freedesktop/portal/desktop",
+                                       "org.freedesktop.portal.Screenshot",
+                                       "Screenshot",
+                                       g_variant_new ("(sa{sv})", "", &options),
+                                       G_VARIANT_TYPE ("(o)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1, NULL, &error);
+  g_assert_no_error (error);
+
+  while ((response = g_atomic_pointer_get (&data.response)) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_dbus_connection_remove_filter (connection, filter_id);
+
+  g_variant_get (g_dbus_message_get_body (response), "(u@a{sv})", &response_code, &results);
+
+  *fd_out = -1;
+  if (g_variant_lookup (results, "fd", "h", &handle))
+    {
+      GUnixFDList *fd_list = g_dbus_message_get_unix_fd_list (response);
+
+      g_assert_nonnull (fd_list);
+      *fd_out = g_unix_fd_list_get (fd_list, handle, &error);
+      g_assert_no_error (error);
+    }
+
+  g_object_unref (response);
+  g_free (data.request_path);
+
+  return response_code;
+}
+
+void
+test_screenshot_fd (void)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree char *image = NULL;
+  g_autofree char *uri = NULL;
+  g_autofree char *proc_path = NULL;
+  struct stat fd_buf, image_buf;
+  char buf[64];
+  ssize_t len;
+  guint response;
+  int fd, rw_fd;
+
+  image = g_build_filename (outdir, "screenshot-image", NULL);
+  g_file_set_contents (image, "screenshot-data", -1, &error);
+  g_assert_no_error (error);
+  uri = g_filename_to_uri (image, NULL, &error);
+  g_assert_no_error (error);
+
+  response = take_screenshot_fd (uri, &fd);
+  g_assert_cmpuint (response, ==, 0);
+  g_assert_cmpint (fd, >=, 0);
+
+  len = read (fd, buf, sizeof (buf) - 1);
+  g_assert_cmpint (len, ==, strlen ("screenshot-data"));
+  buf[len] = 0;
+  g_assert_cmpstr (buf, ==, "screenshot-data");
+
+  /* Read-only */
+  g_assert_cmpint (write (fd, "x", 1), ==, -1);
+
+  /* A sealed copy, not the file itself */
+  g_assert_cmpint (fstat (fd, &fd_buf), ==, 0);
+  g_assert_cmpint (stat (image, &image_buf), ==, 0);
+  g_assert_false (fd_buf.st_dev == image_buf.st_dev && fd_buf.st_ino == image_buf.st_ino);
+  g_assert_cmpint (fcntl (fd, F_GET_SEALS) & F_SEAL_WRITE, !=, 0);
+
+  /* And it can't be reopened for writing either */
+  proc_path = g_strdup_printf ("/proc/self/fd/%d", fd);
+  rw_fd = open (proc_path, O_RDWR | O_CLOEXEC);
+  if (rw_fd >= 0)
+    {
+      g_assert_cmpint (write (rw_fd, "x", 1), ==, -1);
+      close (rw_fd);
+    }
+
+  close (fd);
+}
+
+/* The backend returns a file the portal can't open */
+void
+test_screenshot_fd_error (void)
+{
+  g_autofree char *image = NULL;
+  g_autofree char *uri = NULL;
+  guint response;
+  int fd;
+
+  image = g_build_filename (outdir, "screenshot-missing", NULL);
+  uri = g_filename_to_uri (image, NULL, NULL);
+
+  response = take_screenshot_fd (uri, &fd);
+  g_assert_cmpuint (response, ==, 2);
+  g_assert_cmpint (fd, ==, -1);
+}
+
+static guint64
+get_histogram_count (const char *name)
+{
+  g_autoptr(GDBusConnection) connection = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GVariant) histograms = NULL;
+  g_autoptr(GError) error = NULL;
+  guint64 count = 0;
+
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  g_assert_no_error (error);
+
+  reply = g_dbus_connection_call_sync (connection,
+                                       "org.freedesktop.portal.Desktop",
+                                       "/org/freedesktop/portal/desktop",
+                                       "org.freedesktop.portal.Debug.Metrics",
+                                       "GetMetrics",
+                                       NULL,
+                                       G_VARIANT_TYPE ("(a{st}a{s(ttat)}at)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1, NULL, &error);
+  g_assert_no_error (error);
+
+  histograms = g_variant_get_child_value (reply, 1);
+  g_variant_lookup (histograms, name, "(tt@at)", &count, NULL, NULL);
+
+  return count;
+}
+
+/* The backend is called through its unique name */
+void
+test_screenshot_metrics (void)
+{
+  const char *name = "call-latency/org.freedesktop.impl.portal.Test/org.freedesktop.impl.portal.Screenshot.Screenshot";
+  g_autofree char *image = NULL;
+  g_autofree char *uri = NULL;
+  guint64 before;
+  int fd;
+
+  before = get_histogram_count (name);
+
+  image = g_build_filename (outdir, "screenshot-missing", NULL);
+  uri = g_filename_to_uri (image, NULL, NULL);
+  take_screenshot_fd (uri, &fd);
+
+  g_assert_cmpuint (get_histogram_count (name), ==, before + 1);
+}
+
 /* Tests for PickColor below */
 
 static void
@@ -5,6 +5,9 @@ void test_screenshot_delay (void);
 void test_screenshot_cancel (void);
 void test_screenshot_close (void);
 void test_screenshot_parallel (void);
+void test_screenshot_fd (void);
+void test_screenshot_fd_error (void);
+void test_screenshot_metrics (void);
 
 void test_color_basic (void);
 void test_color_delay (void);
@@ -8,12 +8,15 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/xattr.h>
 
 #include <gio/gio.h>
 #include <gio/gunixfdlist.h>
 #include <glib/gstdio.h>
 
 #include "document-portal/document-portal-dbus.h"
+#include "document-portal/document-enums.h"
 
 #include "can-use-fuse.h"
 #include "utils.h"
@@ -321,6 +324,57 @@ unlink_doc_from_host (const char *basename, GError **error)
   return TRUE;
 }
 
+static char *
+export_dir (const char *path)
+{
+  int fd, fd_id;
+  g_autoptr(GUnixFDList) fd_list = NULL;
+  g_auto(GStrv) out_doc_ids = NULL;
+  g_autoptr(GVariant) out_extra = NULL;
+  const char *permissions[] = { "read", NULL };
+  GError *error = NULL;
+  gboolean res;
+
+  fd = open (path, O_PATH | O_CLOEXEC);
+  g_assert (fd >= 0);
+
+  fd_list = g_unix_fd_list_new ();
+  fd_id = g_unix_fd_list_append (fd_list, fd, &error);
+  g_assert_no_error (error);
+  close (fd);
+
+  res = xdp_dbus_documents_call_add_full_sync (documents,
+                                               g_variant_new_fixed_array (G_VARIANT_TYPE_HANDLE,
+                                                                          &fd_id, 1, sizeof (guint32)),
+                                               DOCUMENT_ADD_FLAGS_REUSE_EXISTING |
+                                               DOCUMENT_ADD_FLAGS_DIRECTORY,
+                                               "com.test.App1",
+                                               permissions,
+                                               fd_list,
+                                               &out_doc_ids,
+                                               &out_extra,
+                                               NULL,
+                                               NULL, &error);
+  g_assert_no_error (error);
+  g_assert (res);
+  g_assert_cmpint (g_strv_length (out_doc_ids), ==, 1);
+
+  return g_strdup (out_doc_ids[0]);
+}
+
+static char *
+lookup (const char *path)
+{
+  GError *error = NULL;
+  char *doc_id = NULL;
+
+  xdp_dbus_documents_call_lookup_sync (documents, path, &doc_id, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (doc_id != NULL);
+
+  return doc_id;
+}
+
 static void
 grant_permissions (const char *id, const char *app, gboolean write)
 {
@@ -457,6 +511,49 @@ test_create_doc (void)
   g_assert_cmpstr (id, !=, id5);
 }
 
+/* Exports from a folder that was replaced by another one since the
+ * last export must not use the old folder */
+static void
+test_export_swapped_dir (void)
+{
+  g_autofree char *dir = NULL;
+  g_autofree char *old_dir = NULL;
+  g_autofree char *file = NULL;
+  g_autofree char *id = NULL;
+  g_autofree char *id2 = NULL;
+  g_autofree char *id_again = NULL;
+  GError *error = NULL;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  dir = g_build_filename (outdir, "swapped", NULL);
+  old_dir = g_build_filename (outdir, "swapped-old", NULL);
+  file = g_build_filename (dir, "swapped-file", NULL);
+
+  g_assert_cmpint (g_mkdir (dir, 0700), ==, 0);
+  g_file_set_contents (file, "old", -1, &error);
+  g_assert_no_error (error);
+  id = export_file (file, FALSE);
+
+  /* Exported again right away, this goes through the cached parent
+   * directory, and the swap below happens while it is still cached */
+  id_again = export_file (file, FALSE);
+  g_assert_cmpstr (id, ==, id_again);
+
+  g_assert_cmpint (rename (dir, old_dir), ==, 0);
+  g_assert_cmpint (g_mkdir (dir, 0700), ==, 0);
+  g_file_set_contents (file, "new", -1, &error);
+  g_assert_no_error (error);
+
+  /* The old document refers to the old folder and is rejected */
+  assert_doc_not_exist (id, "swapped-file", NULL);
+
+  id2 = export_file (file, FALSE);
+  g_assert_cmpstr (id, !=, id2);
+  assert_doc_has_contents (id2, "swapped-file", NULL, "new");
+}
+
 static void
 test_recursive_doc (void)
 {
@@ -490,6 +587,645 @@ test_recursive_doc (void)
   g_assert_cmpstr (id, ==, id3);
 }
 
+static void
+test_lookup_doc (void)
+{
+  g_autofree char *id = NULL;
+  g_autofree char *host_path = NULL;
+  g_autofree char *doc_path = NULL;
+  g_autofree char *tmp_path = NULL;
+  g_autofree char *nodoc_path = NULL;
+  g_autofree char *looked_up = NULL;
+  const char *basename = "lookup-file";
+  GError *error = NULL;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  id = export_new_file (basename, "lookup-content", FALSE);
+  host_path = g_build_filename (outdir, basename, NULL);
+  doc_path = make_doc_path (id, basename, NULL);
+
+  looked_up = lookup (host_path);
+  g_assert_cmpstr (looked_up, ==, id);
+  g_clear_pointer (&looked_up, g_free);
+
+  looked_up = lookup (doc_path);
+  g_assert_cmpstr (looked_up, ==, id);
+  g_clear_pointer (&looked_up, g_free);
+
+  /* Replacing the main file through fuse keeps it the document */
+  update_doc (id, basename, NULL, "lookup-content2", &error);
+  g_assert_no_error (error);
+  looked_up = lookup (doc_path);
+  g_assert_cmpstr (looked_up, ==, id);
+  g_clear_pointer (&looked_up, g_free);
+
+  /* And so does replacing it from the host */
+  update_from_host (basename, "lookup-content3", &error);
+  g_assert_no_error (error);
+  looked_up = lookup (doc_path);
+  g_assert_cmpstr (looked_up, ==, id);
+  g_clear_pointer (&looked_up, g_free);
+
+  /* Temporary files next to the main file are not the document */
+  update_doc (id, "lookup-tmp", NULL, "tmpdata", &error);
+  g_assert_no_error (error);
+  tmp_path = make_doc_path (id, "lookup-tmp", NULL);
+  looked_up = lookup (tmp_path);
+  g_assert_cmpstr (looked_up, ==, "");
+  g_clear_pointer (&looked_up, g_free);
+
+  nodoc_path = g_build_filename (outdir, "lookup-nodoc", NULL);
+  g_file_set_contents (nodoc_path, "nodoc", -1, &error);
+  g_assert_no_error (error);
+  looked_up = lookup (nodoc_path);
+  g_assert_cmpstr (looked_up, ==, "");
+}
+
+static void
+test_lookup_many (void)
+{
+  g_autofree char *id = NULL;
+  g_autofree char *host_path = NULL;
+  g_autofree char *doc_path = NULL;
+  g_autofree char *nodoc_path = NULL;
+  g_autofree char *missing_path = NULL;
+  g_autoptr(GVariant) results = NULL;
+  const char *looked_up;
+  const char *message;
+  GError *error = NULL;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  id = export_new_file ("lookup-many-file", "lookup-many", FALSE);
+  host_path = g_build_filename (outdir, "lookup-many-file", NULL);
+  doc_path = make_doc_path (id, "lookup-many-file", NULL);
+
+  nodoc_path = g_build_filename (outdir, "lookup-many-nodoc", NULL);
+  g_file_set_contents (nodoc_path, "nodoc", -1, &error);
+  g_assert_no_error (error);
+
+  missing_path = g_build_filename (outdir, "lookup-many-missing", NULL);
+
+  {
+    const char *filenames[] = { host_path, nodoc_path, missing_path, doc_path, NULL };
+
+    xdp_dbus_documents_call_lookup_many_sync (documents, filenames, &results, NULL, &error);
+    g_assert_no_error (error);
+  }
+
+  g_assert_cmpint (g_variant_n_children (results), ==, 4);
+
+  g_variant_get_child (results, 0, "(&s&s)", &looked_up, &message);
+  g_assert_cmpstr (looked_up, ==, id);
+  g_assert_cmpstr (message, ==, "");
+
+  g_variant_get_child (results, 1, "(&s&s)", &looked_up, &message);
+  g_assert_cmpstr (looked_up, ==, "");
+  g_assert_cmpstr (message, ==, "");
+
+  /* A failing entry doesn't fail the whole call */
+  g_variant_get_child (results, 2, "(&s&s)", &looked_up, &message);
+  g_assert_cmpstr (looked_up, ==, "");
+  g_assert_cmpstr (message, !=, "");
+
+  g_variant_get_child (results, 3, "(&s&s)", &looked_up, &message);
+  g_assert_cmpstr (looked_up, ==, id);
+  g_assert_cmpstr (message, ==, "");
+}
+
+static void
+test_lookup_replaced_doc (void)
+{
+  g_autofree char *id = NULL;
+  g_autofree char *doc_path = NULL;
+  g_autofree char *old_path = NULL;
+  g_autofree char *looked_up = NULL;
+  g_autoptr(GVariant) results = NULL;
+  const char *basename = "lookup-replaced";
+  const char *old_id;
+  int fd;
+  GError *error = NULL;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  id = export_new_file (basename, "old", FALSE);
+  doc_path = make_doc_path (id, basename, NULL);
+
+  fd = open (doc_path, O_PATH | O_CLOEXEC);
+  g_assert_cmpint (fd, >=, 0);
+  old_path = g_strdup_printf ("/proc/%d/fd/%d", getpid (), fd);
+
+  looked_up = lookup (old_path);
+  g_assert_cmpstr (looked_up, ==, id);
+  g_clear_pointer (&looked_up, g_free);
+
+  /* Replaced outside of fuse, the old file is no longer the document */
+  update_from_host (basename, "new", &error);
+  g_assert_no_error (error);
+
+  {
+    const char *filenames[] = { old_path, NULL };
+
+    xdp_dbus_documents_call_lookup_many_sync (documents, filenames, &results, NULL, &error);
+    g_assert_no_error (error);
+  }
+
+  g_assert_cmpint (g_variant_n_children (results), ==, 1);
+  g_variant_get_child (results, 0, "(&s&s)", &old_id, NULL);
+  g_assert_cmpstr (old_id, ==, "");
+
+  looked_up = lookup (doc_path);
+  g_assert_cmpstr (looked_up, ==, id);
+
+  close (fd);
+}
+
+static void
+test_info_many (void)
+{
+  g_autofree char *id = NULL;
+  g_autofree char *host_path = NULL;
+  g_autoptr(GVariant) results = NULL;
+  g_autoptr(GVariant) apps = NULL;
+  g_autofree const char **permissions = NULL;
+  const char *path;
+  const char *message;
+  GError *error = NULL;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  id = export_new_file ("info-many-file", "info-many", FALSE);
+  host_path = g_build_filename (outdir, "info-many-file", NULL);
+  grant_permissions (id, "com.test.App1", TRUE);
+
+  {
+    const char *ids[] = { id, "not-a-doc", NULL };
+
+    xdp_dbus_documents_call_info_many_sync (documents, ids, &results, NULL, &error);
+    g_assert_no_error (error);
+  }
+
+  g_assert_cmpint (g_variant_n_children (results), ==, 2);
+
+  g_variant_get_child (results, 0, "(^&ay@a{sas}&s)", &path, &apps, &message);
+  g_assert_cmpstr (path, ==, host_path);
+  g_assert_cmpstr (message, ==, "");
+  g_assert (g_variant_lookup (apps, "com.test.App1", "^a&s", &permissions));
+  g_assert (g_strv_contains (permissions, "read"));
+  g_assert (g_strv_contains (permissions, "write"));
+  g_clear_pointer (&apps, g_variant_unref);
+
+  g_variant_get_child (results, 1, "(^&ay@a{sas}&s)", &path, &apps, &message);
+  g_assert_cmpstr (path, ==, "");
+  g_assert_cmpint (g_variant_n_children (apps), ==, 0);
+  g_assert_cmpstr (message, !=, "");
+}
+
+static void
+test_nested_dir_docs (void)
+{
+  g_autofree char *outer_path = NULL;
+  g_autofree char *inner_path = NULL;
+  g_autofree char *file_path = NULL;
+  g_autofree char *outer_id = NULL;
+  g_autofree char *inner_id = NULL;
+  g_autofree char *looked_up = NULL;
+  g_autofree char *fuse_path = NULL;
+  GError *error = NULL;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  outer_path = g_build_filename (outdir, "nested-outer", NULL);
+  inner_path = g_build_filename (outer_path, "nested-inner", NULL);
+  file_path = g_build_filename (inner_path, "nested-file", NULL);
+
+  g_assert_cmpint (g_mkdir_with_parents (inner_path, 0700), ==, 0);
+  g_file_set_contents (file_path, "nested-content", -1, &error);
+  g_assert_no_error (error);
+
+  outer_id = export_dir (outer_path);
+  inner_id = export_dir (inner_path);
+  g_assert_cmpstr (outer_id, !=, inner_id);
+
+  /* Exporting again gives back the same documents */
+  looked_up = export_dir (inner_path);
+  g_assert_cmpstr (looked_up, ==, inner_id);
+  g_clear_pointer (&looked_up, g_free);
+
+  /* The file is visible through both documents */
+  assert_doc_has_contents (outer_id, "nested-outer/nested-inner/nested-file", NULL, "nested-content");
+  assert_doc_has_contents (inner_id, "nested-inner/nested-file", NULL, "nested-content");
+  assert_doc_has_contents (outer_id, "nested-outer/nested-inner/nested-file", "com.test.App1", "nested-content");
+  assert_doc_has_contents (inner_id, "nested-inner/nested-file", "com.test.App1", "nested-content");
+
+  looked_up = lookup (outer_path);
+  g_assert_cmpstr (looked_up, ==, outer_id);
+  g_clear_pointer (&looked_up, g_free);
+
+  looked_up = lookup (inner_path);
+  g_assert_cmpstr (looked_up, ==, inner_id);
+  g_clear_pointer (&looked_up, g_free);
+
+  /* On the fuse side only the document roots map to the documents,
+   * the inner directory seen through the outer document does not */
+  fuse_path = make_doc_path (outer_id, "nested-outer", NULL);
+  looked_up = lookup (fuse_path);
+  g_assert_cmpstr (looked_up, ==, outer_id);
+  g_clear_pointer (&looked_up, g_free);
+  g_clear_pointer (&fuse_path, g_free);
+
+  fuse_path = make_doc_path (inner_id, "nested-inner", NULL);
+  looked_up = lookup (fuse_path);
+  g_assert_cmpstr (looked_up, ==, inner_id);
+  g_clear_pointer (&looked_up, g_free);
+  g_clear_pointer (&fuse_path, g_free);
+
+  fuse_path = make_doc_path (outer_id, "nested-outer/nested-inner", NULL);
+  looked_up = lookup (fuse_path);
+  g_assert_cmpstr (looked_up, ==, "");
+  g_clear_pointer (&looked_up, g_free);
+  g_clear_pointer (&fuse_path, g_free);
+
+  fuse_path = make_doc_path (inner_id, "nested-inner/nested-file", NULL);
+  looked_up = lookup (fuse_path);
+  g_assert_cmpstr (looked_up, ==, "");
+  g_clear_pointer (&looked_up, g_free);
+  g_clear_pointer (&fuse_path, g_free);
+
+  /* Same through the app view */
+  fuse_path = make_doc_path (inner_id, "nested-inner", "com.test.App1");
+  looked_up = lookup (fuse_path);
+  g_assert_cmpstr (looked_up, ==, inner_id);
+}
+
+static char *
+doc_info_path (const char *id)
+{
+  g_autoptr(GVariant) apps = NULL;
+  GError *error = NULL;
+  char *path = NULL;
+
+  xdp_dbus_documents_call_info_sync (documents, id, &path, &apps, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (path != NULL);
+
+  return path;
+}
+
+/* Re-exporting a file inside a directory document gives a document
+ * for its current host path, also after renames through fuse */
+static void
+test_reexport_after_rename (void)
+{
+  g_autofree char *host_dir = NULL;
+  g_autofree char *host_sub = NULL;
+  g_autofree char *host_file = NULL;
+  g_autofree char *dir_id = NULL;
+  g_autofree char *fuse_sub = NULL;
+  g_autofree char *fuse_sub2 = NULL;
+  g_autofree char *fuse_file = NULL;
+  g_autofree char *file_id = NULL;
+  g_autofree char *doc_path = NULL;
+  g_autofree char *expected = NULL;
+  GError *error = NULL;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  host_dir = g_build_filename (outdir, "reexport", NULL);
+  host_sub = g_build_filename (host_dir, "sub", NULL);
+  host_file = g_build_filename (host_sub, "file", NULL);
+  g_assert_cmpint (g_mkdir_with_parents (host_sub, 0700), ==, 0);
+  g_file_set_contents (host_file, "reexport", -1, &error);
+  g_assert_no_error (error);
+
+  dir_id = export_dir (host_dir);
+  fuse_sub = make_doc_path (dir_id, "reexport/sub", NULL);
+  fuse_sub2 = make_doc_path (dir_id, "reexport/sub2", NULL);
+
+  fuse_file = g_build_filename (fuse_sub, "file", NULL);
+  file_id = export_file (fuse_file, FALSE);
+  doc_path = doc_info_path (file_id);
+  g_assert_cmpstr (doc_path, ==, host_file);
+  g_clear_pointer (&file_id, g_free);
+  g_clear_pointer (&doc_path, g_free);
+  g_clear_pointer (&fuse_file, g_free);
+
+  g_assert_cmpint (rename (fuse_sub, fuse_sub2), ==, 0);
+
+  fuse_file = g_build_filename (fuse_sub2, "file", NULL);
+  file_id = export_file (fuse_file, FALSE);
+  doc_path = doc_info_path (file_id);
+  expected = g_build_filename (host_dir, "sub2", "file", NULL);
+  g_assert_cmpstr (doc_path, ==, expected);
+}
+
+static gboolean
+dir_has_hidden_tempfiles (const char *path)
+{
+  g_autoptr(GDir) dir = NULL;
+  GError *error = NULL;
+  const char *name;
+
+  dir = g_dir_open (path, 0, &error);
+  g_assert_no_error (error);
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      if (g_str_has_prefix (name, ".xdp-"))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+dir_has_entry (const char *path, const char *entry)
+{
+  g_autoptr(GDir) dir = NULL;
+  GError *error = NULL;
+  const char *name;
+
+  dir = g_dir_open (path, 0, &error);
+  g_assert_no_error (error);
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      if (strcmp (name, entry) == 0)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+write_fd (int fd, const char *contents)
+{
+  gsize len = strlen (contents);
+
+  g_assert_cmpint (write (fd, contents, len), ==, len);
+  g_assert_cmpint (fsync (fd), ==, 0);
+}
+
+/* The way editors save: write a new file next to the document, then
+ * rename it over the document, optionally keeping a backup */
+static void
+test_save_via_rename (void)
+{
+  g_autofree char *host_dir = NULL;
+  g_autofree char *doc_dir = NULL;
+  g_autofree char *doc_path = NULL;
+  g_autofree char *tmp_path = NULL;
+  g_autofree char *backup_path = NULL;
+  g_autofree char *id = NULL;
+  const char *basename = "save-via-rename.txt";
+  gboolean has_tmpfile;
+  GError *error = NULL;
+  int fd;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  host_dir = g_build_filename (outdir, "save-via-rename", NULL);
+  g_assert_cmpint (g_mkdir_with_parents (host_dir, 0700), ==, 0);
+
+  /* Without O_TMPFILE the portal falls back to named temporary files */
+  fd = open (host_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  has_tmpfile = fd >= 0;
+  if (fd >= 0)
+    close (fd);
+
+  id = export_new_file ("save-via-rename/save-via-rename.txt", "original", FALSE);
+  doc_dir = make_doc_dir (id, NULL);
+  doc_path = make_doc_path (id, basename, NULL);
+  tmp_path = make_doc_path (id, ".save-via-rename.txt.swp", NULL);
+  backup_path = make_doc_path (id, "save-via-rename.txt~", NULL);
+
+  /* Write the new contents to a temporary file */
+  fd = open (tmp_path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+  g_assert_cmpint (fd, >=, 0);
+  write_fd (fd, "saved");
+  close (fd);
+
+  assert_doc_has_contents (id, ".save-via-rename.txt.swp", NULL, "saved");
+  g_assert (dir_has_entry (doc_dir, ".save-via-rename.txt.swp"));
+  g_assert (!dir_has_entry (host_dir, ".save-via-rename.txt.swp"));
+  if (has_tmpfile)
+    g_assert (!dir_has_hidden_tempfiles (host_dir));
+
+  /* Keep a backup of the old version, then replace the document */
+  g_assert_cmpint (rename (doc_path, backup_path), ==, 0);
+  assert_doc_has_contents (id, "save-via-rename.txt~", NULL, "original");
+  g_assert (!dir_has_entry (host_dir, basename));
+
+  g_assert_cmpint (rename (tmp_path, doc_path), ==, 0);
+  assert_doc_has_contents (id, basename, NULL, "saved");
+  assert_host_has_contents ("save-via-rename/save-via-rename.txt", "saved");
+  assert_doc_not_exist (id, ".save-via-rename.txt.swp", NULL);
+
+  g_assert_cmpint (unlink (backup_path), ==, 0);
+  assert_doc_not_exist (id, "save-via-rename.txt~", NULL);
+  g_assert (!dir_has_hidden_tempfiles (host_dir));
+
+  /* Replacing without a backup, several times in a row */
+  for (int i = 0; i < 3; i++)
+    {
+      g_autofree char *contents = g_strdup_printf ("saved%d", i);
+
+      fd = open (tmp_path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+      g_assert_cmpint (fd, >=, 0);
+      write_fd (fd, contents);
+      close (fd);
+
+      g_assert_cmpint (rename (tmp_path, doc_path), ==, 0);
+      assert_doc_has_contents (id, basename, NULL, contents);
+      assert_host_has_contents ("save-via-rename/save-via-rename.txt", contents);
+      g_assert (!dir_has_hidden_tempfiles (host_dir));
+    }
+
+  /* A temporary file that is never renamed leaves nothing behind */
+  fd = open (tmp_path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+  g_assert_cmpint (fd, >=, 0);
+  write_fd (fd, "abandoned");
+  close (fd);
+  g_assert_cmpint (unlink (tmp_path), ==, 0);
+  assert_doc_not_exist (id, ".save-via-rename.txt.swp", NULL);
+  g_assert (!dir_has_hidden_tempfiles (host_dir));
+
+  /* Writes through an fd kept open across the rename go to the document */
+  fd = open (tmp_path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+  g_assert_cmpint (fd, >=, 0);
+  write_fd (fd, "kept");
+  g_assert_cmpint (rename (tmp_path, doc_path), ==, 0);
+  write_fd (fd, "-open");
+  close (fd);
+  assert_doc_has_contents (id, basename, NULL, "kept-open");
+  assert_host_has_contents ("save-via-rename/save-via-rename.txt", "kept-open");
+  g_assert (!dir_has_hidden_tempfiles (host_dir));
+
+  /* The same through g_file_set_contents() */
+  update_doc (id, basename, NULL, "set-contents", &error);
+  g_assert_no_error (error);
+  assert_host_has_contents ("save-via-rename/save-via-rename.txt", "set-contents");
+  g_assert (!dir_has_hidden_tempfiles (host_dir));
+}
+
+typedef struct {
+  const char *doc_dir;
+  int index;
+  int n_created;
+} TempfileThread;
+
+#define TEMPFILE_THREADS 4
+#define TEMPFILE_ROUNDS 20
+
+static gpointer
+tempfile_thread_func (gpointer user_data)
+{
+  TempfileThread *t = user_data;
+
+  for (int i = 0; i < TEMPFILE_ROUNDS; i++)
+    {
+      g_autofree char *own_name = g_strdup_printf (".tmp-%d-%d", t->index, i);
+      g_autofree char *own_path = g_build_filename (t->doc_dir, own_name, NULL);
+      g_autofree char *shared_path = g_build_filename (t->doc_dir, ".tmp-shared", NULL);
+      g_autofree char *doc_path = g_build_filename (t->doc_dir, "tempfile-race.txt", NULL);
+      int fd;
+
+      /* All threads race to create the same name, at most one wins */
+      fd = open (shared_path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+      if (fd >= 0)
+        {
+          t->n_created++;
+          close (fd);
+          g_assert_cmpint (unlink (shared_path), ==, 0);
+        }
+      else
+        g_assert_cmpint (errno, ==, EEXIST);
+
+      fd = open (own_path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+      g_assert_cmpint (fd, >=, 0);
+      write_fd (fd, "saved");
+      close (fd);
+
+      g_assert_cmpint (rename (own_path, doc_path), ==, 0);
+    }
+
+  return NULL;
+}
+
+/* Several writers creating and renaming temporary files in the same
+ * document at once */
+static void
+test_concurrent_tempfiles (void)
+{
+  g_autofree char *host_dir = NULL;
+  g_autofree char *doc_dir = NULL;
+  g_autofree char *id = NULL;
+  TempfileThread threads[TEMPFILE_THREADS] = { { 0 } };
+  GThread *handles[TEMPFILE_THREADS];
+  int n_created = 0;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  host_dir = g_build_filename (outdir, "tempfile-race", NULL);
+  g_assert_cmpint (g_mkdir_with_parents (host_dir, 0700), ==, 0);
+
+  id = export_new_file ("tempfile-race/tempfile-race.txt", "original", FALSE);
+  doc_dir = make_doc_dir (id, NULL);
+
+  for (int i = 0; i < TEMPFILE_THREADS; i++)
+    {
+      threads[i].doc_dir = doc_dir;
+      threads[i].index = i;
+      handles[i] = g_thread_new ("tempfile", tempfile_thread_func, &threads[i]);
+    }
+
+  for (int i = 0; i < TEMPFILE_THREADS; i++)
+    {
+      g_thread_join (handles[i]);
+      n_created += threads[i].n_created;
+    }
+
+  g_assert_cmpint (n_created, >, 0);
+  assert_doc_has_contents (id, "tempfile-race.txt", NULL, "saved");
+  assert_host_has_contents ("tempfile-race/tempfile-race.txt", "saved");
+  assert_doc_not_exist (id, ".tmp-shared", NULL);
+  g_assert (!dir_has_hidden_tempfiles (host_dir));
+}
+
+static void
+test_xattrs (void)
+{
+  g_autofree char *dir_path = NULL;
+  g_autofree char *host_file = NULL;
+  g_autofree char *id = NULL;
+  g_autofree char *doc_file = NULL;
+  char buf[64];
+  ssize_t res;
+  GError *error = NULL;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  dir_path = g_build_filename (outdir, "xattr-dir", NULL);
+  host_file = g_build_filename (dir_path, "xattr-file", NULL);
+  g_assert_cmpint (g_mkdir_with_parents (dir_path, 0700), ==, 0);
+  g_file_set_contents (host_file, "xattr-content", -1, &error);
+  g_assert_no_error (error);
+
+  if (setxattr (host_file, "user.xdp-probe", "1", 1, 0) != 0)
+    {
+      g_test_skip ("No user xattrs on the test filesystem");
+      return;
+    }
+  g_assert_cmpint (removexattr (host_file, "user.xdp-probe"), ==, 0);
+
+  id = export_dir (dir_path);
+  doc_file = make_doc_path (id, "xattr-dir/xattr-file", NULL);
+
+  /* Missing attributes, twice so the second reply comes from the cache */
+  for (int i = 0; i < 2; i++)
+    {
+      res = getxattr (doc_file, "user.xdp-test", buf, sizeof (buf));
+      g_assert_cmpint (res, ==, -1);
+      g_assert_cmpint (errno, ==, ENODATA);
+    }
+
+  /* Setting it through fuse is visible right away */
+  g_assert_cmpint (setxattr (doc_file, "user.xdp-test", "value1", 6, 0), ==, 0);
+  res = getxattr (doc_file, "user.xdp-test", buf, sizeof (buf));
+  g_assert_cmpint (res, ==, 6);
+  g_assert (memcmp (buf, "value1", 6) == 0);
+
+  res = getxattr (host_file, "user.xdp-test", buf, sizeof (buf));
+  g_assert_cmpint (res, ==, 6);
+
+  res = listxattr (doc_file, buf, sizeof (buf));
+  g_assert_cmpint (res, >, 0);
+  g_assert (memmem (buf, res, "user.xdp-test", strlen ("user.xdp-test") + 1) != NULL);
+
+  /* And so is removing it */
+  g_assert_cmpint (removexattr (doc_file, "user.xdp-test"), ==, 0);
+  res = getxattr (doc_file, "user.xdp-test", buf, sizeof (buf));
+  g_assert_cmpint (res, ==, -1);
+  g_assert_cmpint (errno, ==, ENODATA);
+
+  /* Changes from outside show up once the cached reply expires */
+  g_assert_cmpint (setxattr (host_file, "user.xdp-test", "value2", 6, 0), ==, 0);
+  g_usleep (G_USEC_PER_SEC + G_USEC_PER_SEC / 2);
+  res = getxattr (doc_file, "user.xdp-test", buf, sizeof (buf));
+  g_assert_cmpint (res, ==, 6);
+  g_assert (memcmp (buf, "value2", 6) == 0);
+}
+
 static void
 test_create_docs (void)
 {
@@ -850,7 +1586,125 @@ test_version (void)
   if (!check_fuse_or_skip_test ())
     return;
 
-  g_assert_cmpint (xdp_dbus_documents_get_version (documents), ==, 4);
+  g_assert_cmpint (xdp_dbus_documents_get_version (documents), ==, 5);
+}
+
+static gboolean
+portal_has_owner (void)
+{
+  g_autoptr(GVariant) reply = NULL;
+  GError *error = NULL;
+  gboolean has_owner;
+
+  reply = g_dbus_connection_call_sync (session_bus,
+                                       "org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus",
+                                       "NameHasOwner",
+                                       g_variant_new ("(s)", "org.freedesktop.portal.Documents"),
+                                       G_VARIANT_TYPE ("(b)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1, NULL, &error);
+  g_assert_no_error (error);
+  g_variant_get (reply, "(b)", &has_owner);
+
+  return has_owner;
+}
+
+static void
+kill_portal (void)
+{
+  g_autoptr(GVariant) reply = NULL;
+  GError *error = NULL;
+  guint32 pid;
+
+  reply = g_dbus_connection_call_sync (session_bus,
+                                       "org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus",
+                                       "GetConnectionUnixProcessID",
+                                       g_variant_new ("(s)", "org.freedesktop.portal.Documents"),
+                                       G_VARIANT_TYPE ("(u)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1, NULL, &error);
+  g_assert_no_error (error);
+  g_variant_get (reply, "(u)", &pid);
+
+  g_assert_cmpint (kill (pid, SIGKILL), ==, 0);
+
+  for (int i = 0; i < 100 && portal_has_owner (); i++)
+    g_usleep (G_USEC_PER_SEC / 20);
+  g_assert (!portal_has_owner ());
+}
+
+/* Waits until the portal saved the transient document */
+static void
+wait_for_checkpoint (const char *id)
+{
+  g_autofree char *path = g_build_filename (outdir, "xdg-document-portal", "transient-documents", NULL);
+
+  for (int i = 0; i < 100; i++)
+    {
+      g_autofree char *contents = NULL;
+      gsize length;
+
+      if (g_file_get_contents (path, &contents, &length, NULL) &&
+          memmem (contents, length, id, strlen (id)) != NULL)
+        return;
+
+      g_usleep (G_USEC_PER_SEC / 20);
+    }
+
+  g_assert_not_reached ();
+}
+
+/* Transient documents and their permissions survive the portal being
+ * killed and started again. This must run last, as it restarts the
+ * portal. */
+static void
+test_restart (void)
+{
+  g_autofree char *id = NULL;
+  g_autofree char *doc_path = NULL;
+  g_autofree char *new_mountpoint = NULL;
+  g_autofree char *contents = NULL;
+  GError *error = NULL;
+  int fd;
+
+  if (!check_fuse_or_skip_test ())
+    return;
+
+  id = export_new_file ("restart-file", "restart-content", FALSE);
+  grant_permissions (id, "com.test.App1", FALSE);
+  /* Let the checkpoint include the grant, not only the new document */
+  g_usleep (G_USEC_PER_SEC / 2);
+  wait_for_checkpoint (id);
+
+  doc_path = make_doc_path (id, "restart-file", NULL);
+
+  /* A client keeping the document open while the portal goes away */
+  fd = open (doc_path, O_RDONLY | O_CLOEXEC);
+  g_assert_cmpint (fd, >=, 0);
+
+  kill_portal ();
+
+  /* Starts a new instance */
+  xdp_dbus_documents_call_get_mount_point_sync (documents, &new_mountpoint, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (new_mountpoint, ==, mountpoint);
+
+  close (fd);
+
+  /* The same path works again, with the same permissions */
+  g_file_get_contents (doc_path, &contents, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (contents, ==, "restart-content");
+
+  assert_doc_has_contents (id, "restart-file", "com.test.App1", "restart-content");
+  assert_doc_not_exist (id, "restart-file", "com.test.App2");
+  update_doc (id, "restart-file", "com.test.App1", "restart-content2", &error);
+  g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_ACCES);
+  g_clear_error (&error);
 }
 
 int
@@ -862,9 +1716,20 @@ main (int argc, char **argv)
 
   g_test_add_func ("/db/version", test_version);
   g_test_add_func ("/db/create_doc", test_create_doc);
+  g_test_add_func ("/db/export_swapped_dir", test_export_swapped_dir);
   g_test_add_func ("/db/recursive_doc", test_recursive_doc);
   g_test_add_func ("/db/create_docs", test_create_docs);
+  g_test_add_func ("/db/lookup_doc", test_lookup_doc);
+  g_test_add_func ("/db/lookup_many", test_lookup_many);
+  g_test_add_func ("/db/lookup_replaced_doc", test_lookup_replaced_doc);
+  g_test_add_func ("/db/info_many", test_info_many);
+  g_test_add_func ("/db/nested_dir_docs", test_nested_dir_docs);
+  g_test_add_func ("/db/reexport_after_rename", test_reexport_after_rename);
+  g_test_add_func ("/db/save_via_rename", test_save_via_rename);
+  g_test_add_func ("/db/concurrent_tempfiles", test_concurrent_tempfiles);
+  g_test_add_func ("/db/xattrs", test_xattrs);
   g_test_add_func ("/db/add_named", test_add_named);
+  g_test_add_func ("/db/restart", test_restart);
 
   global_setup ();
 
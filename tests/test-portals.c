@@ -214,6 +214,7 @@ global_setup (void)
   g_subprocess_launcher_setenv (launcher, "G_DEBUG", "fatal-criticals", TRUE);
   g_subprocess_launcher_setenv (launcher, "DBUS_SESSION_BUS_ADDRESS", g_test_dbus_get_bus_address (dbus), TRUE);
   g_subprocess_launcher_setenv (launcher, "XDG_DESKTOP_PORTAL_DIR", portal_dir, TRUE);
+  g_subprocess_launcher_setenv (launcher, "XDG_DESKTOP_PORTAL_METRICS", "1", TRUE);
   g_subprocess_launcher_setenv (launcher, "XDG_DATA_HOME", outdir, TRUE);
   g_subprocess_launcher_setenv (launcher, "PATH", g_getenv ("PATH"), TRUE);
   g_subprocess_launcher_take_stdout_fd (launcher, xdup (STDERR_FILENO));
@@ -432,7 +433,7 @@ DEFINE_TEST_EXISTS(notification, NOTIFICATION, 1)
 DEFINE_TEST_EXISTS(open_uri, OPEN_URI, 3)
 DEFINE_TEST_EXISTS(print, PRINT, 1)
 DEFINE_TEST_EXISTS(proxy_resolver, PROXY_RESOLVER, 1)
-DEFINE_TEST_EXISTS(screenshot, SCREENSHOT, 2)
+DEFINE_TEST_EXISTS(screenshot, SCREENSHOT, 3)
 DEFINE_TEST_EXISTS(settings, SETTINGS, 1)
 DEFINE_TEST_EXISTS(trash, TRASH, 1)
 DEFINE_TEST_EXISTS(wallpaper, WALLPAPER, 1)
@@ -487,6 +488,9 @@ main (int argc, char **argv)
   g_test_add_func ("/portal/screenshot/cancel", test_screenshot_cancel);
   g_test_add_func ("/portal/screenshot/close", test_screenshot_close);
   g_test_add_func ("/portal/screenshot/parallel", test_screenshot_parallel);
+  g_test_add_func ("/portal/screenshot/fd", test_screenshot_fd);
+  g_test_add_func ("/portal/screenshot/fd-error", test_screenshot_fd_error);
+  g_test_add_func ("/portal/screenshot/metrics", test_screenshot_metrics);
 
   g_test_add_func ("/portal/color/basic", test_color_basic);
   g_test_add_func ("/portal/color/delay", test_color_delay);
@@ -551,6 +555,7 @@ main (int argc, char **argv)
   g_test_add_func ("/portal/inhibit/parallel", test_inhibit_parallel);
   g_test_add_func ("/portal/inhibit/permissions", test_inhibit_permissions);
   g_test_add_func ("/portal/inhibit/monitor", test_inhibit_monitor);
+  g_test_add_func ("/portal/inhibit/monitor_query_end_burst", test_inhibit_monitor_query_end_burst);
 
   g_test_add_func ("/portal/openuri/http", test_open_uri_http);
   g_test_add_func ("/portal/openuri/http2", test_open_uri_http2);
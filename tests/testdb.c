@@ -347,6 +347,113 @@ test_modify (void)
   }
 }
 
+static void
+check_iter (PermissionDb *db,
+            const char   *app,
+            const char  **expected)
+{
+  g_auto(PermissionDbIter) iter = { 0, };
+  g_autoptr(GPtrArray) seen = g_ptr_array_new_with_free_func (g_free);
+  const char *id;
+  PermissionDbEntry *entry;
+  int i;
+
+  permission_db_iter_init (&iter, db, app);
+  while (permission_db_iter_next (&iter, &id, &entry))
+    {
+      g_autoptr(PermissionDbEntry) looked_up = permission_db_lookup (db, id);
+
+      g_assert (looked_up != NULL);
+      g_assert (g_variant_equal ((GVariant *) entry, (GVariant *) looked_up));
+      g_assert (!g_ptr_array_find_with_equal_func (seen, id, g_str_equal, NULL));
+      g_ptr_array_add (seen, g_strdup (id));
+    }
+
+  g_assert_cmpint (seen->len, ==, g_strv_length ((char **) expected));
+  for (i = 0; expected[i] != NULL; i++)
+    g_assert (g_ptr_array_find_with_equal_func (seen, expected[i], g_str_equal, NULL));
+}
+
+static void
+test_iter (void)
+{
+  g_autoptr(PermissionDb) db = NULL;
+  const char *all[] = { "foo", "bar", "gazonk", NULL };
+  const char *app[] = { "foo", "bar", NULL };
+  const char *eapp[] = { "gazonk", NULL };
+  const char *none[] = { NULL };
+  const char *permissions[] = { "read", NULL };
+
+  /* Mix serialized entries with pending updates */
+  db = create_test_db (TRUE);
+
+  {
+    g_autoptr(PermissionDbEntry) entry1 = NULL;
+    g_autoptr(PermissionDbEntry) entry2 = NULL;
+
+    entry1 = permission_db_entry_new (g_variant_new_string ("gazonk-data"));
+    entry2 = permission_db_entry_set_app_permissions (entry1, "org.test.eapp", permissions);
+    permission_db_set_entry (db, "gazonk", entry2);
+  }
+
+  {
+    g_autoptr(PermissionDbEntry) entry1 = NULL;
+    g_autoptr(PermissionDbEntry) entry2 = NULL;
+
+    entry1 = permission_db_lookup (db, "foo");
+    entry2 = permission_db_entry_set_app_permissions (entry1, "org.test.app", permissions);
+    permission_db_set_entry (db, "foo", entry2);
+  }
+
+  check_iter (db, NULL, all);
+  check_iter (db, "org.test.app", app);
+  check_iter (db, "org.test.eapp", eapp);
+  check_iter (db, "org.test.noapp", none);
+
+  permission_db_set_entry (db, "bar", NULL);
+
+  {
+    const char *remaining[] = { "foo", "gazonk", NULL };
+    const char *remaining_app[] = { "foo", NULL };
+
+    check_iter (db, NULL, remaining);
+    check_iter (db, "org.test.app", remaining_app);
+  }
+
+  permission_db_update (db);
+
+  {
+    const char *remaining[] = { "foo", "gazonk", NULL };
+
+    check_iter (db, NULL, remaining);
+    check_iter (db, "org.test.eapp", eapp);
+  }
+}
+
+static void
+test_app_permissions (void)
+{
+  g_autoptr(PermissionDb) db = NULL;
+  g_autoptr(PermissionDbEntry) entry1 = NULL;
+  g_autoptr(PermissionDbEntry) entry2 = NULL;
+  g_autoptr(GVariant) perms = NULL;
+  g_autofree const char **app_perms = NULL;
+  const char *no_permissions[] = { NULL };
+
+  db = create_test_db (TRUE);
+
+  entry1 = permission_db_lookup (db, "foo");
+  entry2 = permission_db_entry_set_app_permissions (entry1, "org.test.bapp", no_permissions);
+
+  perms = g_variant_ref_sink (permission_db_entry_get_app_permissions (entry2));
+  g_assert_cmpstr (g_variant_get_type_string (perms), ==, "a{sas}");
+  g_assert_cmpint (g_variant_n_children (perms), ==, 2);
+  g_assert (!g_variant_lookup (perms, "org.test.bapp", "^a&s", &app_perms));
+  g_assert (g_variant_lookup (perms, "org.test.app", "^a&s", &app_perms));
+  g_assert (g_strv_contains (app_perms, "read"));
+  g_assert (g_strv_contains (app_perms, "write"));
+}
+
 int
 main (int argc, char **argv)
 {
@@ -355,6 +462,8 @@ main (int argc, char **argv)
   g_test_add_func ("/db/open", test_db_open);
   g_test_add_func ("/db/serialize", test_serialize);
   g_test_add_func ("/db/modify", test_modify);
+  g_test_add_func ("/db/iter", test_iter);
+  g_test_add_func ("/db/app-permissions", test_app_permissions);
 
   return g_test_run ();
 }
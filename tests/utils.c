@@ -2,6 +2,9 @@
 
 #include "utils.h"
 
+#include <signal.h>
+#include <stdarg.h>
+
 #include <glib/gstdio.h>
 
 /*
@@ -59,3 +62,224 @@ setup_dbus_daemon_wrapper (const char *outdir)
   g_chmod (file_name, 0700);
   g_assert_no_error (error);
 }
+
+/* Sets up a scratch directory, used as XDG_RUNTIME_DIR and
+ * XDG_DATA_HOME, and a session bus that can activate the services
+ * built in the tree.
+ */
+BenchEnv *
+bench_env_new (void)
+{
+  g_autofree char *services = NULL;
+  g_autoptr(GError) error = NULL;
+  BenchEnv *env;
+
+  env = g_new0 (BenchEnv, 1);
+  env->outdir = g_dir_make_tmp ("xdp-bench-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  g_setenv ("XDG_RUNTIME_DIR", env->outdir, TRUE);
+  g_setenv ("XDG_DATA_HOME", env->outdir, TRUE);
+
+  setup_dbus_daemon_wrapper (env->outdir);
+
+  env->dbus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  services = g_test_build_filename (G_TEST_BUILT, "services", NULL);
+  g_test_dbus_add_service_dir (env->dbus, services);
+  g_test_dbus_up (env->dbus);
+
+  /* g_test_dbus_up unsets this, so re-set */
+  g_setenv ("XDG_RUNTIME_DIR", env->outdir, TRUE);
+
+  env->bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  g_assert_no_error (error);
+
+  env->subprocesses = g_ptr_array_new_with_free_func (g_object_unref);
+
+  return env;
+}
+
+void
+bench_env_free (BenchEnv *env)
+{
+  char *rm_argv[] = { "rm", "-rf", env->outdir, NULL };
+
+  g_dbus_connection_close_sync (env->bus, NULL, NULL);
+  g_clear_object (&env->bus);
+
+  for (guint i = 0; i < env->subprocesses->len; i++)
+    {
+      GSubprocess *subprocess = g_ptr_array_index (env->subprocesses, i);
+
+      g_subprocess_send_signal (subprocess, SIGTERM);
+      g_subprocess_wait (subprocess, NULL, NULL);
+    }
+  g_ptr_array_unref (env->subprocesses);
+
+  g_test_dbus_down (env->dbus);
+  g_clear_object (&env->dbus);
+
+  g_spawn_sync (NULL, rm_argv, NULL, G_SPAWN_SEARCH_PATH,
+                NULL, NULL, NULL, NULL, NULL, NULL);
+
+  g_free (env->outdir);
+  g_free (env);
+}
+
+static GSubprocess *
+bench_env_spawnv (BenchEnv          *env,
+                  GSubprocessFlags   flags,
+                  GError           **error,
+                  const char        *path,
+                  va_list            args)
+{
+  g_autoptr(GSubprocessLauncher) launcher = NULL;
+  g_autoptr(GPtrArray) argv = g_ptr_array_new ();
+  g_autofree char *portal_dir = NULL;
+  const char *arg;
+
+  portal_dir = g_test_build_filename (G_TEST_DIST, "portals", NULL);
+
+  launcher = g_subprocess_launcher_new (flags);
+  g_subprocess_launcher_setenv (launcher, "DBUS_SESSION_BUS_ADDRESS", g_test_dbus_get_bus_address (env->dbus), TRUE);
+  g_subprocess_launcher_setenv (launcher, "XDG_DESKTOP_PORTAL_DIR", portal_dir, TRUE);
+  g_subprocess_launcher_setenv (launcher, "XDG_DATA_HOME", env->outdir, TRUE);
+  g_subprocess_launcher_setenv (launcher, "XDG_RUNTIME_DIR", env->outdir, TRUE);
+
+  g_ptr_array_add (argv, (char *) path);
+  while ((arg = va_arg (args, const char *)) != NULL)
+    g_ptr_array_add (argv, (char *) arg);
+  g_ptr_array_add (argv, NULL);
+
+  return g_subprocess_launcher_spawnv (launcher, (const char * const *) argv->pdata, error);
+}
+
+/* Spawns a daemon on the bus of @env. The caller owns it. */
+GSubprocess *
+bench_env_spawn (BenchEnv          *env,
+                 GSubprocessFlags   flags,
+                 GError           **error,
+                 const char        *path,
+                 ...)
+{
+  GSubprocess *subprocess;
+  va_list args;
+
+  va_start (args, path);
+  subprocess = bench_env_spawnv (env, flags, error, path, args);
+  va_end (args);
+
+  return subprocess;
+}
+
+/* Spawns a daemon that lives until bench_env_free(), and waits for it
+ * to appear on the bus.
+ */
+void
+bench_env_launch (BenchEnv   *env,
+                  const char *bus_name,
+                  const char *path,
+                  ...)
+{
+  g_autoptr(GError) error = NULL;
+  GSubprocess *subprocess;
+  va_list args;
+
+  va_start (args, path);
+  subprocess = bench_env_spawnv (env, G_SUBPROCESS_FLAGS_NONE, &error, path, args);
+  va_end (args);
+  g_assert_no_error (error);
+
+  g_ptr_array_add (env->subprocesses, subprocess);
+
+  if (!bench_wait_for_name (env->bus, bus_name, NULL))
+    g_error ("Failed to launch %s", path);
+}
+
+typedef struct {
+  const char *old_owner;
+  gboolean appeared;
+} NameWatch;
+
+static void
+name_appeared_cb (GDBusConnection *bus,
+                  const char      *name,
+                  const char      *name_owner,
+                  gpointer         data)
+{
+  NameWatch *watch = data;
+
+  if (g_strcmp0 (name_owner, watch->old_owner) != 0)
+    watch->appeared = TRUE;
+}
+
+/* Waits for the name to get an owner other than @old_owner, since a
+ * previous instance, or an activated one, may still own it.
+ */
+gboolean
+bench_wait_for_name (GDBusConnection *bus,
+                     const char      *name,
+                     const char      *old_owner)
+{
+  NameWatch watch = { old_owner, FALSE };
+  gint64 timeout;
+  guint id;
+
+  id = g_bus_watch_name_on_connection (bus, name, 0,
+                                       name_appeared_cb, NULL,
+                                       &watch, NULL);
+
+  timeout = g_get_monotonic_time () + 10 * G_USEC_PER_SEC;
+  while (!watch.appeared && g_get_monotonic_time () < timeout)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_bus_unwatch_name (id);
+
+  return watch.appeared;
+}
+
+void
+bench_print_json (JsonBuilder *builder)
+{
+  g_autoptr(JsonGenerator) generator = NULL;
+  g_autoptr(JsonNode) root = NULL;
+  g_autofree char *json = NULL;
+
+  root = json_builder_get_root (builder);
+  generator = json_generator_new ();
+  json_generator_set_pretty (generator, TRUE);
+  json_generator_set_root (generator, root);
+  json = json_generator_to_data (generator, NULL);
+  g_print ("%s\n", json);
+}
+
+char **
+bench_make_app_ids (int n_apps)
+{
+  char **app_ids = g_new0 (char *, n_apps + 1);
+
+  for (int i = 0; i < n_apps; i++)
+    app_ids[i] = g_strdup_printf ("org.test.App%d", i);
+
+  return app_ids;
+}
+
+/* A few apps are used by most documents, most apps are used by few */
+const char *
+bench_pick_app (GRand  *rand,
+                char  **app_ids,
+                int     n_apps)
+{
+  double r = g_rand_double (rand);
+
+  return app_ids[(int) (r * r * r * n_apps)];
+}
+
+/* Multiplying by an odd constant is a bijection, so ids are unique
+ * but not inserted in order.
+ */
+char *
+bench_make_id (guint i)
+{
+  return g_strdup_printf ("%08x", i * 2654435761u);
+}
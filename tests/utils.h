@@ -1,6 +1,7 @@
 #pragma once
 
 #include <gio/gio.h>
+#include <json-glib/json-glib.h>
 
 gboolean tests_set_property_sync (GDBusProxy *proxy,
                                   const char *iface,
@@ -9,3 +10,40 @@ gboolean tests_set_property_sync (GDBusProxy *proxy,
                                   GError **error);
 
 void setup_dbus_daemon_wrapper (const char *outdir);
+
+/* A private session bus and scratch directory for the benchmarks */
+typedef struct {
+  char *outdir;
+  GTestDBus *dbus;
+  GDBusConnection *bus;
+  GPtrArray *subprocesses;
+} BenchEnv;
+
+BenchEnv *bench_env_new (void);
+
+void bench_env_free (BenchEnv *env);
+
+GSubprocess *bench_env_spawn (BenchEnv          *env,
+                              GSubprocessFlags   flags,
+                              GError           **error,
+                              const char        *path,
+                              ...) G_GNUC_NULL_TERMINATED;
+
+void bench_env_launch (BenchEnv   *env,
+                       const char *bus_name,
+                       const char *path,
+                       ...) G_GNUC_NULL_TERMINATED;
+
+gboolean bench_wait_for_name (GDBusConnection *bus,
+                              const char      *name,
+                              const char      *old_owner);
+
+void bench_print_json (JsonBuilder *builder);
+
+char **bench_make_app_ids (int n_apps);
+
+const char *bench_pick_app (GRand  *rand,
+                            char  **app_ids,
+                            int     n_apps);
+
+char *bench_make_id (guint i);